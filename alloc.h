@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// All the heap allocations of the library go through `internal::Allocate()`
+// and `internal::Deallocate()`, tagged by the site allocating.
+//
+// The allocator is `internal::DefaultAllocator`, i.e. the global operator new,
+// unless MFUTURE_ALLOCATOR is defined as another class with the same static
+// members, e.g. allocating from an arena. It should be the same for the whole
+// program.
+//
+// With MFUTURE_ALLOC_STATS defined to 1, allocations are counted per thread
+// and per site as well, e.g. for tests to assert allocation budgets. Otherwise
+// counting costs nothing, as it's compiled out.
+#ifndef MFUTURE_ALLOCATOR
+#define MFUTURE_ALLOCATOR ::internal::DefaultAllocator
+#endif
+
+#ifndef MFUTURE_ALLOC_STATS
+#define MFUTURE_ALLOC_STATS 0
+#endif
+
+namespace internal {
+
+enum class AllocSite : std::uint8_t {
+  kFutureState,     // The shared state of a mfuture promise.
+  kContinuation,    // The continuation of Then() and the like.
+  kSharedState,     // The shared state of a SharedFuture.
+  kDoUntilState,    // The state of a pending DoUntil() loop.
+  kCoroutineFrame,  // A coroutine frame missed by the frame cache.
+  kWaiters,         // The waiters of a SharedFuture beyond the inline ones.
+  kPromisePool,     // The promises of a PromisePool.
+  kDeferredQueue,   // The continuations deferred by the trampoline.
+};
+
+constexpr std::size_t kNumAllocSites = 8;
+
+inline const char* AllocSiteName(AllocSite site) {
+  static constexpr const char* kNames[kNumAllocSites] = {
+      "future_state",   "continuation", "shared_state",
+      "do_until_state", "coroutine_frame", "waiters",
+      "promise_pool",   "deferred_queue"};
+  return kNames[static_cast<std::size_t>(site)];
+}
+
+struct DefaultAllocator {
+  static void* Allocate(std::size_t size) { return ::operator new(size); }
+
+  // `size` is the one allocated with.
+  static void Deallocate(void* p, std::size_t size) {
+    ::operator delete(p, size);
+  }
+};
+
+struct AllocStats {
+  std::uint64_t count = 0;  // Allocations made.
+  std::uint64_t bytes = 0;  // Bytes allocated.
+  // Allocations not released yet. A block released by another thread is
+  // counted there, so that one might go negative.
+  std::int64_t live = 0;
+  // The peak of `live`, of a single site only, as the peaks of several ones
+  // aren't simultaneous, so it's left 0 summing them.
+  std::int64_t peak = 0;
+
+  AllocStats& operator+=(const AllocStats& other) {
+    count += other.count;
+    bytes += other.bytes;
+    live += other.live;
+    return *this;
+  }
+};
+
+#if MFUTURE_ALLOC_STATS
+
+// The counters of the calling thread.
+inline AllocStats& ThreadAllocStats(AllocSite site) {
+  static thread_local AllocStats stats[kNumAllocSites];
+  return stats[static_cast<std::size_t>(site)];
+}
+
+// Summed over the sites, but the peak.
+inline AllocStats ThreadAllocStats() {
+  AllocStats total;
+  for (std::size_t i = 0; i < kNumAllocSites; ++i)
+    total += ThreadAllocStats(static_cast<AllocSite>(i));
+  return total;
+}
+
+inline void ResetThreadAllocStats() {
+  for (std::size_t i = 0; i < kNumAllocSites; ++i)
+    ThreadAllocStats(static_cast<AllocSite>(i)) = AllocStats{};
+}
+
+#endif  // MFUTURE_ALLOC_STATS
+
+inline void* Allocate(AllocSite site, std::size_t size) {
+#if MFUTURE_ALLOC_STATS
+  auto& stats = ThreadAllocStats(site);
+  ++stats.count;
+  stats.bytes += size;
+  if (++stats.live > stats.peak) stats.peak = stats.live;
+#else
+  (void)site;
+#endif
+  return MFUTURE_ALLOCATOR::Allocate(size);
+}
+
+inline void Deallocate(AllocSite site, void* p, std::size_t size) {
+#if MFUTURE_ALLOC_STATS
+  --ThreadAllocStats(site).live;
+#else
+  (void)site;
+#endif
+  MFUTURE_ALLOCATOR::Deallocate(p, size);
+}
+
+// A base of heap-allocated classes, so that `new` and `delete` of them go
+// through the allocation interface. Deleting is by the static type, i.e. the
+// most derived one.
+template <AllocSite kSite>
+struct Allocated {
+  static void* operator new(std::size_t size) { return Allocate(kSite, size); }
+
+  static void operator delete(void* p, std::size_t size) {
+    Deallocate(kSite, p, size);
+  }
+};
+
+// For std::allocate_shared() and the like.
+template <typename T, AllocSite kSite>
+struct SiteAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = SiteAllocator<U, kSite>;
+  };
+
+  SiteAllocator() = default;
+
+  template <typename U>
+  SiteAllocator(const SiteAllocator<U, kSite>&) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(Allocate(kSite, n * sizeof(T)));
+  }
+
+  void deallocate(T* p, std::size_t n) { Deallocate(kSite, p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const SiteAllocator<U, kSite>&) const {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const SiteAllocator<U, kSite>&) const {
+    return false;
+  }
+};
+
+// Same as std::vector, allocating by `kSite`.
+template <typename T, AllocSite kSite>
+using SiteVector = std::vector<T, SiteAllocator<T, kSite>>;
+
+// Same as std::make_shared(), allocating by `kSite`.
+template <typename T, AllocSite kSite, typename... Args>
+std::shared_ptr<T> MakeShared(Args&&... args) {
+  return std::allocate_shared<T>(SiteAllocator<T, kSite>(),
+                                 std::forward<Args>(args)...);
+}
+
+}  // namespace internal
@@ -0,0 +1,334 @@
+// Built with MFUTURE_ALLOC_STATS, and the allocator replaced by the one below,
+// so that allocation budgets are asserted.
+
+#include <cstddef>
+#include <new>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Keeps the bytes outstanding, which should agree with the stats.
+struct TestAllocator {
+  static void* Allocate(std::size_t size) {
+    bytes += size;
+    return ::operator new(size);
+  }
+
+  static void Deallocate(void* p, std::size_t size) {
+    bytes -= size;
+    ::operator delete(p, size);
+  }
+
+  static inline std::size_t bytes = 0;
+};
+
+}  // namespace
+
+#define MFUTURE_ALLOCATOR TestAllocator
+
+#include "alloc.h"
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if !MFUTURE_ALLOC_STATS
+#error "This test should be built with MFUTURE_ALLOC_STATS=1."
+#endif
+
+using internal::AllocSite;
+using internal::ThreadAllocStats;
+
+namespace {
+
+std::uint64_t Count(AllocSite site) { return ThreadAllocStats(site).count; }
+
+class AllocTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    internal::ResetThreadAllocStats();
+    bytes_ = TestAllocator::bytes;
+  }
+
+  void TearDown() override {
+    // Everything is released, but what's retained for reuse.
+    EXPECT_EQ(ThreadAllocStats().live, retained_);
+  }
+
+  // Outstanding in the allocator since the test started.
+  std::size_t Bytes() const { return TestAllocator::bytes - bytes_; }
+
+  std::size_t bytes_ = 0;
+  std::int64_t retained_ = 0;
+};
+
+}  // namespace
+
+TEST_F(AllocTest, nfuture_then) {
+  using namespace nfuture;
+
+  {
+    Promise<int> promise;
+    auto future = promise.GetFuture();
+    EXPECT_EQ(ThreadAllocStats().count, 0);
+
+    // Then on an unready future makes exactly one allocation.
+    auto f2 = future.Then([](int v) { return v + 1; });
+    EXPECT_EQ(Count(AllocSite::kContinuation), 1);
+    promise.SetValue(1);
+    EXPECT_EQ(f2.Value<0>(), 2);
+
+    // None on a ready one.
+    auto f3 = MakeReadyFuture<int>(1).Then([](int v) { return v + 1; });
+    EXPECT_EQ(ThreadAllocStats().count, 1);
+  }
+
+  // The continuation is retained for the next one of its type.
+  auto stats = ThreadAllocStats(AllocSite::kContinuation);
+  EXPECT_EQ(stats.peak, 1);
+  EXPECT_EQ(stats.live, 1);
+  EXPECT_EQ(Bytes(), stats.bytes);
+  retained_ = 1;
+}
+
+namespace {
+
+// Every level waits for `pending` and then calls itself in the callback.
+nfuture::Future<> AsyncLoop(int n, int& counter,
+                            std::optional<nfuture::Promise<>>& pending) {
+  if (n == 0) return nfuture::MakeReadyFuture<>();
+  return pending.emplace().GetFuture().Then([n, &counter, &pending]() {
+    ++counter;
+    return AsyncLoop(n - 1, counter, pending);
+  });
+}
+
+}  // namespace
+
+// A recursive asynchronous loop reuses the continuations of its levels, instead
+// of allocating one per iteration. Two are live at a time, the one running and
+// the next one it chains, so two are allocated for the whole loop, however long.
+TEST_F(AllocTest, nfuture_tail_call) {
+  int counter = 0;
+  std::optional<nfuture::Promise<>> pending;
+  auto future = AsyncLoop(1000, counter, pending);
+  std::uint64_t warmed_up = 0;
+  for (int i = 0; i < 1000; ++i) {
+    auto promise = std::move(*pending);
+    pending.reset();
+    promise.SetValue();
+    if (i == 1) warmed_up = Count(AllocSite::kContinuation);
+  }
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, 1000);
+  EXPECT_EQ(warmed_up, 2);
+  EXPECT_EQ(Count(AllocSite::kContinuation), warmed_up);
+  EXPECT_EQ(ThreadAllocStats().count, warmed_up);
+  EXPECT_EQ(ThreadAllocStats(AllocSite::kContinuation).peak, 2);
+  // The last one released is kept for the next loop.
+  retained_ = 1;
+}
+
+TEST_F(AllocTest, nfuture_shared_future) {
+  using namespace nfuture;
+
+  Promise<int> promise;
+  auto shared = promise.GetFuture().Share();
+  auto f1 = shared.GetFuture();
+  auto f2 = shared.GetFuture();
+  // The shared state only, waiters are inline.
+  EXPECT_EQ(Count(AllocSite::kSharedState), 1);
+  EXPECT_EQ(ThreadAllocStats().count, 1);
+
+  // Beyond the inline ones, they're moved out.
+  auto f3 = shared.GetFuture();
+  auto f4 = shared.GetFuture();
+  EXPECT_EQ(Count(AllocSite::kWaiters), 1);
+  EXPECT_EQ(ThreadAllocStats().count, 2);
+  promise.SetValue(1);
+}
+
+TEST_F(AllocTest, nfuture_promise_pool) {
+  using namespace nfuture;
+
+  {
+    // The promises and the free list, once.
+    PromisePool<int> pool(4);
+    EXPECT_EQ(Count(AllocSite::kPromisePool), 2);
+    for (int i = 0; i < 10; ++i) {
+      auto promise = pool.Acquire();
+      auto future = promise->GetFuture();
+      promise->SetValue(i);
+      pool.Release(promise);
+    }
+    EXPECT_EQ(ThreadAllocStats().count, 2);
+  }
+  EXPECT_EQ(Bytes(), 0);
+}
+
+TEST_F(AllocTest, deferred_queue) {
+  // On a thread of its own, as the queue is kept for the thread.
+  std::thread([] {
+    using internal::Trampoline;
+    auto nothing = [](void*) {};
+    for (int i = 0; i < 3; ++i)
+      Trampoline::RunInline([&] { Trampoline::Defer(nothing, nullptr); });
+    EXPECT_EQ(Count(AllocSite::kDeferredQueue), 1);
+    EXPECT_EQ(ThreadAllocStats(AllocSite::kDeferredQueue).live, 1);
+  }).join();
+}
+
+TEST_F(AllocTest, nfuture_do_until) {
+  using namespace nfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  auto future = DoUntil([n = 3]() mutable { return n-- == 0; },
+                        [&]() {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(Count(AllocSite::kDoUntilState), 1);
+  EXPECT_EQ(ThreadAllocStats().count, 1);
+}
+
+TEST_F(AllocTest, mfuture_then) {
+  using namespace mfuture;
+
+  {
+    // A promise allocates its shared state.
+    Promise<int> promise;
+    auto future = promise.GetFuture();
+    EXPECT_EQ(Count(AllocSite::kFutureState), 1);
+
+    // Then on an unready future makes a continuation and the state of the
+    // future it returns.
+    auto f2 = future.Then([](int v) { return v + 1; });
+    EXPECT_EQ(Count(AllocSite::kContinuation), 1);
+    EXPECT_EQ(Count(AllocSite::kFutureState), 2);
+    promise.SetValue(1);
+    EXPECT_EQ(f2.GetValue<0>(), 2);
+    EXPECT_EQ(ThreadAllocStats().count, 3);
+
+    // A ready one makes the states of both futures.
+    MakeReadyFuture<int>(1).Then([](int v) { return v + 1; });
+    EXPECT_EQ(Count(AllocSite::kFutureState), 4);
+    EXPECT_EQ(ThreadAllocStats().count, 5);
+  }
+  EXPECT_EQ(Bytes(), 0);
+}
+
+TEST_F(AllocTest, mfuture_then_value_or_error) {
+  using namespace mfuture;
+  auto on_value = [](int v) { return v + 1; };
+  auto on_error = [](std::exception_ptr) { return -1; };
+
+  {
+    // Either result costs the same as Then() on an unready future: the state
+    // of the promise, a continuation and the state of the future returned.
+    Promise<int> p1;
+    auto f1 = p1.GetFuture().ThenValueOrError(on_value, on_error);
+    p1.SetValue(1);
+    EXPECT_EQ(f1.GetValue<0>(), 2);
+    EXPECT_EQ(ThreadAllocStats().count, 3);
+
+    Promise<int> p2;
+    auto f2 = p2.GetFuture().ThenValueOrError(on_value, on_error);
+    p2.SetError(std::make_error_code(std::errc::timed_out));
+    EXPECT_TRUE(f2.HasErrorCode());
+    EXPECT_EQ(ThreadAllocStats().count, 6);
+    EXPECT_EQ(Count(AllocSite::kContinuation), 2);
+  }
+  EXPECT_EQ(Bytes(), 0);
+}
+
+TEST_F(AllocTest, mfuture_handle_exception) {
+  using namespace mfuture;
+  auto handler = [](const std::runtime_error&) { return -1; };
+
+  {
+    // The same as Then() on an unready future, whether it's recovered or
+    // passed on.
+    Promise<int> p1;
+    auto f1 = p1.GetFuture().HandleException<std::runtime_error>(handler);
+    p1.SetValue(1);
+    EXPECT_EQ(f1.GetValue<0>(), 1);
+    EXPECT_EQ(ThreadAllocStats().count, 3);
+
+    Promise<int> p2;
+    auto f2 = p2.GetFuture().HandleException<std::runtime_error>(handler);
+    p2.SetError(std::make_error_code(std::errc::timed_out));
+    EXPECT_TRUE(f2.HasErrorCode());
+    EXPECT_EQ(ThreadAllocStats().count, 6);
+    EXPECT_EQ(Count(AllocSite::kContinuation), 2);
+  }
+  EXPECT_EQ(Bytes(), 0);
+}
+
+TEST_F(AllocTest, mfuture_rearm) {
+  using namespace mfuture;
+
+  Promise<int> promise;
+  for (int i = 0; i < 3; ++i) {
+    auto future = promise.Rearm();
+    promise.SetValue(i);
+    EXPECT_EQ(future.GetValue<0>(), i);
+  }
+  // Re-armed in place.
+  EXPECT_EQ(ThreadAllocStats().count, 1);
+}
+
+TEST_F(AllocTest, mfuture_rearm_from_consumer) {
+  using namespace mfuture;
+
+  // A connection loop: each response re-arms the promise for the next one
+  // from within its consumer.
+  Promise<int> promise;
+  int sum = 0;
+  std::function<void(int)> consume = [&](int v) {
+    sum += v;
+    if (v < 10) promise.Rearm().Then(consume);
+  };
+  promise.GetFuture().Then(consume);
+  promise.SetValue(1);
+  auto warmed_up = ThreadAllocStats().count;
+  for (int i = 2; i <= 10; ++i) promise.SetValue(i);
+  EXPECT_EQ(sum, 55);
+  // The state is re-armed in place, so only Then() allocates its continuation
+  // and the state of the future it returns.
+  EXPECT_EQ(ThreadAllocStats().count - warmed_up, 8 * 2);
+  EXPECT_EQ(Count(AllocSite::kFutureState), 1 + 10);
+}
+
+TEST_F(AllocTest, mfuture_do_until) {
+  using namespace mfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  auto future = DoUntil([n = 10]() mutable { return n-- == 0; },
+                        [&]() {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  std::vector<std::uint64_t> counts;
+  while (pending) {
+    counts.push_back(ThreadAllocStats().count);
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.IsReady());
+  // The promise is re-armed in place from within the loop, so a step only
+  // chains the loop onto the future of the round.
+  ASSERT_EQ(counts.size(), 10);
+  for (std::size_t i = 1; i < counts.size(); ++i)
+    EXPECT_EQ(counts[i] - counts[i - 1], 3);
+}
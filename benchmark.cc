@@ -0,0 +1,639 @@
+// Benchmarks of mfuture and nfuture, against std::future and hand-written
+// callbacks as baselines. Each case is named `<case>/<library>`, and reports
+// the heap allocations per operation besides the time.
+//
+// The results are kept as JSON for comparison between releases, by
+// --benchmark_out=<file> --benchmark_out_format=json, then compared by
+// tools/compare.py of Google Benchmark. Build with -c opt.
+//
+// With --hw_counters, hardware counters are reported per operation as well:
+// cycles, instructions, branch misses, L1d and LLC read misses. They're read
+// by perf_event_open(2), counting user space only, which a perf_event_paranoid
+// of up to 2 allows. Counters unavailable, e.g. in a VM or under a stricter
+// setting, are left out, with a note on stderr.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The replaced operators pair malloc() with free(), which GCC takes for a
+// mismatch once inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace {
+
+// Heap allocations made so far, counted by the replaced operator new. The
+// benchmarks run on a single thread.
+std::uint64_t allocations = 0;
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  ++allocations;
+  if (auto p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+// A group of hardware counters of this thread, counted over the same period.
+// An event the CPU or the kernel doesn't support is left out.
+class HardwareCounters {
+ public:
+  struct Event {
+    const char* name;
+    std::uint32_t type;
+    std::uint64_t config;
+  };
+
+  static constexpr int kMaxEvents = 5;
+
+  // Opened by --hw_counters, once for all cases.
+  static HardwareCounters* Get() { return instance_; }
+
+  static void Open() {
+    static HardwareCounters counters;
+    if (counters.size_ > 0) instance_ = &counters;
+  }
+
+  int Size() const { return size_; }
+
+  const char* Name(int i) const { return events_[i].name; }
+
+  void Start() {
+#ifdef __linux__
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  // Stops counting, and reads the counts since Start() into `counts`, scaled
+  // up if the events were multiplexed.
+  void Stop(double (&counts)[kMaxEvents]) {
+#ifdef __linux__
+    ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // See PERF_FORMAT_GROUP of perf_event_open(2).
+    std::uint64_t buffer[3 + kMaxEvents] = {};
+    if (read(leader_, buffer, sizeof(buffer)) < 0) return;
+    auto enabled = buffer[1], running = buffer[2];
+    auto scale = running ? static_cast<double>(enabled) / running : 0;
+    for (int i = 0; i < size_; ++i) counts[i] = buffer[3 + i] * scale;
+#else
+    (void)counts;
+#endif
+  }
+
+ private:
+  HardwareCounters() {
+#ifdef __linux__
+    static constexpr auto kReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    static constexpr Event kEvents[kMaxEvents] = {
+        {"cycles/op", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions/op", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"branch-misses/op", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {"L1d-misses/op", PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | kReadMiss},
+        {"LLC-misses/op", PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_LL | kReadMiss},
+    };
+    for (auto& event : kEvents) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = event.type;
+      attr.config = event.config;
+      attr.disabled = leader_ < 0;  // Only the leader, the rest follow it.
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd < 0) {
+        std::fprintf(stderr, "Hardware counter %s unavailable: %s\n",
+                     event.name, std::strerror(errno));
+        continue;
+      }
+      if (leader_ < 0) leader_ = fd;
+      events_[size_++] = event;
+    }
+#else
+    std::fprintf(stderr, "Hardware counters unavailable on this platform\n");
+#endif
+  }
+
+  static inline HardwareCounters* instance_ = nullptr;
+
+  int leader_ = -1;
+  Event events_[kMaxEvents];
+  int size_ = 0;
+};
+
+// Reports the allocations per operation made during a run of a case, as well
+// as the hardware counters if they're on.
+class Measure {
+ public:
+  explicit Measure(benchmark::State& state)
+      : state_(state), allocations_(allocations) {
+    if (auto counters = HardwareCounters::Get()) counters->Start();
+  }
+
+  ~Measure() {
+    state_.counters["allocs/op"] =
+        benchmark::Counter(static_cast<double>(allocations - allocations_),
+                           benchmark::Counter::kAvgIterations);
+    if (auto counters = HardwareCounters::Get()) {
+      double counts[HardwareCounters::kMaxEvents] = {};
+      counters->Stop(counts);
+      for (int i = 0; i < counters->Size(); ++i) {
+        state_.counters[counters->Name(i)] = benchmark::Counter(
+            counts[i], benchmark::Counter::kAvgIterations);
+      }
+    }
+  }
+
+ private:
+  benchmark::State& state_;
+  std::uint64_t allocations_;
+};
+
+const std::error_code kTimedOut = std::make_error_code(std::errc::timed_out);
+
+// The hand-written baseline: the consumer registers a callback, which the
+// producer invokes with the result.
+using Callback = std::function<void(int)>;
+
+// Then() on a future already resolved.
+
+void ReadyThenMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    auto future =
+        mfuture::MakeReadyFuture<int>(1).Then([](int v) { return v + 1; });
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+}
+
+void ReadyThenNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    auto future =
+        nfuture::MakeReadyFuture<int>(1).Then([](int v) { return v + 1; });
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+}
+
+void ReadyThenStd(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    std::promise<int> promise;
+    promise.set_value(1);
+    benchmark::DoNotOptimize(promise.get_future().get() + 1);
+  }
+}
+
+void ReadyThenCallback(benchmark::State& state) {
+  Measure measure(state);
+  int result = 0;
+  for (auto _ : state) {
+    Callback callback([&result](int v) { result = v + 1; });
+    callback(1);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// Then() on a pending future, which is resolved afterwards.
+
+void UnreadyThenMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    mfuture::Promise<int> promise;
+    auto future = promise.GetFuture().Then([](int v) { return v + 1; });
+    promise.SetValue(1);
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+}
+
+void UnreadyThenNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    nfuture::Promise<int> promise;
+    auto future = promise.GetFuture().Then([](int v) { return v + 1; });
+    promise.SetValue(1);
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+}
+
+// Without continuations, the consumer blocks on get() instead.
+void UnreadyThenStd(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    std::promise<int> promise;
+    auto future = promise.get_future();
+    promise.set_value(1);
+    benchmark::DoNotOptimize(future.get() + 1);
+  }
+}
+
+void UnreadyThenCallback(benchmark::State& state) {
+  Measure measure(state);
+  int result = 0;
+  for (auto _ : state) {
+    Callback callback;
+    callback = [&result](int v) { result = v + 1; };
+    benchmark::DoNotOptimize(callback);
+    callback(1);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// A continuation returning a pending future, which is folded into the future
+// Then() returned.
+
+void FoldMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    mfuture::Promise<int> outer;
+    mfuture::Promise<int> inner;
+    auto future = outer.GetFuture().Then(
+        [&inner](int) { return inner.GetFuture(); });
+    outer.SetValue(1);
+    inner.SetValue(2);
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+}
+
+void FoldNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    nfuture::Promise<int> outer;
+    nfuture::Promise<int> inner;
+    auto future = outer.GetFuture().Then(
+        [&inner](int) { return inner.GetFuture(); });
+    outer.SetValue(1);
+    inner.SetValue(2);
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+}
+
+// An asynchronous loop of 10 steps, each waiting for a pending future.
+
+constexpr int kSteps = 10;
+
+void DoUntilMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    mfuture::Promise<> promise;
+    bool pending = false;
+    auto future = mfuture::DoUntil(
+        [n = kSteps]() mutable { return n-- == 0; },
+        [&]() {
+          pending = true;
+          return promise.Rearm();
+        });
+    while (pending) {
+      pending = false;
+      promise.SetValue();
+    }
+    benchmark::DoNotOptimize(future.IsReady());
+  }
+  state.SetItemsProcessed(state.iterations() * kSteps);
+}
+
+void DoUntilNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    nfuture::Promise<> promise;
+    bool pending = false;
+    auto future = nfuture::DoUntil(
+        [n = kSteps]() mutable { return n-- == 0; },
+        [&]() {
+          pending = true;
+          return promise.Rearm();
+        });
+    while (pending) {
+      pending = false;
+      promise.SetValue();
+    }
+    benchmark::DoNotOptimize(future.Ready());
+  }
+  state.SetItemsProcessed(state.iterations() * kSteps);
+}
+
+// A chain of `state.range(0)` continuations on a pending future.
+
+void DeepChainMfuture(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  for (auto _ : state) {
+    mfuture::Promise<int> promise;
+    auto future = promise.GetFuture();
+    for (int i = 0; i < length; ++i)
+      future = future.Then([](int v) { return v + 1; });
+    promise.SetValue(0);
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+void DeepChainNfuture(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  for (auto _ : state) {
+    nfuture::Promise<int> promise;
+    auto future = promise.GetFuture();
+    for (int i = 0; i < length; ++i)
+      future = future.Then([](int v) { return v + 1; });
+    promise.SetValue(0);
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+void DeepChainCallback(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  std::vector<std::function<int(int)>> callbacks;
+  for (auto _ : state) {
+    for (int i = 0; i < length; ++i)
+      callbacks.emplace_back([](int v) { return v + 1; });
+    int v = 0;
+    for (auto& callback : callbacks) v = callback(v);
+    benchmark::DoNotOptimize(v);
+    callbacks.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+// As above, with four distinct callback types in turn.
+
+void MixedChainMfuture(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  for (auto _ : state) {
+    mfuture::Promise<int> promise;
+    auto future = promise.GetFuture();
+    for (int i = 0; i < length; i += 4) {
+      future = future.Then([](int v) { return v + 1; })
+                   .Then([](int v) { return v * 3; })
+                   .Then([](int v) { return v - 2; })
+                   .Then([](int v) { return v >> 1; });
+    }
+    promise.SetValue(0);
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+void MixedChainNfuture(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  for (auto _ : state) {
+    nfuture::Promise<int> promise;
+    auto future = promise.GetFuture();
+    for (int i = 0; i < length; i += 4) {
+      future = future.Then([](int v) { return v + 1; })
+                   .Then([](int v) { return v * 3; })
+                   .Then([](int v) { return v - 2; })
+                   .Then([](int v) { return v >> 1; });
+    }
+    promise.SetValue(0);
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+void MixedChainCallback(benchmark::State& state) {
+  Measure measure(state);
+  const auto length = state.range(0);
+  std::vector<std::function<int(int)>> callbacks;
+  for (auto _ : state) {
+    for (int i = 0; i < length; i += 4) {
+      callbacks.emplace_back([](int v) { return v + 1; });
+      callbacks.emplace_back([](int v) { return v * 3; });
+      callbacks.emplace_back([](int v) { return v - 2; });
+      callbacks.emplace_back([](int v) { return v >> 1; });
+    }
+    int v = 0;
+    for (auto& callback : callbacks) v = callback(v);
+    benchmark::DoNotOptimize(v);
+    callbacks.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * length);
+}
+
+// A result fanned out to three consumers.
+
+constexpr int kConsumers = 3;
+
+void FanOutMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    mfuture::Promise<int> promise;
+    auto shared = promise.GetFuture().Share();
+    auto f1 = shared.GetFuture();
+    auto f2 = shared.GetFuture();
+    auto f3 = shared.GetFuture();
+    promise.SetValue(1);
+    benchmark::DoNotOptimize(f1.GetValue<0>() + f2.GetValue<0>() +
+                             f3.GetValue<0>());
+  }
+}
+
+void FanOutNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    nfuture::Promise<int> promise;
+    auto shared = promise.GetFuture().Share();
+    auto f1 = shared.GetFuture();
+    auto f2 = shared.GetFuture();
+    auto f3 = shared.GetFuture();
+    promise.SetValue(1);
+    benchmark::DoNotOptimize(f1.Value<0>() + f2.Value<0>() + f3.Value<0>());
+  }
+}
+
+void FanOutStd(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    std::promise<int> promise;
+    auto shared = promise.get_future().share();
+    promise.set_value(1);
+    int sum = 0;
+    for (int i = 0; i < kConsumers; ++i) sum += shared.get();
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+void FanOutCallback(benchmark::State& state) {
+  Measure measure(state);
+  std::vector<Callback> callbacks;
+  int sum = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < kConsumers; ++i)
+      callbacks.emplace_back([&sum](int v) { sum += v; });
+    for (auto& callback : callbacks) callback(1);
+    callbacks.clear();
+  }
+  benchmark::DoNotOptimize(sum);
+}
+
+// A failure skipping a Then() callback, then handled.
+
+void ExceptionMfuture(benchmark::State& state) {
+  Measure measure(state);
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  for (auto _ : state) {
+    auto future = mfuture::MakeExceptionalFuture<int>(std::exception_ptr(e))
+                      .Then([](int v) { return v + 1; })
+                      .HandleException<std::runtime_error>(
+                          [](const std::runtime_error&) { return 0; });
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+}
+
+void ExceptionNfuture(benchmark::State& state) {
+  Measure measure(state);
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  for (auto _ : state) {
+    auto future = nfuture::MakeExceptionalFuture<int>(std::exception_ptr(e))
+                      .Then([](int v) { return v + 1; })
+                      .HandleException<std::runtime_error>(
+                          [](const std::runtime_error&) { return 0; });
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+}
+
+// Without continuations, the failure is rethrown by get().
+void ExceptionStd(benchmark::State& state) {
+  Measure measure(state);
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  for (auto _ : state) {
+    std::promise<int> promise;
+    promise.set_exception(e);
+    int v;
+    try {
+      v = promise.get_future().get() + 1;
+    } catch (const std::runtime_error&) {
+      v = 0;
+    }
+    benchmark::DoNotOptimize(v);
+  }
+}
+
+void ExceptionCallback(benchmark::State& state) {
+  Measure measure(state);
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  for (auto _ : state) {
+    int v = 1;
+    std::function<void(std::exception_ptr)> on_error(
+        [&v](std::exception_ptr) { v = 0; });
+    on_error(e);
+    benchmark::DoNotOptimize(v);
+  }
+}
+
+// The same, failed by an error code instead.
+
+void ErrorCodeMfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    auto future = mfuture::MakeErrorFuture<int>(kTimedOut)
+                      .Then([](int v) { return v + 1; })
+                      .ThenOnError([](std::error_code) { return 0; });
+    benchmark::DoNotOptimize(future.GetValue<0>());
+  }
+}
+
+void ErrorCodeNfuture(benchmark::State& state) {
+  Measure measure(state);
+  for (auto _ : state) {
+    auto future = nfuture::MakeErrorFuture<int>(kTimedOut)
+                      .Then([](int v) { return v + 1; })
+                      .ThenOnError([](std::error_code) { return 0; });
+    benchmark::DoNotOptimize(future.Value<0>());
+  }
+}
+
+}  // namespace
+
+BENCHMARK(ReadyThenMfuture)->Name("ready_then/mfuture");
+BENCHMARK(ReadyThenNfuture)->Name("ready_then/nfuture");
+BENCHMARK(ReadyThenStd)->Name("ready_then/std");
+BENCHMARK(ReadyThenCallback)->Name("ready_then/callback");
+
+BENCHMARK(UnreadyThenMfuture)->Name("unready_then/mfuture");
+BENCHMARK(UnreadyThenNfuture)->Name("unready_then/nfuture");
+BENCHMARK(UnreadyThenStd)->Name("unready_then/std");
+BENCHMARK(UnreadyThenCallback)->Name("unready_then/callback");
+
+BENCHMARK(FoldMfuture)->Name("fold/mfuture");
+BENCHMARK(FoldNfuture)->Name("fold/nfuture");
+
+BENCHMARK(DoUntilMfuture)->Name("do_until/mfuture");
+BENCHMARK(DoUntilNfuture)->Name("do_until/nfuture");
+
+BENCHMARK(DeepChainMfuture)->Name("deep_chain/mfuture")->Arg(10)->Arg(1000);
+BENCHMARK(DeepChainNfuture)->Name("deep_chain/nfuture")->Arg(10)->Arg(1000);
+BENCHMARK(DeepChainCallback)->Name("deep_chain/callback")->Arg(10)->Arg(1000);
+
+BENCHMARK(MixedChainMfuture)->Name("mixed_chain/mfuture")->Arg(12)->Arg(1000);
+BENCHMARK(MixedChainNfuture)->Name("mixed_chain/nfuture")->Arg(12)->Arg(1000);
+BENCHMARK(MixedChainCallback)->Name("mixed_chain/callback")->Arg(12)->Arg(1000);
+
+BENCHMARK(FanOutMfuture)->Name("fan_out/mfuture");
+BENCHMARK(FanOutNfuture)->Name("fan_out/nfuture");
+BENCHMARK(FanOutStd)->Name("fan_out/std");
+BENCHMARK(FanOutCallback)->Name("fan_out/callback");
+
+BENCHMARK(ExceptionMfuture)->Name("exception/mfuture");
+BENCHMARK(ExceptionNfuture)->Name("exception/nfuture");
+BENCHMARK(ExceptionStd)->Name("exception/std");
+BENCHMARK(ExceptionCallback)->Name("exception/callback");
+
+BENCHMARK(ErrorCodeMfuture)->Name("error_code/mfuture");
+BENCHMARK(ErrorCodeNfuture)->Name("error_code/nfuture");
+
+int main(int argc, char** argv) {
+  // --hw_counters is taken here, the rest by Google Benchmark.
+  int n = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--hw_counters") == 0)
+      HardwareCounters::Open();
+    else
+      argv[n++] = argv[i];
+  }
+  argc = n;
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
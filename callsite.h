@@ -0,0 +1,291 @@
+#pragma once
+
+// Attribution of continuations to where they're chained, with
+// MFUTURE_CALLSITE_STATS defined to 1. Then(), ThenWrap() and DoUntil() take
+// the location of their caller as a trailing default argument, which is
+// interned as a compact id and stored in the continuation. As the continuation
+// runs, the invocation and the time it runs are counted for that callsite in
+// the counters of the running thread. Callbacks of futures already resolved
+// run inline within their callers, so they're not counted.
+//
+// The counters of each thread are registered, so that `MergedCallsiteStats()`
+// reads those of all the threads while they count, and the ones of a thread
+// exiting are merged into the registry, so that they're still counted.
+//
+// The location is captured by std::source_location since C++20, and by the
+// builtins GCC and Clang provide before that.
+//
+// Otherwise neither the parameters nor the counting are compiled in.
+
+#ifndef MFUTURE_CALLSITE_STATS
+#define MFUTURE_CALLSITE_STATS 0
+#endif
+
+#if MFUTURE_CALLSITE_STATS
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.h"
+
+#if __cplusplus >= 202002L && __has_include(<source_location>)
+#include <source_location>
+#define MFUTURE_HAS_SOURCE_LOCATION 1
+#endif
+
+namespace internal {
+
+struct Callsite {
+  const char* file;
+  std::uint32_t line;
+  const char* function;
+
+  // The location of the caller, when used as a default argument.
+#ifdef MFUTURE_HAS_SOURCE_LOCATION
+  static constexpr Callsite Current(
+      std::source_location location = std::source_location::current()) {
+    return {location.file_name(), location.line(), location.function_name()};
+  }
+#else
+  static constexpr Callsite Current(
+      const char* file = __builtin_FILE(),
+      std::uint32_t line = __builtin_LINE(),
+      const char* function = __builtin_FUNCTION()) {
+    return {file, line, function};
+  }
+#endif
+};
+
+struct CallsiteStats {
+  std::uint64_t invocations = 0;
+  std::uint64_t nanoseconds = 0;  // Accumulated running.
+};
+
+// Counted by its own thread, and read by any. The counters are allocated by
+// pages as callsites are first run on the thread, and published to readers
+// once allocated, so that counting takes no lock.
+class CallsiteRecorder {
+ public:
+  static constexpr std::size_t kPageSize = 256;
+  // Callsites beyond `kPageSize * kMaxPages` aren't counted.
+  static constexpr std::size_t kMaxPages = 256;
+
+  CallsiteRecorder();
+  ~CallsiteRecorder();
+
+  CallsiteRecorder(const CallsiteRecorder&) = delete;
+  CallsiteRecorder& operator=(const CallsiteRecorder&) = delete;
+
+  void Record(std::uint32_t id, std::uint64_t nanoseconds) {
+    auto index = id / kPageSize;
+    if (index >= kMaxPages) return;
+    auto page = pages_[index].load(std::memory_order_relaxed);
+    if (!page) {
+      page = new Page;
+      pages_[index].store(page, std::memory_order_release);
+    }
+    auto& counters = page->counters[id % kPageSize];
+    Add(counters.invocations, 1);
+    Add(counters.nanoseconds, nanoseconds);
+  }
+
+  // Adds the counters to `stats`, indexed by callsite id, which is extended as
+  // needed.
+  void MergeInto(std::vector<CallsiteStats>& stats) const {
+    for (std::size_t index = 0; index < kMaxPages; ++index) {
+      auto page = pages_[index].load(std::memory_order_acquire);
+      if (!page) continue;
+      for (std::size_t i = 0; i < kPageSize; ++i) {
+        auto& counters = page->counters[i];
+        auto invocations = counters.invocations.load(std::memory_order_relaxed);
+        if (!invocations) continue;
+        auto id = index * kPageSize + i;
+        if (stats.size() <= id) stats.resize(id + 1);
+        stats[id].invocations += invocations;
+        stats[id].nanoseconds +=
+            counters.nanoseconds.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Reset() {
+    for (auto& page : pages_) {
+      auto p = page.load(std::memory_order_relaxed);
+      if (!p) continue;
+      for (auto& counters : p->counters) {
+        counters.invocations.store(0, std::memory_order_relaxed);
+        counters.nanoseconds.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct Counters {
+    std::atomic<std::uint64_t> invocations{0};
+    std::atomic<std::uint64_t> nanoseconds{0};
+  };
+
+  struct Page {
+    Counters counters[kPageSize];
+  };
+
+  // Only written by its own thread, so it's a load and a store rather than a
+  // read-modify-write.
+  static void Add(std::atomic<std::uint64_t>& counter, std::uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  std::atomic<Page*> pages_[kMaxPages] = {};
+};
+
+// Callsites, numbered from 1 in the order first interned. Only taken by
+// interning a callsite new to the calling thread, and by readout.
+struct CallsiteRegistry {
+  struct Hash {
+    std::size_t operator()(const Callsite& callsite) const {
+      return std::hash<std::string_view>()(callsite.file) ^
+             std::hash<std::uint32_t>()(callsite.line);
+    }
+  };
+
+  struct Equal {
+    bool operator()(const Callsite& a, const Callsite& b) const {
+      return a.line == b.line && std::strcmp(a.file, b.file) == 0 &&
+             std::strcmp(a.function, b.function) == 0;
+    }
+  };
+
+  std::mutex mutex;
+  std::unordered_map<Callsite, std::uint32_t, Hash, Equal> ids;
+  std::vector<Callsite> callsites{Callsite{"", 0, ""}};
+  // The recorders of the running threads, and the counters of the ones
+  // exited.
+  std::vector<const CallsiteRecorder*> threads;
+  std::vector<CallsiteStats> exited;
+
+  // Leaked, as the recorders of threads exiting late still merge into it.
+  static CallsiteRegistry& Get() {
+    static auto registry = new CallsiteRegistry;
+    return *registry;
+  }
+};
+
+inline CallsiteRecorder::CallsiteRecorder() {
+  auto& registry = CallsiteRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.threads.push_back(this);
+}
+
+inline CallsiteRecorder::~CallsiteRecorder() {
+  auto& registry = CallsiteRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  MergeInto(registry.exited);
+  registry.threads.erase(
+      std::find(registry.threads.begin(), registry.threads.end(), this));
+  for (auto& page : pages_) delete page.load(std::memory_order_relaxed);
+}
+
+// The same location might be spelled by different pointers in different
+// translation units, so it's looked up by the pointers per thread first, and
+// by the strings globally on a miss.
+inline std::uint32_t InternCallsite(const Callsite& callsite) {
+  struct Hash {
+    std::size_t operator()(const Callsite& callsite) const {
+      return std::hash<const void*>()(callsite.file) ^
+             std::hash<std::uint32_t>()(callsite.line);
+    }
+  };
+  struct Equal {
+    bool operator()(const Callsite& a, const Callsite& b) const {
+      return a.file == b.file && a.line == b.line && a.function == b.function;
+    }
+  };
+  static thread_local std::unordered_map<Callsite, std::uint32_t, Hash, Equal>
+      cache;
+
+  auto [iter, inserted] = cache.try_emplace(callsite, 0);
+  if (inserted) {
+    auto& registry = CallsiteRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto [global, added] = registry.ids.try_emplace(
+        callsite, static_cast<std::uint32_t>(registry.callsites.size()));
+    if (added) registry.callsites.push_back(callsite);
+    iter->second = global->second;
+  }
+  return iter->second;
+}
+
+inline Callsite GetCallsite(std::uint32_t id) {
+  auto& registry = CallsiteRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.callsites.at(id);
+}
+
+inline CallsiteRecorder& ThreadCallsiteRecorder() {
+  static thread_local CallsiteRecorder recorder;
+  return recorder;
+}
+
+// The counters of the calling thread, indexed by callsite id. Ids not run on
+// this thread yet might be beyond the end.
+inline std::vector<CallsiteStats> ThreadCallsiteStats() {
+  std::vector<CallsiteStats> stats;
+  ThreadCallsiteRecorder().MergeInto(stats);
+  return stats;
+}
+
+inline void ResetThreadCallsiteStats() { ThreadCallsiteRecorder().Reset(); }
+
+// The counters of all the threads, including the ones exited, indexed by
+// callsite id.
+inline std::vector<CallsiteStats> MergedCallsiteStats() {
+  auto& registry = CallsiteRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto stats = registry.exited;
+  for (auto recorder : registry.threads) recorder->MergeInto(stats);
+  return stats;
+}
+
+// Counts a continuation chained at callsite `id`, for the lifetime of the
+// timer. Unattributed ones, of id 0, aren't counted.
+class CallsiteTimer {
+ public:
+  explicit CallsiteTimer(std::uint32_t id)
+      : id_(id), start_(id ? NowNanoseconds() : 0) {}
+
+  ~CallsiteTimer() {
+    if (id_)
+      ThreadCallsiteRecorder().Record(id_, NowNanoseconds() - start_);
+  }
+
+  CallsiteTimer(const CallsiteTimer&) = delete;
+  CallsiteTimer& operator=(const CallsiteTimer&) = delete;
+
+ private:
+  std::uint32_t id_;
+  std::uint64_t start_;
+};
+
+}  // namespace internal
+
+// The trailing parameter `callsite` of a function capturing its caller, and
+// the argument passing it on.
+#define MFUTURE_CALLSITE_PARAM \
+  , ::internal::Callsite callsite = ::internal::Callsite::Current()
+#define MFUTURE_CALLSITE_ARG , callsite
+
+#else
+
+#define MFUTURE_CALLSITE_PARAM
+#define MFUTURE_CALLSITE_ARG
+
+#endif  // MFUTURE_CALLSITE_STATS
@@ -0,0 +1,157 @@
+// Built with MFUTURE_CALLSITE_STATS, so that continuations are attributed to
+// their callsites.
+
+#include "callsite.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if !MFUTURE_CALLSITE_STATS
+#error "This test should be built with MFUTURE_CALLSITE_STATS=1."
+#endif
+
+using internal::CallsiteStats;
+
+namespace {
+
+// The counters of the callsite at `line` of this file in `stats`, those of
+// this thread by default.
+CallsiteStats Stats(std::uint32_t line,
+                    const std::vector<CallsiteStats>& stats =
+                        internal::ThreadCallsiteStats()) {
+  CallsiteStats total;
+  for (std::uint32_t id = 1; id < stats.size(); ++id) {
+    auto callsite = internal::GetCallsite(id);
+    if (callsite.line == line && std::strcmp(callsite.file, __FILE__) == 0) {
+      total.invocations += stats[id].invocations;
+      total.nanoseconds += stats[id].nanoseconds;
+    }
+  }
+  return total;
+}
+
+}  // namespace
+
+TEST(Callsite, current) {
+  auto callsite = internal::Callsite::Current();
+  EXPECT_STREQ(callsite.file, __FILE__);
+  EXPECT_EQ(callsite.line, __LINE__ - 2);
+  EXPECT_NE(std::strstr(callsite.function, "TestBody"), nullptr);
+
+  // Interned once.
+  auto id = internal::InternCallsite(callsite);
+  EXPECT_GT(id, 0);
+  EXPECT_EQ(internal::InternCallsite(callsite), id);
+  EXPECT_EQ(internal::GetCallsite(id).line, callsite.line);
+}
+
+TEST(Callsite, nfuture) {
+  using namespace nfuture;
+
+  std::uint32_t then_line = 0, wrap_line = 0;
+  for (int i = 0; i < 3; ++i) {
+    Promise<int> promise;
+    then_line = __LINE__ + 1;
+    auto future = promise.GetFuture().Then([](int v) { return v + 1; });
+    wrap_line = __LINE__ + 1;
+    auto wrapped = std::move(future).ThenWrap([](Future<int> &&f) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return f.Value<0>();
+    });
+    promise.SetValue(i);
+    EXPECT_EQ(wrapped.Value<0>(), i + 1);
+  }
+  EXPECT_EQ(Stats(then_line).invocations, 3);
+  EXPECT_EQ(Stats(wrap_line).invocations, 3);
+  EXPECT_GE(Stats(wrap_line).nanoseconds, 3000000);
+
+  // Ready ones run inline, uncounted.
+  auto line = __LINE__ + 1;
+  auto ready = MakeReadyFuture<int>(1).Then([](int v) { return v; });
+  EXPECT_TRUE(ready.Ready());
+  EXPECT_EQ(Stats(line).invocations, 0);
+}
+
+TEST(Callsite, nfuture_do_until) {
+  using namespace nfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  int n = 3;
+  auto line = __LINE__ + 1;
+  auto future = DoUntil([&] { return n-- == 0; },
+                        [&] {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(Stats(line).invocations, 3);
+}
+
+TEST(Callsite, mfuture) {
+  using namespace mfuture;
+
+  std::uint32_t then_line = 0;
+  for (int i = 0; i < 3; ++i) {
+    Promise<int> promise;
+    then_line = __LINE__ + 1;
+    auto future = promise.GetFuture().Then([](int v) { return v + 1; });
+    promise.SetValue(i);
+    EXPECT_EQ(future.GetValue<0>(), i + 1);
+  }
+  EXPECT_EQ(Stats(then_line).invocations, 3);
+}
+
+TEST(Callsite, mfuture_do_until) {
+  using namespace mfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  int n = 3;
+  auto line = __LINE__ + 1;
+  auto future = DoUntil([&] { return n-- == 0; },
+                        [&] {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.IsReady());
+  EXPECT_EQ(Stats(line).invocations, 3);
+}
+
+TEST(Callsite, merged) {
+  using namespace mfuture;
+  constexpr int kTimes = 100;
+
+  // Counted on both threads, one still running and the other exited.
+  auto line = __LINE__ + 4;
+  auto run = [] {
+    for (int i = 0; i < kTimes; ++i) {
+      Promise<int> promise;
+      auto future = promise.GetFuture().Then([](int v) { return v; });
+      promise.SetValue(i);
+    }
+  };
+  auto before = Stats(line, internal::MergedCallsiteStats()).invocations;
+  std::thread(run).join();
+  run();
+  EXPECT_EQ(Stats(line).invocations, kTimes);
+  EXPECT_EQ(Stats(line, internal::MergedCallsiteStats()).invocations,
+            before + 2 * kTimes);
+
+  internal::ResetThreadCallsiteStats();
+  EXPECT_EQ(Stats(line).invocations, 0);
+}
@@ -0,0 +1,465 @@
+#pragma once
+
+// A census of pending futures, with MFUTURE_CENSUS defined to 1: promises
+// whose futures are handed out but not resolved yet, continuations attached
+// but not run yet, and DoUntil() loops not done yet, counted per future type
+// and kept in intrusive lists of the thread they're made on. A chain is only
+// touched by a single thread at a time, yet that's not always the thread it's
+// made on, e.g. a promise resolved by another one. The thread owning a list
+// links and unlinks without a lock, while another one hands what it unlinks
+// back through an atomic stack, which the owner drains as it links or finds
+// the pending next, so the counters lag behind until then. They're only
+// written by the owner, while readable by any thread.
+//
+// The census of a thread exiting is recycled for the next thread started, as
+// what's still pending of it unlinks itself later, so there are as many as
+// threads running at once.
+//
+// Besides, the continuation running on each thread is published, so that a
+// watchdog thread finds the ones running too long, e.g. blocking a loop. The
+// ones pending too long are found by each thread in its own lists, e.g. by a
+// timer of the loop. Both are reported with the callsite where the
+// continuation is chained, if MFUTURE_CALLSITE_STATS is on as well, otherwise
+// callsite 0.
+//
+// Otherwise nothing is compiled into the futures.
+
+#ifndef MFUTURE_CENSUS
+#define MFUTURE_CENSUS 0
+#endif
+
+#if MFUTURE_CENSUS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+
+namespace internal {
+
+enum class CensusKind : std::uint8_t {
+  kPromise,       // Its future handed out, and not resolved yet.
+  kContinuation,  // Attached to a pending future.
+  kDoUntilState,  // Of a DoUntil() loop not done yet.
+};
+
+constexpr std::size_t kNumCensusKinds = 3;
+
+// Future types beyond this are counted together, as type 0.
+constexpr std::size_t kMaxCensusTypes = 256;
+
+class CensusThread;
+
+// Future types, numbered from 1 in the order first counted, and the census of
+// each thread.
+struct CensusRegistry {
+  std::mutex mutex;
+  std::vector<std::string> types{"<other>"};
+  std::vector<CensusThread*> threads;
+  std::vector<CensusThread*> exited;  // Of `threads`, to be recycled.
+  std::uint32_t started = 0;          // Threads ever counted.
+
+  // Not destructed, as pending futures might be released after static
+  // destruction, and threads exiting give their census back to it.
+  static CensusRegistry& Get() {
+    static auto registry = new CensusRegistry;
+    return *registry;
+  }
+};
+
+// Extracts "int, char" of "... [with T = {int, char}; ...]" by GCC, or of
+// "... [T = <int, char>]" by Clang.
+inline std::string CensusTypeArgs(std::string_view function) {
+  auto begin = function.find("T = ");
+  if (begin == std::string_view::npos) return std::string(function);
+  begin += 4;
+  int depth = 0;
+  for (auto end = begin; end < function.size(); ++end) {
+    auto c = function[end];
+    if (c == '{' || c == '<' || c == '(' || c == '[') ++depth;
+    if (c == '}' || c == '>' || c == ')' || c == ']') --depth;
+    if (depth == 0)
+      return std::string(function.substr(begin + 1, end - begin - 1));
+  }
+  return std::string(function.substr(begin));
+}
+
+template <typename... T>
+std::string CensusTypeName() {
+  return "Future<" + CensusTypeArgs(__PRETTY_FUNCTION__) + ">";
+}
+
+template <typename... T>
+std::uint32_t CensusType() {
+  static const std::uint32_t type = [] {
+    auto& registry = CensusRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (registry.types.size() == kMaxCensusTypes) return std::uint32_t{0};
+    registry.types.push_back(CensusTypeName<T...>());
+    return static_cast<std::uint32_t>(registry.types.size() - 1);
+  }();
+  return type;
+}
+
+inline std::string GetCensusTypeName(std::uint32_t type) {
+  auto& registry = CensusRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.types.at(type);
+}
+
+// The record of a node pending, in a list of the thread it's linked on. It's
+// owned by the census of that thread rather than embedded in the node, so that
+// a node unlinked by another thread can be released at once, while its entry
+// is handed back to the owner to be unlinked there.
+struct CensusEntry {
+  CensusEntry* prev = nullptr;
+  CensusEntry* next = nullptr;
+  CensusEntry* remote_next = nullptr;  // In the stack of remote unlinks.
+  CensusThread* owner = nullptr;
+  std::uint64_t since = 0;
+  std::uint32_t type = 0;
+  std::atomic<std::uint32_t> callsite{0};
+  CensusKind kind = CensusKind::kPromise;
+};
+
+// Embedded in what's counted, linked into a list of the thread while pending.
+// Only touched by a single thread at a time, which may unlink it from the list
+// of another one.
+class CensusNode {
+ public:
+  CensusNode() = default;
+  ~CensusNode() { Unlink(); }
+
+  // A node moved is left alone, e.g. a coroutine awaiter moved before it's
+  // attached. `MoveFrom()` is for taking over a link.
+  CensusNode(CensusNode&&) noexcept {}
+  CensusNode& operator=(const CensusNode&) = delete;
+
+  // Pending since now, until unlinked.
+  void Link(CensusKind kind, std::uint32_t type, std::uint32_t callsite = 0);
+
+  void Unlink();
+
+  bool Linked() const { return entry_; }
+
+  // Takes over the link of `other`, which is left unlinked.
+  void MoveFrom(CensusNode& other) {
+    Unlink();
+    entry_ = std::exchange(other.entry_, nullptr);
+  }
+
+  // 0 if not linked, the same below.
+  std::uint32_t Type() const { return entry_ ? entry_->type : 0; }
+
+  std::uint32_t Callsite() const {
+    return entry_ ? entry_->callsite.load(std::memory_order_relaxed) : 0;
+  }
+
+  void SetCallsite(std::uint32_t callsite) {
+    if (entry_) entry_->callsite.store(callsite, std::memory_order_relaxed);
+  }
+
+ private:
+  CensusEntry* entry_ = nullptr;
+};
+
+struct Stall {
+  bool running;  // Running too long, otherwise pending too long.
+  CensusKind kind;
+  std::uint32_t thread;
+  std::uint32_t type;
+  std::uint32_t callsite;
+  std::uint64_t nanoseconds;  // Running or pending so far.
+};
+
+// The census of a thread. Never released, but recycled once the thread exits,
+// so that its counters are still summed, and what's still linked into its
+// lists unlinks itself later.
+class CensusThread {
+ public:
+  explicit CensusThread(std::uint32_t thread) : thread_(thread) {
+    for (auto& list : lists_) list.prev = list.next = &list;
+  }
+
+  std::uint32_t Thread() const {
+    return thread_.load(std::memory_order_relaxed);
+  }
+
+  // As recycled for another thread.
+  void SetThread(std::uint32_t thread) {
+    thread_.store(thread, std::memory_order_relaxed);
+  }
+
+  std::int64_t Live(CensusKind kind, std::uint32_t type) const {
+    return live_[type][static_cast<std::size_t>(kind)].load(
+        std::memory_order_relaxed);
+  }
+
+  // Links an entry pending since now, only by its own thread, the same for the
+  // ones below but RemoteRemove().
+  CensusEntry* Append(CensusKind kind, std::uint32_t type,
+                      std::uint32_t callsite) {
+    DrainRemote();
+    if (!free_) Grow();
+    auto entry = std::exchange(free_, free_->next);
+    entry->owner = this;
+    entry->since = NowNanoseconds();
+    entry->type = type;
+    entry->callsite.store(callsite, std::memory_order_relaxed);
+    entry->kind = kind;
+    auto& list = lists_[static_cast<std::size_t>(kind)];
+    entry->prev = list.prev;
+    entry->next = &list;
+    list.prev->next = entry;
+    list.prev = entry;
+    Count(kind, type, 1);
+    return entry;
+  }
+
+  void Remove(CensusEntry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    Count(entry->kind, entry->type, -1);
+    entry->owner = nullptr;
+    entry->prev = nullptr;
+    entry->next = std::exchange(free_, entry);
+  }
+
+  // By any other thread. The entry is pushed to be removed by this one as it
+  // links or finds the pending next, so it's still counted until then.
+  void RemoteRemove(CensusEntry* entry) {
+    auto head = remote_.load(std::memory_order_relaxed);
+    do {
+      entry->remote_next = head;
+    } while (!remote_.compare_exchange_weak(
+        head, entry, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // The ones pending at least `threshold` nanoseconds, oldest first. They're
+  // listed in the order linked, so only those are visited.
+  void FindPending(std::uint64_t threshold, std::uint64_t now,
+                   std::vector<Stall>& stalls) {
+    DrainRemote();
+    auto thread = Thread();
+    for (auto& list : lists_) {
+      for (auto entry = list.next; entry != &list; entry = entry->next) {
+        auto pending = now - entry->since;
+        if (now < entry->since || pending < threshold) break;
+        stalls.push_back({false, entry->kind, thread, entry->type,
+                          entry->callsite.load(std::memory_order_relaxed),
+                          pending});
+      }
+    }
+  }
+
+  struct Running {
+    std::uint64_t since = 0;  // 0 if none.
+    std::uint32_t type = 0;
+    std::uint32_t callsite = 0;
+  };
+
+  // Publishes the continuation running, and returns the previous one, only by
+  // its own thread.
+  Running SetRunning(const Running& running) {
+    auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    since_.store(running.since, std::memory_order_relaxed);
+    type_.store(running.type, std::memory_order_relaxed);
+    callsite_.store(running.callsite, std::memory_order_relaxed);
+    seq_.store(seq + 2, std::memory_order_release);
+    return std::exchange(running_, running);
+  }
+
+  // By any thread.
+  Running GetRunning() const {
+    while (true) {
+      auto seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      Running running{since_.load(std::memory_order_relaxed),
+                      type_.load(std::memory_order_relaxed),
+                      callsite_.load(std::memory_order_relaxed)};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq) return running;
+    }
+  }
+
+ private:
+  static constexpr std::size_t kChunk = 64;
+
+  // Only written by its own thread, while readable by any.
+  void Count(CensusKind kind, std::uint32_t type, std::int64_t delta) {
+    auto& live = live_[type][static_cast<std::size_t>(kind)];
+    live.store(live.load(std::memory_order_relaxed) + delta,
+               std::memory_order_relaxed);
+  }
+
+  void DrainRemote() {
+    if (!remote_.load(std::memory_order_relaxed)) return;
+    auto entry = remote_.exchange(nullptr, std::memory_order_acquire);
+    while (entry) Remove(std::exchange(entry, entry->remote_next));
+  }
+
+  void Grow() {
+    chunks_.push_back(std::make_unique<CensusEntry[]>(kChunk));
+    for (std::size_t i = 0; i < kChunk; ++i)
+      chunks_.back()[i].next = std::exchange(free_, &chunks_.back()[i]);
+  }
+
+  std::atomic<std::uint32_t> thread_;
+  std::atomic<std::int64_t> live_[kMaxCensusTypes][kNumCensusKinds] = {};
+  CensusEntry lists_[kNumCensusKinds];
+  CensusEntry* free_ = nullptr;
+  std::vector<std::unique_ptr<CensusEntry[]>> chunks_;
+  std::atomic<CensusEntry*> remote_{nullptr};
+
+  Running running_;  // The copy of its own thread.
+  std::atomic<std::uint64_t> seq_{0};
+  std::atomic<std::uint64_t> since_{0};
+  std::atomic<std::uint32_t> type_{0};
+  std::atomic<std::uint32_t> callsite_{0};
+};
+
+// Takes the census of an exited thread if any, and gives it back on exit.
+class CensusThreadSlot {
+ public:
+  CensusThreadSlot() {
+    auto& registry = CensusRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto thread = ++registry.started;
+    if (registry.exited.empty()) {
+      census_ = new CensusThread(thread);
+      registry.threads.push_back(census_);
+    } else {
+      census_ = registry.exited.back();
+      registry.exited.pop_back();
+      census_->SetThread(thread);
+    }
+  }
+
+  ~CensusThreadSlot() {
+    auto& registry = CensusRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.exited.push_back(census_);
+  }
+
+  CensusThreadSlot(const CensusThreadSlot&) = delete;
+  CensusThreadSlot& operator=(const CensusThreadSlot&) = delete;
+
+  CensusThread& Census() { return *census_; }
+
+ private:
+  CensusThread* census_;
+};
+
+inline CensusThread& ThreadCensus() {
+  static thread_local CensusThreadSlot slot;
+  return slot.Census();
+}
+
+inline void CensusNode::Link(CensusKind kind, std::uint32_t type,
+                             std::uint32_t callsite) {
+  Unlink();
+  entry_ = ThreadCensus().Append(kind, type, callsite);
+}
+
+// Only the unlink by another thread than the owner takes an atomic.
+inline void CensusNode::Unlink() {
+  if (!entry_) return;
+  auto entry = std::exchange(entry_, nullptr);
+  if (entry->owner == &ThreadCensus())
+    entry->owner->Remove(entry);
+  else
+    entry->owner->RemoteRemove(entry);
+}
+
+// Publishes the continuation of `node` running on this thread, for the
+// lifetime of the object. It's no longer pending.
+class CensusRun {
+ public:
+  explicit CensusRun(CensusNode& node)
+      : saved_(ThreadCensus().SetRunning(
+            {NowNanoseconds(), node.Type(), node.Callsite()})) {
+    node.Unlink();
+  }
+
+  ~CensusRun() { ThreadCensus().SetRunning(saved_); }
+
+  CensusRun(const CensusRun&) = delete;
+  CensusRun& operator=(const CensusRun&) = delete;
+
+ private:
+  CensusThread::Running saved_;
+};
+
+// Summed over the threads.
+inline std::int64_t CensusLive(CensusKind kind, std::uint32_t type) {
+  auto& registry = CensusRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::int64_t live = 0;
+  for (auto census : registry.threads) live += census->Live(kind, type);
+  return live;
+}
+
+struct CensusRow {
+  std::string type;
+  std::int64_t live[kNumCensusKinds];
+};
+
+// The future types with anything live, summed over the threads.
+inline std::vector<CensusRow> Census() {
+  auto& registry = CensusRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::vector<CensusRow> rows;
+  for (std::uint32_t type = 0; type < registry.types.size(); ++type) {
+    CensusRow row{registry.types[type], {}};
+    bool any = false;
+    for (std::size_t kind = 0; kind < kNumCensusKinds; ++kind) {
+      for (auto census : registry.threads)
+        row.live[kind] += census->Live(static_cast<CensusKind>(kind), type);
+      any |= row.live[kind] != 0;
+    }
+    if (any) rows.push_back(std::move(row));
+  }
+  return rows;
+}
+
+// The promises, continuations and DoUntil() loops of this thread pending at
+// least `threshold` nanoseconds.
+inline std::vector<Stall> FindPendingStalls(std::uint64_t threshold) {
+  std::vector<Stall> stalls;
+  ThreadCensus().FindPending(threshold, NowNanoseconds(), stalls);
+  return stalls;
+}
+
+// The continuations of any thread running at least `threshold` nanoseconds,
+// which is meant for a watchdog thread.
+inline std::vector<Stall> FindRunningStalls(std::uint64_t threshold) {
+  std::vector<CensusThread*> threads;
+  {
+    auto& registry = CensusRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    threads = registry.threads;
+  }
+  std::vector<Stall> stalls;
+  auto now = NowNanoseconds();
+  for (auto census : threads) {
+    auto running = census->GetRunning();
+    if (!running.since || now < running.since) continue;
+    if (now - running.since < threshold) continue;
+    stalls.push_back({true, CensusKind::kContinuation, census->Thread(),
+                      running.type, running.callsite, now - running.since});
+  }
+  return stalls;
+}
+
+}  // namespace internal
+
+#endif  // MFUTURE_CENSUS
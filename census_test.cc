@@ -0,0 +1,287 @@
+// Built with MFUTURE_CENSUS and MFUTURE_CALLSITE_STATS, so that pending
+// futures are counted and attributed.
+
+#include "census.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if !MFUTURE_CENSUS || !MFUTURE_CALLSITE_STATS
+#error "This test should be built with MFUTURE_CENSUS=1 and " \
+    "MFUTURE_CALLSITE_STATS=1."
+#endif
+
+using internal::CensusKind;
+using internal::CensusLive;
+using internal::CensusType;
+
+namespace {
+
+// Distinct types per test, so that counts aren't mixed up.
+template <int N>
+struct Tag {};
+
+template <typename... T>
+std::int64_t Live(CensusKind kind) {
+  return CensusLive(kind, CensusType<T...>());
+}
+
+}  // namespace
+
+TEST(Census, type_name) {
+  EXPECT_EQ(internal::CensusTypeName<>(), "Future<>");
+  EXPECT_EQ(internal::CensusTypeName<int>(), "Future<int>");
+  EXPECT_EQ((internal::CensusTypeName<int, char>()), "Future<int, char>");
+  EXPECT_EQ(internal::GetCensusTypeName((CensusType<int, char>())),
+            "Future<int, char>");
+}
+
+TEST(Census, nfuture) {
+  using namespace nfuture;
+  using T = Tag<1>;
+
+  {
+    Promise<T> promise;
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+    auto future = promise.GetFuture();
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 1);
+    auto f2 = std::move(future).Then([](T v) { return v; });
+    EXPECT_EQ(Live<T>(CensusKind::kContinuation), 1);
+    // And the promise of the future returned.
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 2);
+
+    promise.SetValue(T());
+    EXPECT_TRUE(f2.Ready());
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+    EXPECT_EQ(Live<T>(CensusKind::kContinuation), 0);
+  }
+
+  {
+    // Abandoned ones.
+    Promise<T> promise;
+    auto future = promise.GetFuture();
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 1);
+  }
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+
+  // Moved ones.
+  Promise<T> promise;
+  auto future = promise.GetFuture();
+  auto moved = std::move(promise);
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 1);
+  moved.SetValue(T());
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+}
+
+TEST(Census, nfuture_do_until) {
+  using namespace nfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  int n = 3;
+  auto future = DoUntil([&] { return n-- == 0; },
+                        [&] {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  EXPECT_EQ(Live<>(CensusKind::kDoUntilState), 1);
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(Live<>(CensusKind::kDoUntilState), 0);
+  EXPECT_EQ(Live<>(CensusKind::kContinuation), 0);
+}
+
+TEST(Census, mfuture) {
+  using namespace mfuture;
+  using T = Tag<2>;
+
+  {
+    Promise<T> promise;
+    auto future = promise.GetFuture();
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 1);
+    auto f2 = future.Then([](T v) { return v; });
+    EXPECT_EQ(Live<T>(CensusKind::kContinuation), 1);
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 2);
+
+    promise.SetValue(T());
+    EXPECT_TRUE(f2.IsReady());
+    EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+    EXPECT_EQ(Live<T>(CensusKind::kContinuation), 0);
+  }
+
+  // Folded into the downstream chain.
+  Promise<T> inner;
+  auto inner_future = inner.GetFuture();
+  Promise<int> promise;
+  auto future =
+      promise.GetFuture().Then([&](int) { return std::move(inner_future); });
+  promise.SetValue(1);
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 1);
+  inner.SetValue(T());
+  EXPECT_TRUE(future.IsReady());
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+}
+
+TEST(Census, mfuture_do_until) {
+  using namespace mfuture;
+
+  Promise<> promise;
+  bool pending = false;
+  int n = 3;
+  auto future = DoUntil([&] { return n-- == 0; },
+                        [&] {
+                          pending = true;
+                          return promise.Rearm();
+                        });
+  EXPECT_EQ(Live<>(CensusKind::kDoUntilState), 1);
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+  EXPECT_TRUE(future.IsReady());
+  EXPECT_EQ(Live<>(CensusKind::kDoUntilState), 0);
+}
+
+TEST(Census, rows) {
+  using T = Tag<3>;
+  nfuture::Promise<T> promise;
+  auto future = promise.GetFuture();
+  bool found = false;
+  for (auto& row : internal::Census()) {
+    if (row.type.find("Tag<3>") != std::string::npos) {
+      EXPECT_EQ(row.live[static_cast<int>(CensusKind::kPromise)], 1);
+      found = true;
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST(Census, pending_stalls) {
+  using namespace nfuture;
+  using T = Tag<4>;
+
+  Promise<T> promise;
+  auto line = __LINE__ + 1;
+  auto future = promise.GetFuture().Then([](T v) { return v; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  Promise<T> young;
+  auto young_future = young.GetFuture();
+
+  std::size_t promises = 0, continuations = 0, attributed = 0;
+  for (auto& stall : internal::FindPendingStalls(1000000)) {
+    if (stall.type != CensusType<T>()) continue;
+    EXPECT_FALSE(stall.running);
+    EXPECT_GE(stall.nanoseconds, 1000000);
+    if (stall.kind == CensusKind::kPromise) ++promises;
+    if (stall.kind == CensusKind::kContinuation) ++continuations;
+    // The promise of the future returned by Then() has nothing chained yet.
+    if (stall.callsite == 0) continue;
+    auto callsite = internal::GetCallsite(stall.callsite);
+    EXPECT_EQ(callsite.line, line);
+    EXPECT_STREQ(callsite.file, __FILE__);
+    ++attributed;
+  }
+  // But the young one.
+  EXPECT_EQ(promises, 2);
+  EXPECT_EQ(continuations, 1);
+  EXPECT_EQ(attributed, 2);
+
+  promise.SetValue(T());
+  young.SetValue(T());
+}
+
+TEST(Census, running_stalls) {
+  using namespace nfuture;
+
+  std::atomic<bool> running{false}, done{false};
+  std::uint32_t line = 0;
+  std::thread loop([&] {
+    Promise<> promise;
+    line = __LINE__ + 1;
+    auto future = promise.GetFuture().Then([&] {
+      running = true;
+      while (!done) std::this_thread::yield();
+    });
+    promise.SetValue();
+  });
+
+  // The watchdog.
+  while (!running) std::this_thread::yield();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  auto stalls = internal::FindRunningStalls(1000000);
+  done = true;
+  loop.join();
+
+  ASSERT_EQ(stalls.size(), 1);
+  EXPECT_TRUE(stalls[0].running);
+  EXPECT_EQ(stalls[0].type, CensusType<>());
+  EXPECT_GE(stalls[0].nanoseconds, 1000000);
+  EXPECT_EQ(internal::GetCallsite(stalls[0].callsite).line, line);
+
+  // None once done.
+  EXPECT_TRUE(internal::FindRunningStalls(0).empty());
+}
+
+TEST(Census, cross_thread) {
+  using namespace mfuture;
+  using T = Tag<5>;
+  constexpr int kPromises = 1000;
+
+  // Made on this thread, and resolved on another one, while this one links.
+  std::vector<Promise<T>> promises(kPromises);
+  std::vector<Future<T>> futures;
+  for (auto& promise : promises) futures.push_back(promise.GetFuture());
+  std::thread resolver([&] {
+    for (auto& promise : promises) promise.SetValue(T());
+  });
+  std::vector<Promise<int>> others(kPromises);
+  std::vector<Future<int>> other_futures;
+  for (auto& other : others) other_futures.push_back(other.GetFuture());
+  resolver.join();
+
+  // Handed back to this thread, until it finds the pending next.
+  internal::FindPendingStalls(0);
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+  for (auto& future : futures) EXPECT_TRUE(future.IsReady());
+  for (auto& other : others) other.SetValue(0);
+}
+
+TEST(Census, exited_threads) {
+  using namespace nfuture;
+  using T = Tag<6>;
+  constexpr int kThreads = 10;
+
+  // Pending past the threads they're made on.
+  std::vector<Promise<T>> promises;
+  std::vector<Future<T>> futures;
+  std::size_t threads = 0;
+  for (int i = 0; i < kThreads; ++i) {
+    std::thread([&] {
+      promises.emplace_back();
+      futures.push_back(promises.back().GetFuture());
+    }).join();
+    auto& registry = internal::CensusRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (i == 0) threads = registry.threads.size();
+    // Recycled.
+    EXPECT_EQ(registry.threads.size(), threads);
+  }
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), kThreads);
+
+  // Handed back to the census of the exited thread, until the next thread
+  // takes it over.
+  for (auto& promise : promises) promise.SetValue(T());
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), kThreads);
+  std::thread([] { internal::FindPendingStalls(0); }).join();
+  EXPECT_EQ(Live<T>(CensusKind::kPromise), 0);
+}
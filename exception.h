@@ -0,0 +1,39 @@
+#pragma once
+
+#include <exception>
+#include <type_traits>
+#include <typeinfo>
+
+namespace internal {
+
+// Returns the exception object held by `e` if it's of type E or derived from
+// E, or nullptr otherwise. The object lives as long as `e` does.
+//
+// With libstdc++, the thrown type is read from the exception header and
+// matched the way a catch clause would, which is far cheaper than rethrowing.
+// Elsewhere it falls back to rethrow and catch.
+template <typename E>
+const E* ExceptionCast(const std::exception_ptr& e) noexcept {
+  static_assert(std::is_class_v<E>, "E should be a class type.");
+  if (!e) return nullptr;
+#if defined(__GLIBCXX__) && __cpp_rtti
+  const std::type_info* thrown = e.__cxa_exception_type();
+  // A std::exception_ptr is nothing but a pointer to the thrown object.
+  void* object = reinterpret_cast<void* const&>(e);
+  if (thrown && typeid(E).__do_catch(thrown, &object, 1))
+    return static_cast<const E*>(object);
+  return nullptr;
+#elif __cpp_exceptions
+  try {
+    std::rethrow_exception(e);
+  } catch (const E& x) {
+    return &x;
+  } catch (...) {
+  }
+  return nullptr;
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace internal
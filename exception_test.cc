@@ -0,0 +1,53 @@
+#include "exception.h"
+
+#include <stdexcept>
+#include <system_error>
+
+#include "gtest/gtest.h"
+
+using namespace internal;
+
+namespace {
+
+struct Base {
+  virtual ~Base() = default;
+  int value = 1;
+};
+
+struct Other {
+  int other = 2;
+};
+
+// The Base subobject isn't at offset 0, so the pointer has to be adjusted.
+struct Derived : Other, Base {};
+
+}  // namespace
+
+TEST(ExceptionCast, basic) {
+  EXPECT_EQ(ExceptionCast<std::exception>(nullptr), nullptr);
+
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  auto p = ExceptionCast<std::runtime_error>(e);
+  ASSERT_NE(p, nullptr);
+  EXPECT_STREQ(p->what(), "test");
+  EXPECT_EQ(ExceptionCast<std::exception>(e), p);
+  EXPECT_EQ(ExceptionCast<std::logic_error>(e), nullptr);
+
+  EXPECT_EQ(ExceptionCast<std::exception>(std::make_exception_ptr(1)),
+            nullptr);
+}
+
+TEST(ExceptionCast, derived) {
+  auto e = std::make_exception_ptr(Derived());
+  auto base = ExceptionCast<Base>(e);
+  ASSERT_NE(base, nullptr);
+  EXPECT_EQ(base->value, 1);
+  auto other = ExceptionCast<Other>(e);
+  ASSERT_NE(other, nullptr);
+  EXPECT_EQ(other->other, 2);
+  EXPECT_EQ(static_cast<const Base*>(ExceptionCast<Derived>(e)), base);
+
+  auto s = std::make_exception_ptr(
+      std::system_error(std::make_error_code(std::errc::timed_out)));
+  EXPECT_NE(ExceptionCast<std::runtime_error>(s), nullptr);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "alloc.h"
+
+namespace internal {
+
+// A thread-local cache of memory blocks, bucketed by size, for objects which
+// are allocated and released at a high rate with a small set of sizes, i.e.
+// coroutine frames. A released block is kept for the next allocation of its
+// bucket, until the retained bytes reach the capacity, beyond which blocks are
+// returned to the system allocator. Blocks larger than the largest bucket
+// aren't cached at all.
+//
+// A block may be released by another thread, then it's simply kept by that
+// thread's cache.
+class FrameCache {
+ public:
+  static constexpr std::size_t kGranularity = 64;
+  static constexpr std::size_t kBuckets = 16;  // Up to 1 KiB.
+  static constexpr std::size_t kMaxSize = kGranularity * kBuckets;
+  static constexpr std::size_t kDefaultCapacity = 1 << 20;
+
+  struct Stats {
+    std::uint64_t hits = 0;      // Allocations served from the cache.
+    std::uint64_t misses = 0;    // Allocations served by the system.
+    std::uint64_t returned = 0;  // Releases returned to the system.
+    std::size_t retained_bytes = 0;
+    std::size_t peak_retained_bytes = 0;
+
+    double HitRate() const {
+      auto total = hits + misses;
+      return total ? static_cast<double>(hits) / total : 0;
+    }
+  };
+
+  FrameCache() = default;
+  FrameCache(const FrameCache&) = delete;
+  FrameCache& operator=(const FrameCache&) = delete;
+
+  ~FrameCache() { Trim(); }
+
+  // The cache of the calling thread.
+  static FrameCache& Local() {
+    static thread_local FrameCache cache;
+    return cache;
+  }
+
+  void* Allocate(std::size_t size) {
+    if (size == 0 || size > kMaxSize) {
+      ++stats_.misses;
+      return internal::Allocate(AllocSite::kCoroutineFrame, size);
+    }
+    auto index = Index(size);
+    if (auto block = free_[index]) {
+      free_[index] = block->next;
+      stats_.retained_bytes -= BucketSize(index);
+      ++stats_.hits;
+      return block;
+    }
+    ++stats_.misses;
+    // Rounded up, so that the block is good for any size of its bucket.
+    return internal::Allocate(AllocSite::kCoroutineFrame, BucketSize(index));
+  }
+
+  // `size` should be the one allocated with.
+  void Deallocate(void* p, std::size_t size) {
+    if (size == 0 || size > kMaxSize ||
+        stats_.retained_bytes + BucketSize(Index(size)) > capacity_) {
+      ++stats_.returned;
+      internal::Deallocate(AllocSite::kCoroutineFrame, p,
+                           size == 0 || size > kMaxSize
+                               ? size
+                               : BucketSize(Index(size)));
+      return;
+    }
+    auto index = Index(size);
+    free_[index] = new (p) Block{free_[index]};
+    stats_.retained_bytes += BucketSize(index);
+    if (stats_.retained_bytes > stats_.peak_retained_bytes)
+      stats_.peak_retained_bytes = stats_.retained_bytes;
+  }
+
+  // Returns all the retained blocks to the system.
+  void Trim() {
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      while (auto block = free_[i]) {
+        free_[i] = block->next;
+        internal::Deallocate(AllocSite::kCoroutineFrame, block, BucketSize(i));
+      }
+    }
+    stats_.retained_bytes = 0;
+  }
+
+  // Takes effect on later releases, call `Trim()` to drop the excess.
+  void SetCapacity(std::size_t bytes) { capacity_ = bytes; }
+
+  std::size_t Capacity() const { return capacity_; }
+
+  const Stats& GetStats() const { return stats_; }
+
+  void ResetStats() {
+    auto retained_bytes = stats_.retained_bytes;
+    stats_ = Stats{};
+    stats_.retained_bytes = stats_.peak_retained_bytes = retained_bytes;
+  }
+
+ private:
+  struct Block {
+    Block* next;
+  };
+
+  static std::size_t Index(std::size_t size) {
+    return (size - 1) / kGranularity;
+  }
+
+  static std::size_t BucketSize(std::size_t index) {
+    return (index + 1) * kGranularity;
+  }
+
+  Block* free_[kBuckets] = {};
+  std::size_t capacity_ = kDefaultCapacity;
+  Stats stats_;
+};
+
+}  // namespace internal
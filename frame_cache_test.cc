@@ -0,0 +1,53 @@
+#include "frame_cache.h"
+
+#include "gtest/gtest.h"
+
+using namespace internal;
+
+TEST(FrameCache, basic) {
+  FrameCache cache;
+  auto p1 = cache.Allocate(100);
+  EXPECT_EQ(cache.GetStats().misses, 1);
+  cache.Deallocate(p1, 100);
+  EXPECT_EQ(cache.GetStats().retained_bytes, 128);
+
+  // Any size of the same bucket reuses the block.
+  auto p2 = cache.Allocate(128);
+  EXPECT_EQ(p2, p1);
+  EXPECT_EQ(cache.GetStats().hits, 1);
+  EXPECT_EQ(cache.GetStats().retained_bytes, 0);
+
+  auto p3 = cache.Allocate(129);
+  EXPECT_NE(p3, p1);
+  EXPECT_EQ(cache.GetStats().misses, 2);
+
+  cache.Deallocate(p2, 128);
+  cache.Deallocate(p3, 129);
+  EXPECT_EQ(cache.GetStats().retained_bytes, 128 + 192);
+  EXPECT_EQ(cache.GetStats().peak_retained_bytes, 128 + 192);
+  EXPECT_DOUBLE_EQ(cache.GetStats().HitRate(), 1.0 / 3);
+
+  cache.Trim();
+  EXPECT_EQ(cache.GetStats().retained_bytes, 0);
+  EXPECT_EQ(cache.GetStats().peak_retained_bytes, 128 + 192);
+}
+
+TEST(FrameCache, capacity) {
+  FrameCache cache;
+  cache.SetCapacity(2 * FrameCache::kGranularity);
+  void* blocks[3];
+  for (auto& p : blocks) p = cache.Allocate(1);
+  for (auto p : blocks) cache.Deallocate(p, 1);
+  EXPECT_EQ(cache.GetStats().retained_bytes, 2 * FrameCache::kGranularity);
+  EXPECT_EQ(cache.GetStats().returned, 1);
+
+  // Too large to be cached.
+  auto p = cache.Allocate(FrameCache::kMaxSize + 1);
+  cache.Deallocate(p, FrameCache::kMaxSize + 1);
+  EXPECT_EQ(cache.GetStats().returned, 2);
+
+  cache.ResetStats();
+  EXPECT_EQ(cache.GetStats().misses, 0);
+  EXPECT_EQ(cache.GetStats().peak_retained_bytes,
+            2 * FrameCache::kGranularity);
+}
@@ -0,0 +1,401 @@
+#pragma once
+
+// One future type over both implementations, `Future<Policy, T...>`, where the
+// policy picks how the state of a future is managed:
+//
+//   Linked  nfuture, whose promise and future point at each other, and keep
+//           the state inline. The fastest, but a promise and its future are
+//           fixed up as either moves, so both belong to a single thread.
+//   Shared  mfuture, whose promise and future share the state on the heap.
+//           Either is safe to move anywhere, e.g. to another thread.
+//
+// `Future<Policy, T...>` is the future of the implementation itself, so that
+// nothing is added to its hot paths, and a future of either policy keeps its
+// own full API. Code generic over the policy uses the free functions here
+// instead, which spell the operations the same for both: the combinators
+// Then(), ThenWrap(), Fold(), DoUntil(), FuturizeInvoke() and FuturizeApply(),
+// and the accessors of the result. E.g.
+//
+//   template <typename Policy>
+//   future::Future<Policy, int> Lookup(Cache<Policy>& cache, Key key) {
+//     return future::Then(cache.Get(key), [](int v) { return v + 1; });
+//   }
+//
+// Callbacks should take the exact types of the values, or the future itself
+// with ThenWrap(), rather than `auto`, as the shared policy tells which one a
+// callback is by its parameters.
+//
+// Being an alias of a member template, `Future<Policy, T...>` is a non-deduced
+// context, so a function template can't take a `Future<Policy, T...>` and
+// deduce the policy. Generic code taking a future takes any type F instead,
+// and gets its policy by `PolicyOf_t<F>`, as the free functions here do. E.g.
+//
+//   template <typename F>
+//   auto Twice(F&& future) {
+//     using Policy = future::PolicyOf_t<F>;
+//     return future::Then(std::move(future), [](int v) {
+//       return future::MakeReadyFuture<Policy, int>(v * 2);
+//     });
+//   }
+
+#include <cstddef>
+#include <exception>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "callsite.h"
+#include "mfuture.h"
+#include "nfuture.h"
+#include "traits.h"
+
+namespace future {
+
+struct Linked {
+  static constexpr const char* kName = "linked";
+
+  template <typename... T>
+  using Future = nfuture::Future<T...>;
+
+  template <typename... T>
+  using Promise = nfuture::Promise<T...>;
+
+  template <typename... T, typename... U>
+  static Future<T...> MakeReadyFuture(U&&... value) {
+    return nfuture::MakeReadyFuture<T...>(std::forward<U>(value)...);
+  }
+
+  template <typename... T>
+  static Future<T...> MakeExceptionalFuture(std::exception_ptr&& exception) {
+    return nfuture::MakeExceptionalFuture<T...>(std::move(exception));
+  }
+
+  template <typename... T>
+  static Future<T...> MakeErrorFuture(std::error_code code) {
+    return nfuture::MakeErrorFuture<T...>(code);
+  }
+
+  template <typename... T>
+  static bool IsResolved(const Future<T...>& future) {
+    return future.Available();
+  }
+
+  template <typename... T>
+  static bool IsReady(const Future<T...>& future) {
+    return future.Ready();
+  }
+
+  template <typename... T>
+  static bool IsFailed(const Future<T...>& future) {
+    return future.Failed();
+  }
+
+  template <typename... T>
+  static bool HasErrorCode(const Future<T...>& future) {
+    return future.HasErrorCode();
+  }
+
+  template <typename... T>
+  static std::tuple<T...> GetValue(Future<T...>& future) {
+    return future.Value();
+  }
+
+  template <typename... T>
+  static std::exception_ptr GetException(Future<T...>& future) {
+    return future.Exception();
+  }
+
+  template <typename... T>
+  static std::error_code GetErrorCode(Future<T...>& future) {
+    return future.ErrorCode();
+  }
+
+  template <typename Callback, typename... T>
+  static auto Then(Future<T...>&& future,
+                   Callback&& callback MFUTURE_CALLSITE_PARAM) {
+    return future.Then(std::forward<Callback>(callback) MFUTURE_CALLSITE_ARG);
+  }
+
+  template <typename Callback, typename... T>
+  static auto ThenWrap(Future<T...>&& future,
+                       Callback&& callback MFUTURE_CALLSITE_PARAM) {
+    return future.ThenWrap(
+        std::forward<Callback>(callback) MFUTURE_CALLSITE_ARG);
+  }
+
+  template <typename... T>
+  static void Fold(Future<T...>&& future, Promise<T...>&& promise) {
+    future.Fold(std::move(promise));
+  }
+
+  template <typename Stop, typename Function>
+  static Future<> DoUntil(Stop&& stop,
+                          Function&& function MFUTURE_CALLSITE_PARAM) {
+    return nfuture::DoUntil(std::forward<Stop>(stop),
+                            std::forward<Function>(function)
+                                MFUTURE_CALLSITE_ARG);
+  }
+
+  template <typename Function, typename... Args>
+  static auto FuturizeInvoke(Function&& f, Args&&... args) {
+    return nfuture::FuturizeInvoke(std::forward<Function>(f),
+                                   std::forward<Args>(args)...);
+  }
+
+  template <typename Function, typename Tuple>
+  static auto FuturizeApply(Function&& f, Tuple&& t) {
+    return nfuture::FuturizeApply(std::forward<Function>(f),
+                                  std::forward<Tuple>(t));
+  }
+};
+
+struct Shared {
+  static constexpr const char* kName = "shared";
+
+  template <typename... T>
+  using Future = mfuture::Future<T...>;
+
+  template <typename... T>
+  using Promise = mfuture::Promise<T...>;
+
+  template <typename... T, typename... U>
+  static Future<T...> MakeReadyFuture(U&&... value) {
+    return mfuture::MakeReadyFuture<T...>(std::forward<U>(value)...);
+  }
+
+  template <typename... T>
+  static Future<T...> MakeExceptionalFuture(std::exception_ptr&& exception) {
+    return mfuture::MakeExceptionalFuture<T...>(std::move(exception));
+  }
+
+  template <typename... T>
+  static Future<T...> MakeErrorFuture(std::error_code code) {
+    return mfuture::MakeErrorFuture<T...>(code);
+  }
+
+  template <typename... T>
+  static bool IsResolved(const Future<T...>& future) {
+    return future.IsResolved();
+  }
+
+  template <typename... T>
+  static bool IsReady(const Future<T...>& future) {
+    return future.IsReady();
+  }
+
+  template <typename... T>
+  static bool IsFailed(const Future<T...>& future) {
+    return future.IsFailed();
+  }
+
+  template <typename... T>
+  static bool HasErrorCode(const Future<T...>& future) {
+    return future.HasErrorCode();
+  }
+
+  template <typename... T>
+  static std::tuple<T...> GetValue(Future<T...>& future) {
+    return future.GetValue();
+  }
+
+  template <typename... T>
+  static std::exception_ptr GetException(Future<T...>& future) {
+    return future.GetException();
+  }
+
+  template <typename... T>
+  static std::error_code GetErrorCode(Future<T...>& future) {
+    return future.GetErrorCode();
+  }
+
+  template <typename Callback, typename... T>
+  static auto Then(Future<T...>&& future,
+                   Callback&& callback MFUTURE_CALLSITE_PARAM) {
+    return future.Then(std::forward<Callback>(callback) MFUTURE_CALLSITE_ARG);
+  }
+
+  // A callback taking the future is invoked with it by Then() as well.
+  template <typename Callback, typename... T>
+  static auto ThenWrap(Future<T...>&& future,
+                       Callback&& callback MFUTURE_CALLSITE_PARAM) {
+    return future.Then(std::forward<Callback>(callback) MFUTURE_CALLSITE_ARG);
+  }
+
+  // The promise is kept alive by the state it's folded into.
+  template <typename... T>
+  static void Fold(Future<T...>&& future, Promise<T...>&& promise) {
+    future.Fold(promise);
+  }
+
+  template <typename Stop, typename Function>
+  static Future<> DoUntil(Stop&& stop,
+                          Function&& function MFUTURE_CALLSITE_PARAM) {
+    return mfuture::DoUntil(std::forward<Stop>(stop),
+                            std::forward<Function>(function)
+                                MFUTURE_CALLSITE_ARG);
+  }
+
+  template <typename Function, typename... Args>
+  static auto FuturizeInvoke(Function&& f, Args&&... args) {
+    return mfuture::FuturizeInvoke(std::forward<Function>(f),
+                                   std::forward<Args>(args)...);
+  }
+
+  template <typename Function, typename Tuple>
+  static auto FuturizeApply(Function&& f, Tuple&& t) {
+    return mfuture::FuturizeApply(std::forward<Function>(f),
+                                  std::forward<Tuple>(t));
+  }
+};
+
+// Not deducible, see above.
+template <typename Policy, typename... T>
+using Future = typename Policy::template Future<T...>;
+
+template <typename Policy, typename... T>
+using Promise = typename Policy::template Promise<T...>;
+
+// The policy of a future or promise type.
+template <typename T>
+struct PolicyOf {};
+
+template <typename... T>
+struct PolicyOf<nfuture::Future<T...>> {
+  using type = Linked;
+};
+
+template <typename... T>
+struct PolicyOf<nfuture::Promise<T...>> {
+  using type = Linked;
+};
+
+template <typename... T>
+struct PolicyOf<mfuture::Future<T...>> {
+  using type = Shared;
+};
+
+template <typename... T>
+struct PolicyOf<mfuture::Promise<T...>> {
+  using type = Shared;
+};
+
+template <typename T>
+using PolicyOf_t = typename PolicyOf<internal::RemoveCVRef_t<T>>::type;
+
+template <typename Policy, typename... T, typename... U>
+Future<Policy, T...> MakeReadyFuture(U&&... value) {
+  return Policy::template MakeReadyFuture<T...>(std::forward<U>(value)...);
+}
+
+template <typename Policy, typename... T>
+Future<Policy, T...> MakeExceptionalFuture(std::exception_ptr&& exception) {
+  return Policy::template MakeExceptionalFuture<T...>(std::move(exception));
+}
+
+template <typename Policy, typename... T>
+Future<Policy, T...> MakeErrorFuture(std::error_code code) {
+  return Policy::template MakeErrorFuture<T...>(code);
+}
+
+template <typename F>
+bool IsResolved(const F& future) {
+  return PolicyOf_t<F>::IsResolved(future);
+}
+
+template <typename F>
+bool IsReady(const F& future) {
+  return PolicyOf_t<F>::IsReady(future);
+}
+
+template <typename F>
+bool IsFailed(const F& future) {
+  return PolicyOf_t<F>::IsFailed(future);
+}
+
+template <typename F>
+bool HasErrorCode(const F& future) {
+  return PolicyOf_t<F>::HasErrorCode(future);
+}
+
+// Consumes the value of a ready future.
+template <typename F>
+auto GetValue(F& future) {
+  return PolicyOf_t<F>::GetValue(future);
+}
+
+template <std::size_t I, typename F>
+auto GetValue(F& future) {
+  return std::get<I>(PolicyOf_t<F>::GetValue(future));
+}
+
+// Consumes the failure of a failed future. One failed by an error code makes a
+// std::system_error here, use GetErrorCode() instead to avoid the cost.
+template <typename F>
+std::exception_ptr GetException(F& future) {
+  return PolicyOf_t<F>::GetException(future);
+}
+
+template <typename F>
+std::error_code GetErrorCode(F& future) {
+  return PolicyOf_t<F>::GetErrorCode(future);
+}
+
+// Chains `callback` to be invoked with the values of `future` once ready, to
+// resolve the future returned; a failure is passed on without invoking it. A
+// callback returning a future is folded into the one returned.
+template <typename F, typename Callback>
+auto Then(F&& future, Callback&& callback MFUTURE_CALLSITE_PARAM) {
+  static_assert(!std::is_lvalue_reference_v<F>, "Then() consumes the future.");
+  return PolicyOf_t<F>::Then(std::move(future),
+                             std::forward<Callback>(callback)
+                                 MFUTURE_CALLSITE_ARG);
+}
+
+// As Then(), but `callback` is invoked with the future itself once resolved,
+// either ready or failed.
+template <typename F, typename Callback>
+auto ThenWrap(F&& future, Callback&& callback MFUTURE_CALLSITE_PARAM) {
+  static_assert(!std::is_lvalue_reference_v<F>,
+                "ThenWrap() consumes the future.");
+  return PolicyOf_t<F>::ThenWrap(std::move(future),
+                                 std::forward<Callback>(callback)
+                                     MFUTURE_CALLSITE_ARG);
+}
+
+// Forwards the result of `future` to `promise`, directly by the upstream
+// producer if it's still pending.
+template <typename F, typename P>
+void Fold(F&& future, P&& promise) {
+  static_assert(!std::is_lvalue_reference_v<F> &&
+                    !std::is_lvalue_reference_v<P>,
+                "Fold() consumes the future and the promise.");
+  static_assert(std::is_same_v<PolicyOf_t<F>, PolicyOf_t<P>>);
+  PolicyOf_t<F>::Fold(std::move(future), std::move(promise));
+}
+
+// Invokes `function`, which returns a Future<Policy>, until `stop` returns
+// true, each time the previous one is ready; it's failed by the first failure.
+template <typename Policy, typename Stop, typename Function>
+Future<Policy> DoUntil(Stop&& stop,
+                       Function&& function MFUTURE_CALLSITE_PARAM) {
+  return Policy::DoUntil(std::forward<Stop>(stop),
+                         std::forward<Function>(function)
+                             MFUTURE_CALLSITE_ARG);
+}
+
+// Invokes `f`, and makes a Future<Policy> of what it returns, unless that's
+// one already.
+template <typename Policy, typename Function, typename... Args>
+auto FuturizeInvoke(Function&& f, Args&&... args) {
+  return Policy::FuturizeInvoke(std::forward<Function>(f),
+                                std::forward<Args>(args)...);
+}
+
+template <typename Policy, typename Function, typename Tuple>
+auto FuturizeApply(Function&& f, Tuple&& t) {
+  return Policy::FuturizeApply(std::forward<Function>(f),
+                               std::forward<Tuple>(t));
+}
+
+}  // namespace future
@@ -0,0 +1,213 @@
+#include "future.h"
+
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+
+#include "gtest/gtest.h"
+
+static_assert(std::is_same_v<future::Future<future::Linked, int>,
+                             nfuture::Future<int>>);
+static_assert(std::is_same_v<future::Future<future::Shared, int>,
+                             mfuture::Future<int>>);
+static_assert(std::is_same_v<future::PolicyOf_t<nfuture::Promise<>&>,
+                             future::Linked>);
+static_assert(std::is_same_v<future::PolicyOf_t<const mfuture::Future<int>&>,
+                             future::Shared>);
+
+namespace {
+
+// Each test runs on both policies, written once as generic code is.
+template <typename Policy>
+class UnifiedFuture : public testing::Test {};
+
+using Policies = testing::Types<future::Linked, future::Shared>;
+
+struct PolicyNames {
+  template <typename Policy>
+  static std::string GetName(int) {
+    return Policy::kName;
+  }
+};
+
+// Takes a future of either policy, as Future<Policy, int> isn't deducible.
+template <typename F>
+auto Twice(F&& future) {
+  using Policy = future::PolicyOf_t<F>;
+  return future::Then(std::move(future), [](int v) {
+    return future::MakeReadyFuture<Policy, int>(v * 2);
+  });
+}
+
+}  // namespace
+
+TYPED_TEST_SUITE(UnifiedFuture, Policies, PolicyNames);
+
+TYPED_TEST(UnifiedFuture, then_ready) {
+  auto f = future::Then(future::MakeReadyFuture<TypeParam, int>(1),
+                        [](int v) { return v + 1; });
+  static_assert(std::is_same_v<decltype(f), future::Future<TypeParam, int>>);
+  ASSERT_TRUE(future::IsReady(f));
+  EXPECT_EQ(future::GetValue<0>(f), 2);
+}
+
+TYPED_TEST(UnifiedFuture, then_pending) {
+  future::Promise<TypeParam, int, char> promise;
+  auto f = future::Then(promise.GetFuture(),
+                        [](int v, char c) { return v + c; });
+  EXPECT_FALSE(future::IsResolved(f));
+
+  promise.SetValue(1, 'a');
+  ASSERT_TRUE(future::IsReady(f));
+  EXPECT_EQ(future::GetValue(f), std::make_tuple(1 + 'a'));
+}
+
+TYPED_TEST(UnifiedFuture, then_folds_returned_future) {
+  future::Promise<TypeParam> first;
+  future::Promise<TypeParam, int> second;
+  auto f = future::Then(first.GetFuture(),
+                        [&second]() { return second.GetFuture(); });
+  static_assert(std::is_same_v<decltype(f), future::Future<TypeParam, int>>);
+
+  first.SetValue();
+  EXPECT_FALSE(future::IsResolved(f));
+  second.SetValue(3);
+  ASSERT_TRUE(future::IsReady(f));
+  EXPECT_EQ(future::GetValue<0>(f), 3);
+}
+
+TYPED_TEST(UnifiedFuture, failure_skips_then) {
+  future::Promise<TypeParam, int> promise;
+  bool called = false;
+  auto f = future::Then(promise.GetFuture(), [&called](int v) {
+    called = true;
+    return v;
+  });
+  promise.SetError(std::make_error_code(std::errc::timed_out));
+
+  EXPECT_FALSE(called);
+  ASSERT_TRUE(future::IsFailed(f));
+  ASSERT_TRUE(future::HasErrorCode(f));
+  EXPECT_EQ(future::GetErrorCode(f), std::errc::timed_out);
+}
+
+TYPED_TEST(UnifiedFuture, then_wrap) {
+  using Future = future::Future<TypeParam, int>;
+  auto recover = [](Future&& f) {
+    if (future::IsFailed(f)) return -1;
+    return future::GetValue<0>(f);
+  };
+
+  auto ready = future::ThenWrap(future::MakeReadyFuture<TypeParam, int>(1),
+                                recover);
+  EXPECT_EQ(future::GetValue<0>(ready), 1);
+
+  future::Promise<TypeParam, int> promise;
+  auto failed = future::ThenWrap(promise.GetFuture(), recover);
+  EXPECT_FALSE(future::IsResolved(failed));
+  promise.SetError(std::make_error_code(std::errc::io_error));
+  ASSERT_TRUE(future::IsReady(failed));
+  EXPECT_EQ(future::GetValue<0>(failed), -1);
+}
+
+TYPED_TEST(UnifiedFuture, exception) {
+  auto f = future::MakeExceptionalFuture<TypeParam, int>(
+      std::make_exception_ptr(std::runtime_error("test")));
+  ASSERT_TRUE(future::IsFailed(f));
+  EXPECT_FALSE(future::HasErrorCode(f));
+  EXPECT_THROW(std::rethrow_exception(future::GetException(f)),
+               std::runtime_error);
+}
+
+TYPED_TEST(UnifiedFuture, fold) {
+  {
+    future::Promise<TypeParam, int> promise;
+    auto f = promise.GetFuture();
+    future::Fold(future::MakeReadyFuture<TypeParam, int>(1),
+                 std::move(promise));
+    ASSERT_TRUE(future::IsReady(f));
+    EXPECT_EQ(future::GetValue<0>(f), 1);
+  }
+  {
+    future::Promise<TypeParam, int> inner;
+    future::Promise<TypeParam, int> outer;
+    auto f = outer.GetFuture();
+    future::Fold(inner.GetFuture(), std::move(outer));
+    EXPECT_FALSE(future::IsResolved(f));
+    inner.SetValue(2);
+    ASSERT_TRUE(future::IsReady(f));
+    EXPECT_EQ(future::GetValue<0>(f), 2);
+  }
+}
+
+TYPED_TEST(UnifiedFuture, do_until) {
+  // A deque, as an iteration made by resolving a promise adds another.
+  std::deque<future::Promise<TypeParam>> promises;
+  int iterations = 0;
+  auto f = future::DoUntil<TypeParam>(
+      [&iterations]() { return iterations == 3; },
+      [&]() {
+        ++iterations;
+        promises.emplace_back();
+        return promises.back().GetFuture();
+      });
+  static_assert(std::is_same_v<decltype(f), future::Future<TypeParam>>);
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_FALSE(future::IsResolved(f));
+    ASSERT_EQ(promises.size(), static_cast<std::size_t>(i + 1));
+    promises[i].SetValue();
+  }
+  EXPECT_TRUE(future::IsReady(f));
+  EXPECT_EQ(iterations, 3);
+}
+
+TYPED_TEST(UnifiedFuture, do_until_failed) {
+  future::Promise<TypeParam> promise;
+  int iterations = 0;
+  auto f = future::DoUntil<TypeParam>([]() { return false; },
+                                      [&]() {
+                                        ++iterations;
+                                        return promise.GetFuture();
+                                      });
+  promise.SetError(std::make_error_code(std::errc::io_error));
+  EXPECT_TRUE(future::IsFailed(f));
+  EXPECT_EQ(iterations, 1);
+}
+
+TYPED_TEST(UnifiedFuture, futurize) {
+  auto v = future::FuturizeInvoke<TypeParam>([](int a) { return a * 2; }, 2);
+  static_assert(std::is_same_v<decltype(v), future::Future<TypeParam, int>>);
+  EXPECT_EQ(future::GetValue<0>(v), 4);
+
+  bool called = false;
+  auto none = future::FuturizeInvoke<TypeParam>([&called]() { called = true; });
+  static_assert(std::is_same_v<decltype(none), future::Future<TypeParam>>);
+  EXPECT_TRUE(called);
+  EXPECT_TRUE(future::IsReady(none));
+
+  auto same = future::FuturizeInvoke<TypeParam>(
+      []() { return future::MakeReadyFuture<TypeParam, char>('a'); });
+  static_assert(
+      std::is_same_v<decltype(same), future::Future<TypeParam, char>>);
+  EXPECT_EQ(future::GetValue<0>(same), 'a');
+
+  auto applied = future::FuturizeApply<TypeParam>(
+      [](int a, int b) { return a + b; }, std::make_tuple(1, 2));
+  EXPECT_EQ(future::GetValue<0>(applied), 3);
+}
+
+TYPED_TEST(UnifiedFuture, policy_deduced) {
+  future::Promise<TypeParam, int> promise;
+  auto f = Twice(promise.GetFuture());
+  static_assert(std::is_same_v<decltype(f), future::Future<TypeParam, int>>);
+  EXPECT_FALSE(future::IsResolved(f));
+
+  promise.SetValue(2);
+  ASSERT_TRUE(future::IsReady(f));
+  EXPECT_EQ(future::GetValue<0>(f), 4);
+}
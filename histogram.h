@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace internal {
+
+// A log-linear histogram of non-negative values, e.g. latencies in
+// nanoseconds. Values below 2^kSubBits are counted exactly; beyond that, each
+// power of two is split into 2^kSubBits buckets, so a value read back is off
+// by less than 1/2^kSubBits of it. Values of 2^kMaxBits and more are counted in
+// the last bucket.
+//
+// Recording is a few instructions and never allocates. A histogram isn't
+// thread-safe, so it's kept per thread, and merged for readout.
+class Histogram {
+ public:
+  static constexpr int kSubBits = 4;
+  static constexpr int kSubBuckets = 1 << kSubBits;
+  static constexpr int kMaxBits = 48;
+  static constexpr int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  void Record(std::uint64_t value) {
+    ++counts_[Index(value)];
+    ++count_;
+    sum_ += value;
+    max_ = std::max(max_, value);
+  }
+
+  std::uint64_t Count() const { return count_; }
+
+  std::uint64_t Max() const { return max_; }
+
+  double Mean() const {
+    return count_ ? static_cast<double>(sum_) / count_ : 0;
+  }
+
+  // The least value which `quantile` of the values are no more than, to the
+  // precision of the buckets, e.g. `Quantile(0.999)` for the p999.
+  std::uint64_t Quantile(double quantile) const {
+    if (count_ == 0) return 0;
+    auto rank = static_cast<std::uint64_t>(std::ceil(quantile * count_));
+    rank = std::clamp<std::uint64_t>(rank, 1, count_);
+    std::uint64_t seen = 0;
+    for (int i = 0; i < kBuckets - 1; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return std::min(UpperBound(i), max_);
+    }
+    return max_;  // The last bucket is bounded by the max only.
+  }
+
+  void Merge(const Histogram& other) {
+    for (int i = 0; i < kBuckets; ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  void Reset() { *this = Histogram(); }
+
+ private:
+  friend class ConcurrentHistogram;
+
+  static int Index(std::uint64_t value) {
+    if (value < kSubBuckets) return static_cast<int>(value);
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= kMaxBits) return kBuckets - 1;
+    int shift = msb - kSubBits;
+    return (shift + 1) * kSubBuckets +
+           static_cast<int>((value >> shift) & (kSubBuckets - 1));
+  }
+
+  // The largest value counted in bucket `index`.
+  static std::uint64_t UpperBound(int index) {
+    if (index < kSubBuckets) return index;
+    int shift = index / kSubBuckets - 1;
+    std::uint64_t lower = static_cast<std::uint64_t>(
+                              kSubBuckets + index % kSubBuckets)
+                          << shift;
+    return lower + (std::uint64_t{1} << shift) - 1;
+  }
+
+  std::uint64_t counts_[kBuckets] = {};
+  std::uint64_t count_ = 0;
+  std::uint64_t sum_ = 0;
+  std::uint64_t max_ = 0;
+};
+
+// A histogram recorded by a single thread, and read by any, e.g. one of a
+// thread registered for merging. The counters are relaxed atomics, only
+// loaded and stored by the writer, so recording costs what a Histogram's does.
+// A snapshot taken while recording may miss the latest values, yet its count
+// is always the sum of its buckets.
+class ConcurrentHistogram {
+ public:
+  // Only by the writer, the same for Reset().
+  void Record(std::uint64_t value) {
+    Add(counts_[Histogram::Index(value)], 1);
+    Add(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed))
+      max_.store(value, std::memory_order_relaxed);
+  }
+
+  // By any thread.
+  Histogram Snapshot() const {
+    Histogram histogram;
+    for (int i = 0; i < Histogram::kBuckets; ++i) {
+      histogram.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+      histogram.count_ += histogram.counts_[i];
+    }
+    histogram.sum_ = sum_.load(std::memory_order_relaxed);
+    histogram.max_ = max_.load(std::memory_order_relaxed);
+    return histogram;
+  }
+
+  void Reset() {
+    for (auto& count : counts_) count.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  static void Add(std::atomic<std::uint64_t>& counter, std::uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t> counts_[Histogram::kBuckets] = {};
+  std::atomic<std::uint64_t> sum_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+}  // namespace internal
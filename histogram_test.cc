@@ -0,0 +1,69 @@
+#include "histogram.h"
+
+#include "gtest/gtest.h"
+
+using internal::Histogram;
+
+TEST(Histogram, exact) {
+  Histogram histogram;
+  EXPECT_EQ(histogram.Quantile(0.5), 0);
+  for (int i = 1; i <= 10; ++i) histogram.Record(i);
+  EXPECT_EQ(histogram.Count(), 10);
+  EXPECT_EQ(histogram.Max(), 10);
+  EXPECT_DOUBLE_EQ(histogram.Mean(), 5.5);
+  EXPECT_EQ(histogram.Quantile(0.5), 5);
+  EXPECT_EQ(histogram.Quantile(0.9), 9);
+  EXPECT_EQ(histogram.Quantile(1), 10);
+  EXPECT_EQ(histogram.Quantile(0), 1);
+}
+
+TEST(Histogram, precision) {
+  Histogram histogram;
+  for (std::uint64_t i = 1; i <= 1000000; ++i) histogram.Record(i * 1000);
+  for (double q : {0.5, 0.99, 0.999}) {
+    auto expected = q * 1e9;
+    auto value = static_cast<double>(histogram.Quantile(q));
+    EXPECT_GE(value, expected);
+    EXPECT_LE(value, expected * (1 + 1.0 / Histogram::kSubBuckets));
+  }
+  EXPECT_EQ(histogram.Quantile(1), 1000000000);
+
+  // Clamped, yet the max is kept.
+  histogram.Record(std::uint64_t{1} << 60);
+  EXPECT_EQ(histogram.Quantile(1), std::uint64_t{1} << 60);
+}
+
+TEST(Histogram, merge) {
+  Histogram h1, h2;
+  h1.Record(1);
+  h2.Record(100);
+  h2.Record(100);
+  h1.Merge(h2);
+  EXPECT_EQ(h1.Count(), 3);
+  EXPECT_EQ(h1.Quantile(0.3), 1);
+  EXPECT_EQ(h1.Quantile(0.5), 100);
+  EXPECT_EQ(h1.Max(), 100);
+
+  h1.Reset();
+  EXPECT_EQ(h1.Count(), 0);
+  EXPECT_EQ(h1.Max(), 0);
+}
+
+TEST(Histogram, concurrent) {
+  internal::ConcurrentHistogram concurrent;
+  Histogram expected;
+  for (std::uint64_t v : {1, 7, 100, 100, 123456}) {
+    concurrent.Record(v);
+    expected.Record(v);
+  }
+  auto snapshot = concurrent.Snapshot();
+  EXPECT_EQ(snapshot.Count(), expected.Count());
+  EXPECT_EQ(snapshot.Max(), expected.Max());
+  EXPECT_DOUBLE_EQ(snapshot.Mean(), expected.Mean());
+  for (double q : {0.2, 0.5, 0.8, 1.0})
+    EXPECT_EQ(snapshot.Quantile(q), expected.Quantile(q));
+
+  concurrent.Reset();
+  EXPECT_EQ(concurrent.Snapshot().Count(), 0);
+  EXPECT_EQ(concurrent.Snapshot().Max(), 0);
+}
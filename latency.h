@@ -0,0 +1,132 @@
+#pragma once
+
+// Latency of continuations, with MFUTURE_LATENCY_STATS defined to 1. As a
+// promise is resolved, the continuation of its future is timestamped, and once
+// it runs, the delay since resolved (e.g. deferred by the trampoline, or
+// queued by an executor) and the time it runs are recorded into histograms of
+// the running thread, in nanoseconds. The time a continuation runs includes
+// the continuations it resolves and runs inline.
+//
+// The histograms of each thread are registered, so that `MergedLatencyStats()`
+// reads those of all the threads while they record, and the ones of a thread
+// exiting are merged into the registry, so that they're still counted.
+//
+// Otherwise nothing is compiled into the resolve paths.
+
+#ifndef MFUTURE_LATENCY_STATS
+#define MFUTURE_LATENCY_STATS 0
+#endif
+
+#if MFUTURE_LATENCY_STATS
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "clock.h"
+#include "histogram.h"
+
+namespace internal {
+
+struct LatencyStats {
+  Histogram delay;  // From resolving a promise to running its continuation.
+  Histogram run;    // Running a continuation.
+
+  void Merge(const LatencyStats& other) {
+    delay.Merge(other.delay);
+    run.Merge(other.run);
+  }
+};
+
+// Recorded by its own thread, and read by any.
+class LatencyRecorder {
+ public:
+  LatencyRecorder();
+  ~LatencyRecorder();
+
+  LatencyRecorder(const LatencyRecorder&) = delete;
+  LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+  LatencyStats Stats() const { return {delay.Snapshot(), run.Snapshot()}; }
+
+  void Reset() {
+    delay.Reset();
+    run.Reset();
+  }
+
+  ConcurrentHistogram delay;
+  ConcurrentHistogram run;
+};
+
+// The recorders of the running threads, and the stats of the ones exited.
+struct LatencyRegistry {
+  std::mutex mutex;
+  std::vector<const LatencyRecorder*> threads;
+  LatencyStats exited;
+
+  // Leaked, as the recorder of a thread exiting after static destruction
+  // still merges into it.
+  static LatencyRegistry& Get() {
+    static auto registry = new LatencyRegistry;
+    return *registry;
+  }
+};
+
+inline LatencyRecorder::LatencyRecorder() {
+  auto& registry = LatencyRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.threads.push_back(this);
+}
+
+inline LatencyRecorder::~LatencyRecorder() {
+  auto& registry = LatencyRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.exited.Merge(Stats());
+  registry.threads.erase(
+      std::find(registry.threads.begin(), registry.threads.end(), this));
+}
+
+inline LatencyRecorder& ThreadLatencyRecorder() {
+  static thread_local LatencyRecorder recorder;
+  return recorder;
+}
+
+// The stats of the calling thread.
+inline LatencyStats ThreadLatencyStats() {
+  return ThreadLatencyRecorder().Stats();
+}
+
+inline void ResetThreadLatencyStats() { ThreadLatencyRecorder().Reset(); }
+
+// The stats of all the threads, including the ones exited.
+inline LatencyStats MergedLatencyStats() {
+  auto& registry = LatencyRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto stats = registry.exited;
+  for (auto recorder : registry.threads) stats.Merge(recorder->Stats());
+  return stats;
+}
+
+// Times a continuation resolved at `resolved`, for the lifetime of the timer.
+class ContinuationTimer {
+ public:
+  explicit ContinuationTimer(std::uint64_t resolved)
+      : start_(NowNanoseconds()) {
+    ThreadLatencyRecorder().delay.Record(start_ - resolved);
+  }
+
+  ~ContinuationTimer() {
+    ThreadLatencyRecorder().run.Record(NowNanoseconds() - start_);
+  }
+
+  ContinuationTimer(const ContinuationTimer&) = delete;
+  ContinuationTimer& operator=(const ContinuationTimer&) = delete;
+
+ private:
+  std::uint64_t start_;
+};
+
+}  // namespace internal
+
+#endif  // MFUTURE_LATENCY_STATS
@@ -0,0 +1,141 @@
+// Built with MFUTURE_LATENCY_STATS, so that continuations are timed.
+
+#include "latency.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if !MFUTURE_LATENCY_STATS
+#error "This test should be built with MFUTURE_LATENCY_STATS=1."
+#endif
+
+using internal::ThreadLatencyStats;
+
+namespace {
+
+constexpr auto kSleep = std::chrono::milliseconds(1);
+constexpr std::uint64_t kSleepNs = 1000000;
+
+class LatencyTest : public testing::Test {
+ protected:
+  void SetUp() override { internal::ResetThreadLatencyStats(); }
+};
+
+}  // namespace
+
+TEST_F(LatencyTest, nfuture) {
+  using namespace nfuture;
+
+  Promise<int> promise;
+  auto future = promise.GetFuture()
+                    .Then([](int v) {
+                      std::this_thread::sleep_for(kSleep);
+                      return v + 1;
+                    })
+                    .Then([](int v) { return v + 1; });
+  // Ready futures run their callbacks without continuations.
+  auto ready = MakeReadyFuture<int>(1).Then([](int v) { return v; });
+  EXPECT_TRUE(ready.Ready());
+  EXPECT_EQ(ThreadLatencyStats().run.Count(), 0);
+
+  promise.SetValue(1);
+  EXPECT_EQ(future.Value<0>(), 3);
+  auto stats = ThreadLatencyStats();
+  EXPECT_EQ(stats.delay.Count(), 2);
+  EXPECT_EQ(stats.run.Count(), 2);
+  // Only the first one sleeps, though the second one runs as part of it.
+  EXPECT_GE(stats.run.Max(), kSleepNs);
+  EXPECT_LT(stats.run.Quantile(0.5), kSleepNs);
+  EXPECT_LT(stats.delay.Quantile(1), kSleepNs);
+}
+
+TEST_F(LatencyTest, nfuture_deferred) {
+  using namespace nfuture;
+
+  Promise<int> promise;
+  auto future = promise.GetFuture();
+  constexpr int kDepth = 1000;
+  for (int i = 0; i < kDepth; ++i)
+    future = future.Then([](int v) { return v + 1; });
+  promise.SetValue(0);
+  EXPECT_EQ(future.Value<0>(), kDepth);
+  // Deferred ones as well.
+  EXPECT_EQ(ThreadLatencyStats().delay.Count(), kDepth);
+  EXPECT_EQ(ThreadLatencyStats().run.Count(), kDepth);
+}
+
+TEST_F(LatencyTest, mfuture) {
+  using namespace mfuture;
+
+  Promise<int> promise;
+  auto future = promise.GetFuture()
+                    .Then([](int v) {
+                      std::this_thread::sleep_for(kSleep);
+                      return v + 1;
+                    })
+                    .Then([](int v) { return v + 1; });
+  EXPECT_EQ(ThreadLatencyStats().run.Count(), 0);
+
+  promise.SetValue(1);
+  EXPECT_EQ(future.GetValue<0>(), 3);
+  auto stats = ThreadLatencyStats();
+  EXPECT_EQ(stats.delay.Count(), 2);
+  EXPECT_EQ(stats.run.Count(), 2);
+  EXPECT_GE(stats.run.Max(), kSleepNs);
+  EXPECT_LT(stats.run.Quantile(0.5), kSleepNs);
+  EXPECT_LT(stats.delay.Quantile(1), kSleepNs);
+}
+
+TEST_F(LatencyTest, mfuture_deferred) {
+  using namespace mfuture;
+
+  Promise<int> promise;
+  auto future = promise.GetFuture();
+  constexpr int kDepth = 1000;
+  for (int i = 0; i < kDepth; ++i)
+    future = future.Then([](int v) { return v + 1; });
+  promise.SetValue(0);
+  EXPECT_EQ(future.GetValue<0>(), kDepth);
+  EXPECT_EQ(ThreadLatencyStats().delay.Count(), kDepth);
+  EXPECT_EQ(ThreadLatencyStats().run.Count(), kDepth);
+}
+
+TEST_F(LatencyTest, merged) {
+  static constexpr int kDepth = 100;
+  // Chains of `kDepth` continuations on a thread.
+  auto record = [] {
+    nfuture::Promise<int> promise;
+    auto future = promise.GetFuture();
+    for (int i = 0; i < kDepth; ++i)
+      future = future.Then([](int v) { return v + 1; });
+    promise.SetValue(0);
+    EXPECT_EQ(future.Value<0>(), kDepth);
+  };
+  auto before = internal::MergedLatencyStats();
+
+  // Read while the others record.
+  std::atomic<bool> recorded{false};
+  std::thread running([&] {
+    record();
+    recorded = true;
+    while (recorded) std::this_thread::yield();
+  });
+  std::thread exited(record);
+  exited.join();
+  while (!recorded) internal::MergedLatencyStats();
+  auto merged = internal::MergedLatencyStats();
+  EXPECT_EQ(merged.run.Count() - before.run.Count(), 2 * kDepth);
+  EXPECT_EQ(merged.delay.Count() - before.delay.Count(), 2 * kDepth);
+  recorded = false;
+  running.join();
+
+  // Once both exited.
+  merged = internal::MergedLatencyStats();
+  EXPECT_EQ(merged.run.Count() - before.run.Count(), 2 * kDepth);
+  EXPECT_EQ(ThreadLatencyStats().run.Count(), 0);
+}
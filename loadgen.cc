@@ -0,0 +1,413 @@
+// A load generator driving synthetic request graphs on mfuture or nfuture, for
+// the end-to-end throughput and latency under queueing, which the benchmarks
+// of single operations don't show. The graphs are written once over the
+// policies of future.h, nfuture being the linked one and mfuture the shared.
+//
+// A request is a graph of calls to a simulated backend, each resolved by the
+// event loop after an exponentially distributed service time, or failed with
+// an error code at --failure_rate:
+//
+//   chain   --depth calls in sequence, each chained by Then().
+//   fanout  --fanout calls at once, joined as all of them resolve.
+//   loop    --depth calls in sequence, by DoUntil().
+//   mixed   --fanout branches at once, of a chain, a loop and a single call
+//           in turn.
+//
+// A failure fails the rest of the request, which is counted as failed.
+//
+// In open-loop mode (--mode=open), requests are started at a fixed --rate per
+// second regardless of how many are outstanding, and the latency is measured
+// from when each was due to start. A request started late, as the loop is
+// held up, is charged for the delay, so that the numbers are free of
+// coordinated omission. In closed-loop mode (--mode=closed), --concurrency
+// requests are kept outstanding, each started as another completes, which
+// gives the throughput at saturation; its latencies are measured from the
+// actual start, and understate the tail once queueing builds up.
+//
+// Everything runs on a single thread. Requests due to start within --warmup
+// seconds are run but not recorded. Build with -c opt, e.g.
+//
+//   loadgen --library=nfuture --graph=mixed --mode=open --rate=20000
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+#include "future.h"
+#include "histogram.h"
+
+namespace {
+
+struct Options {
+  std::string library = "nfuture";
+  std::string graph = "chain";
+  std::string mode = "open";
+  double rate = 10000;      // Requests per second, open-loop.
+  int concurrency = 64;     // Outstanding requests, closed-loop.
+  double duration = 10;     // Seconds.
+  double warmup = 0;        // Seconds.
+  int fanout = 4;
+  int depth = 4;
+  double failure_rate = 0;  // Of each call.
+  double service_us = 100;  // Mean service time of a call.
+  std::uint64_t seed = 1;
+};
+
+// Invokes `callback` with whether `request` failed, once resolved.
+template <typename Future, typename Callback>
+void OnDone(Future&& request, Callback&& callback) {
+  using Policy = future::PolicyOf_t<Future>;
+  (void)future::ThenWrap(
+      std::move(request),
+      [callback = std::forward<Callback>(callback)](
+          future::Future<Policy>&& done) mutable {
+        callback(future::IsFailed(done));
+      });
+}
+
+// The simulated backend: calls outstanding, in a min-heap by deadline.
+template <typename Policy>
+class Backend {
+ public:
+  using Future = future::Future<Policy>;
+
+  explicit Backend(const Options& options)
+      : rng_(options.seed),
+        service_(1 / std::max(options.service_us * 1e3, 1.0)),
+        exponential_(options.service_us > 0),
+        failure_(options.failure_rate) {}
+
+  Future Call() {
+    std::size_t slot;
+    if (free_.empty()) {
+      slot = promises_.size();
+      promises_.emplace_back();
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+    }
+    auto future = promises_[slot].emplace().GetFuture();
+
+    auto service = exponential_ ? service_(rng_) : 0;
+    calls_.push_back({internal::NowNanoseconds() +
+                          static_cast<std::uint64_t>(service),
+                      slot, failure_(rng_)});
+    std::push_heap(calls_.begin(), calls_.end(), Later);
+    return future;
+  }
+
+  // Resolves the calls due by `now`, which run the continuations inline, and
+  // might make further calls.
+  void Run(std::uint64_t now) {
+    while (!calls_.empty() && calls_.front().deadline <= now) {
+      std::pop_heap(calls_.begin(), calls_.end(), Later);
+      auto call = calls_.back();
+      calls_.pop_back();
+      // Taken out first, as the continuations might make calls, and grow the
+      // slots.
+      auto promise = std::move(*promises_[call.slot]);
+      promises_[call.slot].reset();
+      free_.push_back(call.slot);
+      if (call.fail)
+        promise.SetError(std::make_error_code(std::errc::io_error));
+      else
+        promise.SetValue();
+    }
+  }
+
+  // The deadline of the next call due, if any, otherwise UINT64_MAX.
+  std::uint64_t Next() const {
+    return calls_.empty() ? UINT64_MAX : calls_.front().deadline;
+  }
+
+ private:
+  struct Pending {
+    std::uint64_t deadline;
+    std::size_t slot;  // Of the promise.
+    bool fail;
+  };
+
+  static bool Later(const Pending& a, const Pending& b) {
+    return a.deadline > b.deadline;
+  }
+
+  std::vector<Pending> calls_;
+  // Promises aren't assignable, so they're kept in slots, reused as freed.
+  std::vector<std::optional<future::Promise<Policy>>> promises_;
+  std::vector<std::size_t> free_;
+  std::mt19937_64 rng_;
+  std::exponential_distribution<double> service_;
+  bool exponential_;
+  std::bernoulli_distribution failure_;
+};
+
+template <typename Policy>
+class LoadGenerator {
+ public:
+  using Future = future::Future<Policy>;
+
+  explicit LoadGenerator(const Options& options)
+      : options_(options), backend_(options) {}
+
+  void Run() {
+    auto start = internal::NowNanoseconds();
+    auto end = start + Seconds(options_.duration);
+    recorded_from_ = start + Seconds(options_.warmup);
+
+    bool open = options_.mode == "open";
+    auto interval = Seconds(1 / options_.rate);
+    auto next = start;  // Due to start, open-loop.
+    if (!open) {
+      issuing_ = true;
+      for (int i = 0; i < options_.concurrency; ++i) Issue(start);
+    }
+
+    for (;;) {
+      auto now = internal::NowNanoseconds();
+      if (open) {
+        for (; next <= now && next < end; next += interval) {
+          lag_ = std::max(lag_, now - next);
+          Issue(next);
+        }
+      } else if (now >= end) {
+        issuing_ = false;
+      }
+      backend_.Run(now);
+      if (now >= end && outstanding_ == 0) break;
+
+      auto wake = backend_.Next();
+      if (open && next < end) wake = std::min(wake, next);
+      Wait(wake);
+    }
+    elapsed_ = internal::NowNanoseconds() - recorded_from_;
+  }
+
+  void Report() const {
+    auto seconds = elapsed_ / 1e9;
+    std::printf("library %s, graph %s, %s-loop, %.1f s\n",
+                options_.library.c_str(),
+                options_.graph.c_str(), options_.mode.c_str(), seconds);
+    std::printf("requests %llu, failed %llu, throughput %.1f/s\n",
+                static_cast<unsigned long long>(completed_),
+                static_cast<unsigned long long>(failed_),
+                seconds > 0 ? completed_ / seconds : 0.0);
+    if (options_.mode == "open")
+      std::printf("max start lag %.3f us\n", lag_ / 1e3);
+
+    // As HdrHistogram prints the percentile distribution.
+    std::printf("\n%12s %12s %12s %18s\n", "Value(us)", "Percentile",
+                "TotalCount", "1/(1-Percentile)");
+    for (double quantile : {0.0, 0.5, 0.75, 0.9, 0.95, 0.99, 0.995, 0.999,
+                            0.9999, 0.99999, 1.0}) {
+      auto count = static_cast<std::uint64_t>(
+          std::ceil(quantile * latency_.Count()));
+      std::printf("%12.3f %12.6f %12llu", latency_.Quantile(quantile) / 1e3,
+                  quantile, static_cast<unsigned long long>(count));
+      if (quantile < 1)
+        std::printf(" %18.2f\n", 1 / (1 - quantile));
+      else
+        std::printf(" %18s\n", "inf");
+    }
+    std::printf("#[Mean = %.3f, Max = %.3f, Total count = %llu]\n",
+                latency_.Mean() / 1e3, latency_.Max() / 1e3,
+                static_cast<unsigned long long>(latency_.Count()));
+  }
+
+ private:
+  static std::uint64_t Seconds(double seconds) {
+    return static_cast<std::uint64_t>(seconds * 1e9);
+  }
+
+  // Sleeps until `deadline`, but spins through the last stretch, as sleeping
+  // overshoots by tens of microseconds.
+  static void Wait(std::uint64_t deadline) {
+    constexpr std::uint64_t kSpin = 100'000;
+    auto now = internal::NowNanoseconds();
+    if (deadline <= now) return;
+    if (deadline - now > kSpin)
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(deadline - now - kSpin));
+    while (internal::NowNanoseconds() < deadline) {
+    }
+  }
+
+  // Starts a request due at `due`.
+  void Issue(std::uint64_t due) {
+    ++outstanding_;
+    OnDone(Build(), [this, due](bool failed) { Complete(due, failed); });
+  }
+
+  void Complete(std::uint64_t due, bool failed) {
+    --outstanding_;
+    if (due >= recorded_from_) {
+      ++completed_;
+      if (failed) ++failed_;
+      latency_.Record(internal::NowNanoseconds() - due);
+    }
+    if (issuing_) Issue(internal::NowNanoseconds());
+  }
+
+  Future Build() {
+    auto& graph = options_.graph;
+    if (graph == "chain") return Chain(options_.depth);
+    if (graph == "fanout")
+      return FanOut(options_.fanout, [this](int) { return backend_.Call(); });
+    if (graph == "loop") return Loop(options_.depth);
+    return FanOut(options_.fanout, [this](int i) {
+      switch (i % 3) {
+        case 0:
+          return Chain(options_.depth);
+        case 1:
+          return Loop(options_.depth);
+        default:
+          return backend_.Call();
+      }
+    });
+  }
+
+  Future Chain(int depth) {
+    auto chain = future::MakeReadyFuture<Policy>();
+    for (int i = 0; i < depth; ++i)
+      chain = future::Then(std::move(chain),
+                           [this]() { return backend_.Call(); });
+    return chain;
+  }
+
+  Future Loop(int depth) {
+    return future::DoUntil<Policy>([remaining = depth]() mutable {
+      return remaining-- == 0;
+    }, [this]() { return backend_.Call(); });
+  }
+
+  // Resolves as all of the `width` branches made by `branch(i)` resolve, and
+  // fails if any of them does.
+  template <typename Branch>
+  Future FanOut(int width, Branch&& branch) {
+    struct Join {
+      explicit Join(int width) : pending(width) {}
+
+      int pending;
+      bool failed = false;
+      future::Promise<Policy> promise;
+    };
+    auto join = new Join(width);
+    auto future = join->promise.GetFuture();
+    for (int i = 0; i < width; ++i) {
+      OnDone(branch(i), [join](bool failed) {
+        join->failed |= failed;
+        if (--join->pending) return;
+        if (join->failed)
+          join->promise.SetError(std::make_error_code(std::errc::io_error));
+        else
+          join->promise.SetValue();
+        delete join;
+      });
+    }
+    return future;
+  }
+
+  const Options& options_;
+  Backend<Policy> backend_;
+  internal::Histogram latency_;  // Nanoseconds.
+  std::uint64_t recorded_from_ = 0;
+  std::uint64_t elapsed_ = 0;
+  std::uint64_t lag_ = 0;
+  std::uint64_t completed_ = 0;
+  std::uint64_t failed_ = 0;
+  std::int64_t outstanding_ = 0;
+  bool issuing_ = false;  // Closed-loop, while a completion starts another.
+};
+
+template <typename Policy>
+void Run(const Options& options) {
+  LoadGenerator<Policy> generator(options);
+  generator.Run();
+  generator.Report();
+}
+
+[[noreturn]] void Usage(const char* argv0) {
+  std::fprintf(
+      stderr,
+      "usage: %s [--library=nfuture|mfuture] "
+      "[--graph=chain|fanout|loop|mixed]\n"
+      "    [--mode=open|closed] [--rate=<per second>] "
+      "[--concurrency=<n>]\n"
+      "    [--duration=<seconds>] [--warmup=<seconds>] [--fanout=<n>] "
+      "[--depth=<n>]\n"
+      "    [--failure_rate=<0..1>] [--service_us=<mean>] [--seed=<n>]\n",
+      argv0);
+  std::exit(2);
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* eq = std::strchr(arg, '=');
+    if (std::strncmp(arg, "--", 2) != 0 || !eq) Usage(argv[0]);
+    std::string name(arg + 2, eq);
+    const char* value = eq + 1;
+    if (name == "library")
+      options.library = value;
+    else if (name == "graph")
+      options.graph = value;
+    else if (name == "mode")
+      options.mode = value;
+    else if (name == "rate")
+      options.rate = std::atof(value);
+    else if (name == "concurrency")
+      options.concurrency = std::atoi(value);
+    else if (name == "duration")
+      options.duration = std::atof(value);
+    else if (name == "warmup")
+      options.warmup = std::atof(value);
+    else if (name == "fanout")
+      options.fanout = std::atoi(value);
+    else if (name == "depth")
+      options.depth = std::atoi(value);
+    else if (name == "failure_rate")
+      options.failure_rate = std::atof(value);
+    else if (name == "service_us")
+      options.service_us = std::atof(value);
+    else if (name == "seed")
+      options.seed = std::strtoull(value, nullptr, 10);
+    else
+      Usage(argv[0]);
+  }
+
+  bool valid = (options.library == "nfuture" || options.library == "mfuture") &&
+               (options.graph == "chain" || options.graph == "fanout" ||
+                options.graph == "loop" || options.graph == "mixed") &&
+               (options.mode == "open" || options.mode == "closed") &&
+               options.rate > 0 && options.concurrency > 0 &&
+               options.duration > 0 && options.warmup >= 0 &&
+               options.warmup < options.duration && options.fanout > 0 &&
+               options.depth > 0 && options.failure_rate >= 0 &&
+               options.failure_rate <= 1 && options.service_us >= 0;
+  if (!valid) Usage(argv[0]);
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto options = ParseOptions(argc, argv);
+  if (options.library == "nfuture")
+    Run<future::Linked>(options);
+  else
+    Run<future::Shared>(options);
+  return 0;
+}
@@ -5,10 +5,30 @@
 #include <type_traits>
 #include <tuple>
 #include <memory>
-#include <variant>
 #include <cassert>
-
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include "alloc.h"
+#include "callsite.h"
+#include "census.h"
+#include "exception.h"
+#include "latency.h"
+#include "small_vector.h"
+#include "trace.h"
 #include "traits.h"
+#include "trampoline.h"
+
+// Exceptions thrown by user callbacks are caught into futures. Without
+// exceptions (i.e. -fno-exceptions), failures are carried by error codes only.
+#if __cpp_exceptions
+#define MFUTURE_TRY try
+#define MFUTURE_CATCH_ALL catch (...)
+#else
+#define MFUTURE_TRY if (true)
+#define MFUTURE_CATCH_ALL else
+#endif
 
 namespace mfuture {
 
@@ -25,11 +45,29 @@ Future<T...> MakeExceptionalFuture(std::exception_ptr&&);
 template <typename... T, typename E>
 Future<T...> MakeExceptionalFuture(E&&);
 
+template <typename... T>
+Future<T...> MakeErrorFuture(std::error_code);
+
 template <typename... T>
 class Promise;
 
+template <typename... T>
+class ReadyFuture;
+
+template <typename... T>
+class PromisePool;
+
+template <typename... T>
+class SharedFuture;
+
 namespace details {
 
+template <typename... T>
+class Continuation;
+
+template <typename... T>
+void SetContinuation(Future<T...>&, Continuation<T...>*);
+
 struct Tag;  // Is incomplete type OK?
 
 template <typename... T>
@@ -61,6 +99,16 @@ static_assert(IsFuture_v<Futurized<void>>);
 static_assert(IsFuture_v<Futurized<int>>);
 static_assert(IsFuture_v<Futurized<Future<int>>>);
 
+template <typename T>
+struct IsReadyFuture : std::false_type {};
+
+template <typename... T>
+struct IsReadyFuture<ReadyFuture<T...>> : std::true_type {};
+
+template <typename T>
+constexpr bool IsReadyFuture_v =
+    IsReadyFuture<internal::RemoveCVRef_t<T>>::value;
+
 struct MakeReadyFutureTag {};
 struct MakeExceptionalFutureTag {};
 
@@ -76,20 +124,73 @@ F MakeExceptionalFuture0(std::exception_ptr&& e) {
   return F(details::MakeExceptionalFutureTag{}, std::move(e));
 }
 
+template <typename F>
+F MakeErrorFuture0(std::error_code code) {
+  static_assert(IsFuture_v<F>, "F should be a substantial future type.");
+  return F(details::MakeExceptionalFutureTag{}, code);
+}
+
+// Continuations are dispatched through a single function pointer instead of
+// virtual functions, so there is neither a vtable nor a virtual destructor, and
+// each dispatcher is specialized for its own continuation type.
 template <typename... T>
-class Continuation {
+class Continuation
+    : public internal::Allocated<internal::AllocSite::kContinuation> {
  public:
-  // Ref: https://en.cppreference.com/w/cpp/memory/unique_ptr
-  // If T is a derived class of some base B, then std::unique_ptr<T> is
-  // implicitly convertible to std::unique_ptr<B>. The default deleter of the
-  // resulting std::unique_ptr<B> will use operator delete for B, leading to
-  // undefined behavior unless the destructor of B is virtual.
-  virtual ~Continuation() {}
+  enum class Op { kReady, kFail, kError, kDestroy };
+  // `arg` points to the value for kReady, the exception for kFail, or the
+  // error code for kError.
+  using Dispatcher = void (*)(Continuation*, Op, void* arg);
+
+  // Without a virtual destructor, a continuation is also released through its
+  // dispatcher.
+  struct Deleter {
+    void operator()(Continuation* continuation) const {
+      continuation->dispatcher_(continuation, Op::kDestroy, nullptr);
+    }
+  };
+  using Pointer = std::unique_ptr<Continuation, Deleter>;
+
+  void Ready(std::tuple<T...>&& val) {
+    dispatcher_(this, Op::kReady, &val);
+  }
+
+  void Fail(std::exception_ptr&& e) { dispatcher_(this, Op::kFail, &e); }
 
-  virtual void Ready(std::tuple<T...>&& val) = 0;
-  virtual void Fail(std::exception_ptr&& e) = 0;
+  void Error(std::error_code code) { dispatcher_(this, Op::kError, &code); }
+
+#if MFUTURE_CALLSITE_STATS
+  std::uint32_t callsite_ = 0;  // Where it's chained.
+#endif
+#if MFUTURE_CENSUS
+  internal::CensusNode census_;
+#endif
 
  protected:
+  explicit Continuation(Dispatcher dispatcher) : dispatcher_(dispatcher) {}
+  ~Continuation() = default;
+
+  // Forwards an operation to `Derived::OnReady`/`OnFail`/`OnError`.
+  template <typename Derived>
+  static void Dispatch(Continuation* base, Op op, void* arg) {
+    auto continuation = static_cast<Derived*>(base);
+    switch (op) {
+      case Op::kReady:
+        continuation->OnReady(
+            std::move(*static_cast<std::tuple<T...>*>(arg)));
+        break;
+      case Op::kFail:
+        continuation->OnFail(std::move(*static_cast<std::exception_ptr*>(arg)));
+        break;
+      case Op::kError:
+        continuation->OnError(*static_cast<std::error_code*>(arg));
+        break;
+      case Op::kDestroy:
+        delete continuation;
+        break;
+    }
+  }
+
   template <typename Callback, typename V, typename PromiseType>
   static void Resolve(Callback&& cb, V&& v, PromiseType&& pr) {
     using R = typename internal::ClosureTraits<Callback>::ReturnType;
@@ -100,7 +201,7 @@ class Continuation {
     // original promise/future both are destroyed in the user callback, then
     // this continuation where this promise exists is also destroyed.
     PromiseType promise(std::move(pr));
-    try {
+    MFUTURE_TRY {
       if constexpr (std::is_void_v<R>) {
         std::apply(std::forward<Callback>(cb), std::forward<V>(v));
         promise.SetValue();  // FIMXE: noexcept?
@@ -111,10 +212,29 @@ class Continuation {
         auto r = std::apply(std::forward<Callback>(cb), std::forward<V>(v));
         r.Fold(promise);
       }
-    } catch (...) {
-      promise.SetException(std::current_exception());
     }
+    MFUTURE_CATCH_ALL { promise.SetException(std::current_exception()); }
   }
+
+  // Resolves `pr` by `handler` invoked with the failure `error`, if it's
+  // invocable with that, otherwise passes the failure on.
+  template <typename Handler, typename Error, typename PromiseType>
+  static void ResolveFailure(Handler&& handler, Error&& error,
+                             PromiseType&& pr) {
+    using RawError = internal::RemoveCVRef_t<Error>;
+    if constexpr (std::is_invocable_v<Handler, RawError>) {
+      Resolve(std::forward<Handler>(handler),
+              std::forward_as_tuple(std::forward<Error>(error)),
+              std::forward<PromiseType>(pr));
+    } else if constexpr (std::is_same_v<RawError, std::error_code>) {
+      pr.SetError(error);
+    } else {
+      pr.SetException(std::move(error));
+    }
+  }
+
+ private:
+  Dispatcher dispatcher_;
 };
 
 template <typename Callback, typename... T>
@@ -122,23 +242,31 @@ class ContinuationWithValue : public Continuation<T...> {
   using R = typename internal::ClosureTraits<Callback>::ReturnType;
   using PromiseType = typename Futurized<R>::PromiseType;
 
-  void Ready(std::tuple<T...>&& val) override {
+  void OnReady(std::tuple<T...>&& val) {
     Continuation<T...>::Resolve(std::move(cb_), std::move(val), std::move(pr_));
   }
 
-  void Fail(std::exception_ptr&& e) override {
+  void OnFail(std::exception_ptr&& e) {
     // skip cb_
     pr_.SetException(std::move(e));
   }
 
+  void OnError(std::error_code code) {
+    // skip cb_
+    pr_.SetError(code);
+  }
+
   Callback cb_;
   PromiseType pr_;
 
+  friend class Continuation<T...>;
+
  public:
   ContinuationWithValue(Callback&& cb, PromiseType&& pr)
-      : cb_(std::forward<Callback>(cb)), pr_(std::move(pr)) {}
-
-  ~ContinuationWithValue() override {}
+      : Continuation<T...>(
+            &Continuation<T...>::template Dispatch<ContinuationWithValue>),
+        cb_(std::forward<Callback>(cb)),
+        pr_(std::move(pr)) {}
 };
 
 template <typename Callback, typename... T>
@@ -146,7 +274,7 @@ class ContinuationWithFuture : public Continuation<T...> {
   using R = typename internal::ClosureTraits<Callback>::ReturnType;
   using PromiseType = typename Futurized<R>::PromiseType;
 
-  void Ready(std::tuple<T...>&& val) override {
+  void OnReady(std::tuple<T...>&& val) {
     auto ft = std::apply(MakeReadyFuture0<T...>,
                          std::forward<std::tuple<T...>>(std::move(val)));
     // We must use make_tuple instead of forward_as_tuple here, because
@@ -157,65 +285,164 @@ class ContinuationWithFuture : public Continuation<T...> {
                                 std::move(pr_));
   }
 
-  void Fail(std::exception_ptr&& e) override {
+  void OnFail(std::exception_ptr&& e) {
     auto ft = MakeExceptionalFuture<T...>(std::move(e));
     Continuation<T...>::Resolve(std::move(cb_), std::make_tuple(std::move(ft)),
                                 std::move(pr_));
   }
 
+  void OnError(std::error_code code) {
+    auto ft = MakeErrorFuture<T...>(code);
+    Continuation<T...>::Resolve(std::move(cb_), std::make_tuple(std::move(ft)),
+                                std::move(pr_));
+  }
+
   Callback cb_;
   PromiseType pr_;
 
+  friend class Continuation<T...>;
+
  public:
   ContinuationWithFuture(Callback&& cb, PromiseType&& pr)
-      : cb_(std::forward<Callback>(cb)), pr_(std::move(pr)) {}
+      : Continuation<T...>(
+            &Continuation<T...>::template Dispatch<ContinuationWithFuture>),
+        cb_(std::forward<Callback>(cb)),
+        pr_(std::move(pr)) {}
+};
+
+// Invokes `on_value` with a value as ContinuationWithValue does, and
+// `on_error` with a failure as a ThenOnError() handler, so neither result is
+// wrapped into a future first.
+template <typename ValueCallback, typename ErrorHandler, typename... T>
+class ContinuationWithValueOrError : public Continuation<T...> {
+  using R = typename internal::ClosureTraits<ValueCallback>::ReturnType;
+  using PromiseType = typename Futurized<R>::PromiseType;
+
+  void OnReady(std::tuple<T...>&& val) {
+    Continuation<T...>::Resolve(std::move(on_value_), std::move(val),
+                                std::move(pr_));
+  }
+
+  void OnFail(std::exception_ptr&& e) {
+    Continuation<T...>::ResolveFailure(std::move(on_error_), std::move(e),
+                                       std::move(pr_));
+  }
+
+  void OnError(std::error_code code) {
+    Continuation<T...>::ResolveFailure(std::move(on_error_), code,
+                                       std::move(pr_));
+  }
+
+  ValueCallback on_value_;
+  ErrorHandler on_error_;
+  PromiseType pr_;
+
+  friend class Continuation<T...>;
 
-  ~ContinuationWithFuture() override {}
+ public:
+  template <typename V, typename E>
+  ContinuationWithValueOrError(V&& on_value, E&& on_error, PromiseType&& pr)
+      : Continuation<T...>(&Continuation<T...>::template Dispatch<
+                           ContinuationWithValueOrError>),
+        on_value_(std::forward<V>(on_value)),
+        on_error_(std::forward<E>(on_error)),
+        pr_(std::move(pr)) {}
 };
 
-template <typename... T>
-class FutureState {
-  static_assert(sizeof...(T) == 0 || internal::IsDefaultConstructible_v<T...>,
-                "Types should be default-constructible.");
+// Recovers from an exception of type E, or derived from E, by `handler`, and
+// passes anything else on untouched, without wrapping it into a future.
+template <typename E, typename Handler, typename... T>
+class ContinuationWithException : public Continuation<T...> {
+  void OnReady(std::tuple<T...>&& val) { pr_.SetValue(std::move(val)); }
+
+  void OnFail(std::exception_ptr&& e) {
+    if (auto error = internal::ExceptionCast<E>(e)) {
+      Continuation<T...>::Resolve(std::move(handler_),
+                                  std::forward_as_tuple(*error),
+                                  std::move(pr_));
+    } else {
+      pr_.SetException(std::move(e));
+    }
+  }
+
+  void OnError(std::error_code code) { pr_.SetError(code); }
+
+  Handler handler_;
+  Promise<T...> pr_;
+
+  friend class Continuation<T...>;
 
+ public:
+  template <typename H>
+  ContinuationWithException(H&& handler, Promise<T...>&& pr)
+      : Continuation<T...>(&Continuation<T...>::template Dispatch<
+                           ContinuationWithException>),
+        handler_(std::forward<H>(handler)),
+        pr_(std::move(pr)) {}
+};
+
+template <typename... T>
+class FutureState
+    : public internal::Allocated<internal::AllocSite::kFutureState> {
  public:
   template <typename... U>
   void SetValue(U&&... val) {
-    assert(inner_->state == 0);
+    Unpark();
+    new (&inner_->value) std::tuple<T...>(std::forward<U>(val)...);
     inner_->state = 1;
-    // Ref: https://en.cppreference.com/w/cpp/language/dependent_name
-    inner_->result.template emplace<0>(std::forward<U>(val)...);
-    TrySchedule();
+    Resolved();
   }
 
   void SetValue(std::tuple<T...>&& val) {
-    assert(inner_->state == 0);
+    Unpark();
+    new (&inner_->value) std::tuple<T...>(std::move(val));
     inner_->state = 1;
-    inner_->result.template emplace<0>(std::move(val));
-    TrySchedule();
+    Resolved();
   }
 
   void SetValue(const std::tuple<T...>& val) {
-    assert(inner_->state == 0);
+    Unpark();
+    new (&inner_->value) std::tuple<T...>(val);
     inner_->state = 1;
-    inner_->result.template emplace<0>(val);
-    TrySchedule();
+    Resolved();
+  }
+
+  template <typename... Args>
+  void Emplace(Args&&... args) {
+    Unpark();
+    if constexpr (std::is_constructible_v<std::tuple<T...>, Args&&...>) {
+      new (&inner_->value) std::tuple<T...>(std::forward<Args>(args)...);
+    } else {
+      static_assert(sizeof...(T) == 1,
+                    "Values should be constructed elementwise.");
+      // std::tuple is unable to construct its element from several arguments,
+      // so it costs a move.
+      new (&inner_->value) std::tuple<T...>(T(std::forward<Args>(args)...)...);
+    }
+    inner_->state = 1;
+    Resolved();
   }
 
   void SetException(std::exception_ptr&& e) {
-    assert(inner_->state == 0);
+    Unpark();
+    new (&inner_->exception) std::exception_ptr(std::move(e));
     inner_->state = 2;
-    inner_->result.template emplace<1>(std::move(e));
-    TrySchedule();
+    Resolved();
+  }
+
+  void SetError(std::error_code code) {
+    Unpark();
+    inner_->category = &code.category();
+    inner_->error_value = code.value();
+    inner_->state = 3;
+    Resolved();
   }
 
   // TODO(monte): We should simplify this while it's resolved to reduce
   // the cost of continuation. Furthermore, we should support empty resolved
   // future for such as MakeReadyFuture...
   template <typename Callback>
-  auto SetCallback(Callback&& cb) {
-    assert(!inner_->consumer);
-
+  auto SetCallback(Callback&& cb MFUTURE_CALLSITE_PARAM) {
     using R = typename internal::ClosureTraits<Callback>::ReturnType;
     using ArgTuple = typename internal::ClosureTraits<Callback>::ArgTypes;
     // TODO(monte): To be more friendly, continuation type limit: lambda,
@@ -225,77 +452,410 @@ class FutureState {
                   "Continuation's parameters are NOT allowed to be non-const "
                   "lvalue reference.");
 
-    typename Futurized<R>::PromiseType pr;
-    auto ft = pr.GetFuture();
-
     using RawArgs = internal::RemoveCVRef_t<ArgTuple>;
     using Expected1 = std::tuple<T...>;
     using Expected2 = std::tuple<Future<T...>>;
+    using PromiseType = typename Futurized<R>::PromiseType;
 
     if constexpr (std::is_same_v<RawArgs, Expected1>) {
-      inner_->consumer =
-          std::make_unique<ContinuationWithValue<Callback, T...>>(
-              std::forward<Callback>(cb), std::move(pr));
+      return Attach<PromiseType>(
+          [&](PromiseType&& pr) {
+            return new ContinuationWithValue<Callback, T...>(
+                std::forward<Callback>(cb), std::move(pr));
+          } MFUTURE_CALLSITE_ARG);
     } else {
       static_assert(std::is_same_v<RawArgs, Expected2>,
                     "Continuation's parameters' types are invalid.");
-      inner_->consumer =
-          std::make_unique<ContinuationWithFuture<Callback, T...>>(
-              std::forward<Callback>(cb), std::move(pr));
+      return Attach<PromiseType>(
+          [&](PromiseType&& pr) {
+            return new ContinuationWithFuture<Callback, T...>(
+                std::forward<Callback>(cb), std::move(pr));
+          } MFUTURE_CALLSITE_ARG);
     }
+  }
+
+  // Attaches the consumer made by `make` of the promise of the future
+  // returned.
+  template <typename PromiseType, typename Make>
+  auto Attach(Make&& make MFUTURE_CALLSITE_PARAM) {
+    assert(!inner_->consumer);
+
+#if MFUTURE_TRACE
+    // The downstream future belongs to the same chain.
+    internal::TraceScope trace(flow_);
+#endif
+    PromiseType pr;
+    auto ft = pr.GetFuture();
+    inner_->consumer.reset(make(std::move(pr)));
+#if MFUTURE_TRACE
+    internal::Trace(internal::TraceEvent::kAttach, flow_);
+#endif
+#if MFUTURE_CALLSITE_STATS
+    inner_->consumer->callsite_ = internal::InternCallsite(callsite);
+#endif
+#if MFUTURE_CENSUS
+    CensusAttach();
+#endif
 
     TrySchedule();
     return ft;
   }
 
+  // Whether Reset() leaves the result a consumer is running with intact, which
+  // it does for the result in place only.
+  bool Resettable() const {
+    return inner_ == &this_inner_ || !inner_->consumer_running;
+  }
+
+  // Back to unresolved for another round, which nothing else should refer to.
+  // If the consumer of the previous round is still running with its result,
+  // the result is parked in place, and released as the consumer returns.
+  void Reset() {
+    inner_ = &this_inner_;
+    holder_.reset();
+    auto& inner = this_inner_;
+    inner.consumer.reset();
+    if (!inner.consumer_running) {
+      inner.Destroy(inner.state);
+    } else if (inner.state) {
+      assert(!inner.parked);  // Resolved elsewhere while parked.
+      inner.parked = inner.state;
+    }
+    inner.state = 0;
+    inner.result_moved = false;
+#if MFUTURE_CENSUS
+    census_.Unlink();
+#endif
+  }
+
+  // Takes over a continuation made elsewhere, e.g. by a coroutine awaiter.
+  void SetContinuation(Continuation<T...>* continuation) {
+    assert(!inner_->consumer);
+    inner_->consumer.reset(continuation);
+#if MFUTURE_TRACE
+    internal::Trace(internal::TraceEvent::kAttach, flow_);
+#endif
+#if MFUTURE_CENSUS
+    CensusAttach();
+#endif
+    TrySchedule();
+  }
+
   int GetState() const noexcept {
     assert(inner_->state >= 0);
-    assert(inner_->state <= 2);
+    assert(inner_->state <= 3);
     return inner_->state;
   }
 
-  auto&& GetResult() noexcept {
+  std::tuple<T...>&& GetValue() noexcept {
+    assert(inner_->state == 1);
+    assert(!inner_->result_moved);
+    inner_->result_moved = true;
+    return std::move(inner_->value);
+  }
+
+  std::tuple<T...>& GetValueRef() noexcept {
+    assert(inner_->state == 1);
+    assert(!inner_->result_moved);
+    return inner_->value;
+  }
+
+  std::exception_ptr GetException() {
+    assert(inner_->state >= 2);
+    if (inner_->state == 3) {
+      // The slow path, only for those who insist on an exception.
+      return std::make_exception_ptr(std::system_error(GetErrorCode()));
+    }
     assert(!inner_->result_moved);
     inner_->result_moved = true;
-    return std::move(inner_->result);
+    return std::move(inner_->exception);
+  }
+
+  // Peeks at the exception without taking it.
+  const std::exception_ptr& PeekException() const noexcept {
+    assert(inner_->state == 2);
+    assert(!inner_->result_moved);
+    return inner_->exception;
+  }
+
+  std::error_code PeekErrorCode() const noexcept {
+    assert(inner_->state == 3);
+    assert(!inner_->result_moved);
+    return std::error_code(inner_->error_value, *inner_->category);
+  }
+
+  std::error_code GetErrorCode() noexcept {
+    assert(inner_->state == 3);
+    assert(!inner_->result_moved);
+    inner_->result_moved = true;
+    return std::error_code(inner_->error_value, *inner_->category);
   }
 
  private:
+  void Resolved() {
+#if MFUTURE_TRACE
+    internal::Trace(internal::TraceEvent::kResolve, flow_);
+#endif
+#if MFUTURE_CENSUS
+    census_.Unlink();
+#endif
+    TrySchedule();
+  }
+
+#if MFUTURE_CENSUS
+  void CensusAttach() {
+    std::uint32_t callsite = 0;
+#if MFUTURE_CALLSITE_STATS
+    callsite = inner_->consumer->callsite_;
+#endif
+    inner_->consumer->census_.Link(internal::CensusKind::kContinuation,
+                                   internal::CensusType<T...>(), callsite);
+    census_.SetCallsite(callsite);
+  }
+#endif
+
   void TrySchedule() {
     if (!inner_->consumer || !inner_->state) return;
+#if MFUTURE_LATENCY_STATS
+    resolved_ = internal::NowNanoseconds();
+#endif
+
+    if (internal::Trampoline::CanRunInline())
+      internal::Trampoline::RunInline([this]() { Schedule(); });
+    else
+      Defer();
+  }
 
+  void Schedule() {
     assert(!inner_->result_moved);
     inner_->result_moved = true;
 
-    if (inner_->state == 1) {
-      inner_->consumer->Ready(std::get<0>(std::move(inner_->result)));
-    } else {  // 2
-      inner_->consumer->Fail(std::get<1>(std::move(inner_->result)));
+    // The consumer is taken out, so that it stays intact even if this state is
+    // released or re-armed by the consumer itself. The result is passed in
+    // place, which a promise re-armed meanwhile leaves intact, see Reset().
+    auto consumer = std::move(inner_->consumer);
+    auto& inner = *inner_;
+    Running running(inner);
+#if MFUTURE_LATENCY_STATS
+    internal::ContinuationTimer timer(resolved_);
+#endif
+#if MFUTURE_TRACE
+    internal::TraceRun trace(flow_);
+#endif
+#if MFUTURE_CALLSITE_STATS
+    internal::CallsiteTimer callsite(consumer->callsite_);
+#endif
+#if MFUTURE_CENSUS
+    internal::CensusRun census(consumer->census_);
+#endif
+    if (inner.state == 1) {
+      consumer->Ready(std::move(inner.value));
+    } else if (inner.state == 2) {
+      consumer->Fail(std::move(inner.exception));
+    } else {  // 3
+      consumer->Error(std::error_code(inner.error_value, *inner.category));
     }
     // After scheduling, this future state might has been released, so we can't
-    // access it anymore.
+    // access it anymore, but through `running`, which knows.
+  }
+
+  // Releases a state its promise is re-armed away from, which is kept till the
+  // outermost consumer running with a result of it returns, if any.
+  static void Retire(std::shared_ptr<FutureState>&& state) {
+    if (!state->this_inner_.consumer_running &&
+        !state->inner_->consumer_running)
+      return;
+    Running* outermost = nullptr;
+    for (auto running = Running::Top(); running; running = running->next) {
+      if (running->inner == &state->this_inner_ ||
+          running->inner == state->inner_)
+        outermost = running;
+    }
+    if (!outermost) return;
+    auto& retired = outermost->retired;
+    if (retired) {
+      // Rarely more than one, e.g. a future folded into the state as well.
+      retired = internal::MakeShared<
+          std::pair<std::shared_ptr<void>, std::shared_ptr<void>>,
+          internal::AllocSite::kFutureState>(std::move(retired),
+                                             std::move(state));
+    } else {
+      retired = std::move(state);
+    }
+  }
+
+  // Resolving a round while the consumer of the previous one is still running
+  // with its result parked in place, this round takes a state of its own.
+  void Unpark() {
+    assert(inner_->state == 0);
+    if (!inner_->parked) return;
+    holder_ =
+        internal::MakeShared<FutureState, internal::AllocSite::kFutureState>();
+#if MFUTURE_TRACE
+    holder_->flow_ = flow_;
+#endif
+    holder_->inner_->consumer = std::move(inner_->consumer);
+    inner_ = holder_->inner_;
+  }
+
+  // Too deep to schedule inline, the result is moved along with the consumer to
+  // a detached state, which schedules as the trampoline drains. As this state
+  // might be released before that, it can't be deferred itself.
+  void Defer() {
+    auto deferred = new FutureState<T...>();
+    auto& inner = *deferred->inner_;
+    if (inner_->state == 1) {
+      new (&inner.value) std::tuple<T...>(std::move(inner_->value));
+    } else if (inner_->state == 2) {
+      new (&inner.exception) std::exception_ptr(std::move(inner_->exception));
+    } else {  // 3
+      inner.category = inner_->category;
+      inner.error_value = inner_->error_value;
+    }
+    inner.state = inner_->state;
+    inner.consumer = std::move(inner_->consumer);
+    inner_->result_moved = true;
+#if MFUTURE_LATENCY_STATS
+    deferred->resolved_ = resolved_;
+#endif
+#if MFUTURE_TRACE
+    deferred->flow_ = flow_;
+#endif
+    internal::Trampoline::Defer(&FutureState::RunDeferred, deferred);
+  }
+
+  static void RunDeferred(void* state) {
+    std::unique_ptr<FutureState> deferred(static_cast<FutureState*>(state));
+    deferred->Schedule();
   }
 
   friend class Future<T...>;
 
+  friend class Promise<T...>;
+
  private:
+  struct Running;
+
   struct Inner {
+    Inner() {}
+
+    ~Inner();
+
+    // The result of `state`, or of `parked`.
+    void Destroy(std::uint8_t result) {
+      if (result == 1)
+        value.~tuple();
+      else if (result == 2)
+        exception.~exception_ptr();
+    }
+
     // Producer
-    int state{0};  // 0: unresolved, 1: ready, 2: failed
-    std::variant<std::tuple<T...>, std::exception_ptr> result;
+    // The result is constructed in place only when it's set, so neither a
+    // pending future pays for a default construction nor `T` is required to be
+    // default-constructible.
+    union {
+      std::tuple<T...> value;
+      std::exception_ptr exception;
+      // An error code is carried inline, without any allocation or throwing.
+      // It's split, so that the value fits in the padding as well.
+      const std::error_category* category;
+    };
+    // 0: unresolved, 1: ready, 2: failed by exception, 3: failed by error code
+    std::uint8_t state{0};
     bool result_moved{false};
+    // The result of the previous round, as `state`, which the consumer is still
+    // running with, though re-armed.
+    std::uint8_t parked{0};
+    // Set while the consumer runs with the result in place.
+    bool consumer_running{false};
+    int error_value;
 
     // Continuation's type info is unknown until callback set(i.e. runtime), but
     // it's necessary while compiling resolving code(i.e. SetValue,
-    // SetException), therefore we can only rely on runtime polymorphism.
-    std::unique_ptr<Continuation<T...>> consumer;
+    // SetException), therefore we can only rely on runtime dispatching.
+    typename Continuation<T...>::Pointer consumer;
   } this_inner_;
 
+  // Marks the consumer running with the result of `inner`, for the lifetime of
+  // the object, on the stack of Schedule(). The result parked meanwhile is
+  // released as it goes, unless the state is released first. Those of a thread
+  // are linked, the innermost first, only for an Inner released under its
+  // consumer to find its own.
+  struct Running {
+    explicit Running(Inner& inner) : inner(&inner), next(Top()) {
+      inner.consumer_running = true;
+      Top() = this;
+    }
+
+    ~Running() {
+      Top() = next;
+      if (!inner) return;
+      inner->consumer_running = false;
+      inner->Destroy(std::exchange(inner->parked, 0));
+    }
+
+    Running(const Running&) = delete;
+    Running& operator=(const Running&) = delete;
+
+    static Running*& Top() {
+      static thread_local Running* top = nullptr;
+      return top;
+    }
+
+    Inner* inner;  // Null once released.
+    Running* next;
+    // The states re-armed away from, kept till the consumer returns.
+    std::shared_ptr<void> retired;
+  };
+
   // Effective entity
   struct Inner* inner_ = &this_inner_;
   std::shared_ptr<FutureState<T...>> holder_;
+#if MFUTURE_LATENCY_STATS
+  std::uint64_t resolved_ = 0;  // When the consumer is scheduled.
+#endif
+#if MFUTURE_TRACE
+  std::uint64_t flow_ = 0;  // The chain the future belongs to.
+
+  template <typename... U>
+  friend std::shared_ptr<FutureState<U...>> MakeState();
+#endif
+#if MFUTURE_CENSUS
+  // Linked once the future is handed out by the promise.
+  internal::CensusNode census_;
+#endif
 };
 
+template <typename... T>
+FutureState<T...>::Inner::~Inner() {
+  if (consumer_running) {
+    for (auto running = Running::Top(); running; running = running->next) {
+      if (running->inner == this) running->inner = nullptr;
+    }
+  }
+  Destroy(state);
+  Destroy(parked);
+}
+
+// Shared states are allocated along with their control blocks.
+template <typename... T>
+std::shared_ptr<FutureState<T...>> MakeState() {
+  auto state = internal::MakeShared<FutureState<T...>,
+                                    internal::AllocSite::kFutureState>();
+#if MFUTURE_TRACE
+  state->flow_ = internal::TraceCreate();
+#endif
+  return state;
+}
+
+// For the dominant Future<> and Future<T> cases, the whole shared state takes
+// no more than six words, unless instrumented.
+#if !MFUTURE_LATENCY_STATS && !MFUTURE_TRACE && !MFUTURE_CENSUS
+static_assert(sizeof(FutureState<>) <= 6 * sizeof(void*));
+static_assert(sizeof(FutureState<int>) <= 6 * sizeof(void*));
+static_assert(sizeof(FutureState<void*>) <= 6 * sizeof(void*));
+#endif
+
 }  // namespace details
 
 // User should explicitly assign template argument, for the sake of avoiding
@@ -323,11 +883,18 @@ Future<T...> MakeExceptionalFuture(E&& e) {
                       std::make_exception_ptr(std::forward<E>(e)));
 }
 
+// Unlike an exception, an error code is carried inline, so a future failed
+// this way costs neither an allocation nor a throw.
+template <typename... T>
+Future<T...> MakeErrorFuture(std::error_code code) {
+  return Future<T...>(details::MakeExceptionalFutureTag{}, code);
+}
+
 // TODO(monte): Add executor support, caring about the thread-safety
 template <typename Function, typename... Args>
 auto FuturizeInvoke(Function&& f, Args&&... args) {
   using R = typename internal::ClosureTraits<Function>::ReturnType;
-  try {
+  MFUTURE_TRY {
     if constexpr (details::IsFuture_v<R>) {
       return std::invoke(std::forward<Function>(f),
                          std::forward<Args>(args)...);
@@ -339,7 +906,8 @@ auto FuturizeInvoke(Function&& f, Args&&... args) {
           std::invoke(std::forward<Function>(f), std::forward<Args>(args)...);
       return MakeReadyFuture<R>(std::move(r));
     }
-  } catch (...) {
+  }
+  MFUTURE_CATCH_ALL {
     if constexpr (details::IsFuture_v<R>)
       return details::MakeExceptionalFuture0<R>(std::current_exception());
     else if constexpr (std::is_void_v<R>)
@@ -352,7 +920,7 @@ auto FuturizeInvoke(Function&& f, Args&&... args) {
 template <typename Function, typename Tuple>
 auto FuturizeApply(Function&& f, Tuple&& t) {
   using R = typename internal::ClosureTraits<Function>::ReturnType;
-  try {
+  MFUTURE_TRY {
     if constexpr (details::IsFuture_v<R>) {
       return std::apply(std::forward<Function>(f), std::forward<Tuple>(t));
     } else if constexpr (std::is_void_v<R>) {
@@ -362,7 +930,8 @@ auto FuturizeApply(Function&& f, Tuple&& t) {
       auto r = std::apply(std::forward<Function>(f), std::forward<Tuple>(t));
       return MakeReadyFuture<R>(std::move(r));
     }
-  } catch (...) {
+  }
+  MFUTURE_CATCH_ALL {
     if constexpr (details::IsFuture_v<R>)
       return details::MakeExceptionalFuture0<R>(std::current_exception());
     else if constexpr (std::is_void_v<R>)
@@ -392,57 +961,189 @@ class Future {
   Future& operator=(Future&& other) = default;
 
   template <typename Callback>
-  auto Then(Callback&& cb) noexcept {
+  auto Then(Callback&& cb MFUTURE_CALLSITE_PARAM) noexcept {
     if (IsResolved())
       return Schedule(std::forward<Callback>(cb));
     else
-      return state_->SetCallback(std::forward<Callback>(cb));
+      return state_->SetCallback(
+          std::forward<Callback>(cb) MFUTURE_CALLSITE_ARG);
   }
 
   bool IsReady() const noexcept { return state_->GetState() == 1; }
 
-  bool IsFailed() const noexcept { return state_->GetState() == 2; }
+  bool IsFailed() const noexcept { return state_->GetState() >= 2; }
+
+  bool HasErrorCode() const noexcept { return state_->GetState() == 3; }
 
   bool IsResolved() const noexcept { return state_->GetState() != 0; }
 
   auto GetValue() {  // FIXME(monte): return type?
     assert(IsReady());
-    return std::get<0>(state_->GetResult());
+    return state_->GetValue();
   }
 
   template <std::size_t I, typename = std::enable_if_t<(sizeof...(T) > I)>>
   auto GetValue() {  // FIXME(monte): return type?
     assert(IsReady());
-    auto&& t = std::get<0>(state_->GetResult());
+    auto&& t = state_->GetValue();
     return std::get<I>(std::move(t));
   }
 
+  // Accesses the value in place, without consuming it.
+  std::tuple<T...>& GetValueRef() {
+    assert(IsReady());
+    return state_->GetValueRef();
+  }
+
+  template <std::size_t I, typename = std::enable_if_t<(sizeof...(T) > I)>>
+  auto& GetValueRef() {
+    return std::get<I>(GetValueRef());
+  }
+
+  // Consumes the value by passing its elements to `f` as rvalues.
+  template <typename Function>
+  decltype(auto) ConsumeValue(Function&& f) {
+    assert(IsReady());
+    return std::apply(std::forward<Function>(f), state_->GetValue());
+  }
+
+  // Note that a future failed by an error code makes a std::system_error here,
+  // use `GetErrorCode()` instead to avoid the cost.
   auto GetException() {  // FIXME(monte): return type? how to unwrap
                          // std::exception_ptr
     assert(IsFailed());
-    return std::get<1>(state_->GetResult());
+    return state_->GetException();
+  }
+
+  std::error_code GetErrorCode() {
+    assert(HasErrorCode());
+    return state_->GetErrorCode();
+  }
+
+  // Handles a failure without rethrowing it: `handler` is invoked with the
+  // std::error_code of a future failed by an error code, or the
+  // std::exception_ptr of one failed by an exception, if it's invocable with
+  // that; otherwise the failure is passed on untouched, so is a value. To
+  // recover, `handler` returns a Future<T...>, or the value of a Future<T>, or
+  // nothing for a Future<>.
+  template <typename Handler>
+  Future<T...> ThenOnError(Handler&& handler) {
+    static_assert(std::is_invocable_v<Handler, std::error_code> ||
+                      std::is_invocable_v<Handler, std::exception_ptr>,
+                  "Handler should accept std::error_code or "
+                  "std::exception_ptr.");
+
+    if (IsReady()) {
+      return std::move(*this);
+    } else if (IsFailed()) {
+      return HandleFailure<Future<T...>>(std::forward<Handler>(handler));
+    } else {
+      return state_->SetCallback([handler = std::forward<Handler>(handler)](
+                                     Future<T...>&& ft) mutable {
+        return ft.ThenOnError(std::move(handler));
+      });
+    }
   }
 
+  // Recovers from an exception of type E, or derived from E: `handler` is
+  // invoked with `const E&`, and recovers as a ThenOnError() handler does.
+  // The type is matched without rethrowing. Other failures, as well as a
+  // value, are passed on untouched.
+  template <typename E, typename Handler>
+  Future<T...> HandleException(Handler&& handler) {
+    if (IsReady() || HasErrorCode()) {
+      return std::move(*this);
+    } else if (IsFailed()) {
+      if (auto e = internal::ExceptionCast<E>(state_->PeekException()))
+        return Recover(std::forward<Handler>(handler), *e);
+      return std::move(*this);
+    } else {
+      using Consumer = details::ContinuationWithException<
+          E, std::decay_t<Handler>, T...>;
+      return state_->template Attach<Promise<T...>>(
+          [&](Promise<T...>&& pr) {
+            return new Consumer(std::forward<Handler>(handler), std::move(pr));
+          });
+    }
+  }
+
+  // Same as HandleException(), with E deduced from `handler`'s parameter.
+  template <typename Handler>
+  Future<T...> HandleExceptionType(Handler&& handler) {
+    using E = internal::RemoveCVRef_t<
+        typename internal::ClosureTraits<Handler>::ArgType>;
+    return HandleException<E>(std::forward<Handler>(handler));
+  }
+
+  // Invokes `f` once this future is resolved, whatever the result is, then
+  // passes the result on untouched, unless `f` throws.
+  template <typename Function>
+  Future<T...> Finally(Function&& f) {
+    return Then([f = std::forward<Function>(f)](Future<T...>&& ft) mutable {
+      f();
+      return std::move(ft);
+    });
+  }
+
+  // Handles both results at once: `on_value` is invoked as a Then() callback
+  // is, and `on_error` as a ThenOnError() handler is, and both should result
+  // in the same type of future. Either costs the same as a Then() callback
+  // taking a value.
+  template <typename OnValue, typename OnError>
+  auto ThenValueOrError(OnValue&& on_value, OnError&& on_error) {
+    using R = typename internal::ClosureTraits<OnValue>::ReturnType;
+    using F = details::Futurized<R>;
+
+    if (IsReady()) {
+      return Then(std::forward<OnValue>(on_value));
+    } else if (IsFailed()) {
+      return HandleFailure<F>(std::forward<OnError>(on_error));
+    } else {
+      using Consumer = details::ContinuationWithValueOrError<
+          std::decay_t<OnValue>, std::decay_t<OnError>, T...>;
+      return state_->template Attach<typename F::PromiseType>(
+          [&](typename F::PromiseType&& pr) {
+            return new Consumer(std::forward<OnValue>(on_value),
+                                std::forward<OnError>(on_error),
+                                std::move(pr));
+          });
+    }
+  }
+
+  // Converts to a future shared by several consumers, which stores the result
+  // once for all of them.
+  SharedFuture<T...> Share() { return SharedFuture<T...>(std::move(*this)); }
+
   void Fold(Promise<T...>& promise) {
     if (IsReady()) {
       promise.SetValue(GetValue());
+    } else if (HasErrorCode()) {
+      promise.SetError(GetErrorCode());
     } else if (IsFailed()) {
       promise.SetException(GetException());
     } else {
       // In order to support multilevel folding, we chain this entity by
-      // promise's effective entity.
+      // promise's effective entity, which isn't the previous round parked.
+      promise.state_->Unpark();
       state_->inner_ = promise.state_->inner_;
       state_->holder_ =
           promise.state_->holder_ ? promise.state_->holder_ : promise.state_;
+#if MFUTURE_TRACE
+      // Resolving this entity resolves the downstream chain.
+      state_->flow_ = promise.state_->flow_;
+#endif
+#if MFUTURE_CENSUS
+      // Which is pending as this one is.
+      promise.state_->census_.Unlink();
+#endif
       // Now this future entity shoulders all the keeper's duty. That's
       // reasonable, because once this future entity is destroyed, it's
       // meaningless to keep the downstream entity.
     }
   }
 
-  // Only used in `Promise<Future<X...>, Y...>`/`Future<Future<X...>, Y...>`,
-  // because `FutureState<Future<X...>, Y...>` needs to be
-  // default-constructible.
+  // Creates a future without any state, which is only good for being assigned
+  // to.
   Future() {}
 
  private:
@@ -454,15 +1155,57 @@ class Future {
 
   template <typename... U>
   Future(details::MakeReadyFutureTag, U&&... val) {
-    state_ = std::make_shared<details::FutureState<T...>>();
+    state_ = details::MakeState<T...>();
     state_->SetValue(std::forward<U>(val)...);
   }
 
   Future(details::MakeExceptionalFutureTag, std::exception_ptr&& e) {
-    state_ = std::make_shared<details::FutureState<T...>>();
+    state_ = details::MakeState<T...>();
     state_->template SetException(std::move(e));
   }
 
+  Future(details::MakeExceptionalFutureTag, std::error_code code) {
+    state_ = details::MakeState<T...>();
+    state_->SetError(code);
+  }
+
+  template <typename F = Future<T...>, typename Handler, typename Error>
+  static F Recover(Handler&& handler, Error&& error) {
+    auto ft =
+        FuturizeInvoke(std::forward<Handler>(handler), std::forward<Error>(error));
+    static_assert(std::is_same_v<decltype(ft), F>,
+                  "Handler should recover with the same type.");
+    return ft;
+  }
+
+  // Invokes `handler` with the failure if it's invocable with that, or passes
+  // the failure on to a future of type F.
+  template <typename F, typename Handler>
+  F HandleFailure(Handler&& handler) {
+    static_assert(std::is_invocable_v<Handler, std::error_code> ||
+                      std::is_invocable_v<Handler, std::exception_ptr>,
+                  "Handler should accept std::error_code or "
+                  "std::exception_ptr.");
+    assert(IsFailed());
+    if (HasErrorCode()) {
+      if constexpr (std::is_invocable_v<Handler, std::error_code>)
+        return Recover<F>(std::forward<Handler>(handler), GetErrorCode());
+    } else {
+      if constexpr (std::is_invocable_v<Handler, std::exception_ptr>)
+        return Recover<F>(std::forward<Handler>(handler), GetException());
+    }
+    return ForwardFailure<F>();
+  }
+
+  // Passes the failure of this future on to a future of type F.
+  template <typename F>
+  F ForwardFailure() {
+    if (HasErrorCode())
+      return details::MakeErrorFuture0<F>(GetErrorCode());
+    else
+      return details::MakeExceptionalFuture0<F>(GetException());
+  }
+
   template <typename Callback>
   auto Schedule(Callback&& cb) {
     using R = typename internal::ClosureTraits<Callback>::ReturnType;
@@ -483,12 +1226,7 @@ class Future {
       if (IsReady()) {
         return FuturizeApply(std::forward<Callback>(cb), GetValue());
       } else {  // IsFailed
-        if constexpr (details::IsFuture_v<R>)
-          return details::MakeExceptionalFuture0<R>(GetException());
-        else if constexpr (std::is_void_v<R>)
-          return MakeExceptionalFuture<>(GetException());
-        else
-          return MakeExceptionalFuture<R>(GetException());
+        return ForwardFailure<details::Futurized<R>>();
       }
     } else {
       static_assert(std::is_same_v<RawArgs, Expected2>,
@@ -506,10 +1244,25 @@ class Future {
   template <typename... U, typename E>
   friend Future<U...> MakeExceptionalFuture(E&&);
 
+  template <typename... U>
+  friend Future<U...> MakeErrorFuture(std::error_code);
+
   friend Future<T...> details::MakeExceptionalFuture0<>(std::exception_ptr&&);
 
+  friend Future<T...> details::MakeErrorFuture0<>(std::error_code);
+
+  template <typename... U>
+  friend class Future;
+
+  friend class ReadyFuture<T...>;
+
+  friend class SharedFuture<T...>;
+
   friend class Promise<T...>;
 
+  friend void details::SetContinuation<>(Future<T...>&,
+                                         details::Continuation<T...>*);
+
  private:
   std::shared_ptr<details::FutureState<T...>> state_;
 };
@@ -524,7 +1277,7 @@ class Promise {
       "Promise's template arguments are NOT allowed to be reference.");
 
  public:
-  Promise() : state_(std::make_shared<details::FutureState<T...>>()) {}
+  Promise() : state_(details::MakeState<T...>()) {}
 
   Promise(Promise&& other) = default;
   Promise& operator=(Promise&& other) = default;
@@ -532,6 +1285,10 @@ class Promise {
   Future<T...> GetFuture() {
     assert(!future_got_);
     future_got_ = true;
+#if MFUTURE_CENSUS
+    state_->census_.Link(internal::CensusKind::kPromise,
+                         internal::CensusType<T...>());
+#endif
     return Future<T...>(state_);
   }
 
@@ -555,6 +1312,13 @@ class Promise {
   // General version, `const &` may be bound to any value.
   void SetValue(const std::tuple<T...>& val) { state_->SetValue(val); }
 
+  // Constructs the value in place from `args`, which are forwarded to the
+  // constructor of `T` for a Promise<T>, or elementwise otherwise.
+  template <typename... Args>
+  void Emplace(Args&&... args) {
+    state_->Emplace(std::forward<Args>(args)...);
+  }
+
   void SetException(std::exception_ptr&& e) {
     state_->SetException(std::move(e));
   }
@@ -564,33 +1328,357 @@ class Promise {
     state_->SetException(std::make_exception_ptr(std::forward<E>(e)));
   }
 
+  // Fails the future cheaply: the error code is stored inline, neither
+  // allocating nor throwing.
+  void SetError(std::error_code code) { state_->SetError(code); }
+
+  // Re-arms this promise for another round, once the previous one is resolved,
+  // and returns its future. The shared state is reused in place if nothing
+  // else refers to it any longer, as is the case once the previous future and
+  // its continuation are done, even from within that continuation. Otherwise
+  // a new one is made.
+  Future<T...> Rearm() {
+    Recycle();
+    return GetFuture();
+  }
+
  private:
   Promise(const Promise&) = delete;
   Promise& operator=(const Promise&) = delete;
 
+  void Recycle() {
+    // The state is reset in place, unless anything else refers to it.
+    if (state_.use_count() == 1 && state_->Resettable())
+      state_->Reset();
+    else
+      details::FutureState<T...>::Retire(
+          std::exchange(state_, details::MakeState<T...>()));
+    future_got_ = false;
+  }
+
   friend class Future<T...>;
 
+  friend class PromisePool<T...>;
+
  private:
   std::shared_ptr<details::FutureState<T...>> state_;
   bool future_got_{false};
 };
 
+// A pool of promises for request slots, e.g. of a connection, so that a steady
+// loop of requests neither constructs a promise nor allocates a shared state.
+// A promise is acquired for a request, and released once the request is done
+// with, to be re-armed for the next one.
+template <typename... T>
+class PromisePool {
+ public:
+  explicit PromisePool(std::size_t size)
+      : promises_(size) {
+    free_.reserve(size);
+    for (std::size_t i = size; i > 0; --i) free_.push_back(&promises_[i - 1]);
+  }
+
+  PromisePool(const PromisePool&) = delete;
+  PromisePool& operator=(const PromisePool&) = delete;
+
+  // Hands out a promise ready for `GetFuture()`, or nullptr if all are in use.
+  Promise<T...>* Acquire() {
+    if (free_.empty()) return nullptr;
+    auto promise = free_.back();
+    free_.pop_back();
+    return promise;
+  }
+
+  // Takes back a promise handed out by `Acquire()`. A round left unresolved
+  // is abandoned.
+  void Release(Promise<T...>* promise) {
+    assert(promise >= promises_.data() &&
+           promise < promises_.data() + promises_.size());
+    promise->Recycle();
+    free_.push_back(promise);
+  }
+
+  std::size_t Size() const { return promises_.size(); }
+
+  std::size_t Available() const { return free_.size(); }
+
+ private:
+  template <typename U>
+  using Vector = internal::SiteVector<U, internal::AllocSite::kPromisePool>;
+
+  Vector<Promise<T...>> promises_;
+  Vector<Promise<T...>*> free_;
+};
+
+namespace details {
+
+// The shared state of a SharedFuture, which is the continuation of the source
+// future as well. It holds itself on behalf of the source until the source is
+// done with it, so it's released once neither refers to it.
+template <typename... T>
+class SharedState : public Continuation<T...> {
+  using Op = typename Continuation<T...>::Op;
+
+ public:
+  // The first few waiters are kept inline.
+  static constexpr std::size_t kInlineWaiters = 3;
+
+  SharedState() : Continuation<T...>(&SharedState::Dispatch) {}
+
+  // Takes the result of a resolved future.
+  void Take(Future<T...>& future) {
+    if (future.IsReady())
+      result_.SetValue(future.GetValue());
+    else if (future.HasErrorCode())
+      result_.SetError(future.GetErrorCode());
+    else
+      result_.SetException(future.GetException());
+  }
+
+  Future<T...> GetFuture() {
+    static_assert(std::is_copy_constructible_v<std::tuple<T...>>,
+                  "A shared value is copied to each future.");
+    switch (result_.GetState()) {
+      case 1:
+        return MakeReadyFuture<T...>(
+            static_cast<const std::tuple<T...>&>(result_.GetValueRef()));
+      case 2:
+        return MakeExceptionalFuture<T...>(
+            std::exception_ptr(result_.PeekException()));
+      case 3:
+        return MakeErrorFuture<T...>(result_.PeekErrorCode());
+      default:
+        return waiters_.emplace_back().GetFuture();
+    }
+  }
+
+ private:
+  static void Dispatch(Continuation<T...>* base, Op op, void* arg) {
+    auto shared = static_cast<SharedState*>(base);
+    switch (op) {
+      case Op::kReady:
+        shared->result_.SetValue(
+            std::move(*static_cast<std::tuple<T...>*>(arg)));
+        break;
+      case Op::kFail:
+        shared->result_.SetException(
+            std::move(*static_cast<std::exception_ptr*>(arg)));
+        break;
+      case Op::kError:
+        shared->result_.SetError(*static_cast<std::error_code*>(arg));
+        break;
+      case Op::kDestroy:
+        // Done with by the source, or abandoned along with the waiters.
+        shared->self_.reset();
+        return;
+    }
+    shared->Notify();
+  }
+
+  void Notify() {
+    // Taken out first, so that a waiter may add another one.
+    auto waiters = std::move(waiters_);
+    for (auto& promise : waiters) {
+      switch (result_.GetState()) {
+        case 1:
+          promise.SetValue(
+              static_cast<const std::tuple<T...>&>(result_.GetValueRef()));
+          break;
+        case 2:
+          promise.SetException(std::exception_ptr(result_.PeekException()));
+          break;
+        default:  // 3
+          promise.SetError(result_.PeekErrorCode());
+          break;
+      }
+    }
+  }
+
+  FutureState<T...> result_;
+  internal::SmallVector<Promise<T...>, kInlineWaiters,
+                        internal::AllocSite::kWaiters>
+      waiters_;
+  std::shared_ptr<SharedState> self_;
+
+  friend class SharedFuture<T...>;
+};
+
+}  // namespace details
+
+// A future shared by several consumers, made by `Future::Share()`. The result
+// is stored once; it's accessed in place by `GetValueRef()` once ready, and
+// each consumer gets a future of its own copy by `GetFuture()`. Copying a
+// SharedFuture only copies the handle. Like Future, it's not thread-safe.
+template <typename... T>
+class SharedFuture {
+ public:
+  SharedFuture(const SharedFuture&) = default;
+  SharedFuture(SharedFuture&&) = default;
+  SharedFuture& operator=(const SharedFuture&) = default;
+  SharedFuture& operator=(SharedFuture&&) = default;
+
+  bool IsReady() const noexcept { return shared_->result_.GetState() == 1; }
+
+  bool IsFailed() const noexcept { return shared_->result_.GetState() >= 2; }
+
+  bool HasErrorCode() const noexcept {
+    return shared_->result_.GetState() == 3;
+  }
+
+  bool IsResolved() const noexcept { return shared_->result_.GetState() != 0; }
+
+  const std::tuple<T...>& GetValueRef() const {
+    assert(IsReady());
+    return shared_->result_.GetValueRef();
+  }
+
+  template <std::size_t I, typename = std::enable_if_t<(sizeof...(T) > I)>>
+  const auto& GetValueRef() const {
+    return std::get<I>(GetValueRef());
+  }
+
+  // A future of a copy of the result, resolved along with this one.
+  Future<T...> GetFuture() { return shared_->GetFuture(); }
+
+ private:
+  friend class Future<T...>;
+
+  explicit SharedFuture(Future<T...>&& future)
+      : shared_(internal::MakeShared<details::SharedState<T...>,
+                                     internal::AllocSite::kSharedState>()) {
+    if (future.IsResolved()) {
+      shared_->Take(future);
+    } else {
+      shared_->self_ = shared_;  // Released by the source.
+      details::SetContinuation(future, shared_.get());
+    }
+  }
+
+  std::shared_ptr<details::SharedState<T...>> shared_;
+};
+
 // static_assert(details::IsDefaultConstructible_v<Future<>>);  // FIXME(monte):
 // false?
 static_assert(internal::IsDefaultConstructible_v<Promise<>>);
 static_assert(internal::IsDefaultConstructible_v<Future<bool>>);
 static_assert(internal::IsDefaultConstructible_v<Promise<int>>);
 
+// A future statically known to be ready, such as a cache hit, which holds its
+// value in place rather than in a shared state. Then() invokes the callback
+// right away, and returns the future the callback returns, or a ReadyFuture of
+// its result, so that a chain of them compiles to plain function calls. As a
+// throwing callback makes a failed future, that's only for a noexcept callback
+// (or any, without exceptions); otherwise a Future is returned as usual. It
+// converts to a Future<T...> where that's wanted.
+template <typename... T>
+class ReadyFuture {
+  static_assert(internal::IsNotVoid_v<T...>,
+                "ReadyFuture's template arguments are NOT allowed to be void, "
+                "use ReadyFuture<> instead of ReadyFuture<void>.");
+
+  static_assert(internal::IsNotReference_v<T...>,
+                "ReadyFuture's template arguments are NOT allowed to be "
+                "reference.");
+
+ public:
+  using TupleValueType = std::tuple<T...>;
+  using FutureType = Future<T...>;
+
+  explicit ReadyFuture(std::tuple<T...>&& val) : value_(std::move(val)) {}
+
+  ReadyFuture(ReadyFuture&&) = default;
+  ReadyFuture& operator=(ReadyFuture&&) = default;
+
+  template <typename Callback,
+            typename R = internal::ApplyResultType<Callback, std::tuple<T...>>>
+  auto Then(Callback&& cb) {
+#if __cpp_exceptions
+    constexpr bool kNoThrow = noexcept(
+        std::apply(std::declval<Callback>(), std::declval<std::tuple<T...>>()));
+#else
+    constexpr bool kNoThrow = true;
+#endif
+    if constexpr (details::IsFuture_v<R>) {
+      return FuturizeApply(std::forward<Callback>(cb), std::move(value_));
+    } else if constexpr (details::IsReadyFuture_v<R> && kNoThrow) {
+      return std::apply(std::forward<Callback>(cb), std::move(value_));
+    } else if constexpr (details::IsReadyFuture_v<R>) {
+      using F = typename R::FutureType;
+      MFUTURE_TRY {
+        return F(std::apply(std::forward<Callback>(cb), std::move(value_)));
+      }
+      MFUTURE_CATCH_ALL {
+        return details::MakeExceptionalFuture0<F>(std::current_exception());
+      }
+    } else if constexpr (!kNoThrow) {
+      return FuturizeApply(std::forward<Callback>(cb), std::move(value_));
+    } else if constexpr (std::is_void_v<R>) {
+      std::apply(std::forward<Callback>(cb), std::move(value_));
+      return ReadyFuture<>(std::tuple<>());
+    } else {
+      return ReadyFuture<R>(std::tuple<R>(
+          std::apply(std::forward<Callback>(cb), std::move(value_))));
+    }
+  }
+
+  constexpr bool IsReady() const noexcept { return true; }
+
+  constexpr bool IsFailed() const noexcept { return false; }
+
+  constexpr bool IsResolved() const noexcept { return true; }
+
+  std::tuple<T...>&& GetValue() { return std::move(value_); }
+
+  template <std::size_t I, typename = std::enable_if_t<(sizeof...(T) > I)>>
+  auto GetValue() {
+    return std::get<I>(std::move(value_));
+  }
+
+  std::tuple<T...>& GetValueRef() { return value_; }
+
+  template <std::size_t I, typename = std::enable_if_t<(sizeof...(T) > I)>>
+  auto& GetValueRef() {
+    return std::get<I>(value_);
+  }
+
+  template <typename Function>
+  decltype(auto) ConsumeValue(Function&& f) {
+    return std::apply(std::forward<Function>(f), std::move(value_));
+  }
+
+  operator Future<T...>() && {
+    return Future<T...>(details::MakeReadyFutureTag{}, std::move(value_));
+  }
+
+ private:
+  std::tuple<T...> value_;
+};
+
+template <typename... T, typename... U>
+ReadyFuture<T...> MakeReady(U&&... val) {
+  return ReadyFuture<T...>(std::tuple<T...>(std::forward<U>(val)...));
+}
+
 namespace details {
 
+template <typename... T>
+void SetContinuation(Future<T...>& future, Continuation<T...>* continuation) {
+  future.state_->SetContinuation(continuation);
+}
+
 template <typename Stop, typename Function>
-struct DoUntilState {
+struct DoUntilState
+    : public internal::Allocated<internal::AllocSite::kDoUntilState> {
   DoUntilState(Stop&& stop, Function&& function)
       : stop_(std::forward<Stop>(stop)),
-        function_(std::forward<Function>(function)) {}
+        function_(std::forward<Function>(function)) {
+#if MFUTURE_CENSUS
+    census_.Link(internal::CensusKind::kDoUntilState, internal::CensusType<>());
+#endif
+  }
 
-  void SetFailed(std::exception_ptr&& e) {
-    promise_.SetException(std::move(e));
+  void SetFailed(Future<>&& ft) {
+    ft.Fold(promise_);
     delete this;
   }
 
@@ -607,25 +1695,35 @@ struct DoUntilState {
         if (future.IsReady()) {
           // Never use Then() to drive here to avoid stack overflow.
         } else if (future.IsFailed()) {
-          promise_.SetException(future.GetException());
+          future.Fold(promise_);
           delete this;
           break;
         } else {
+#if MFUTURE_CALLSITE_STATS
+          auto& callsite = callsite_;
+#endif
           // Return value ignored.
           future.Then([this](Future<>&& ft) {
             if (ft.IsFailed()) {
-              SetFailed(ft.GetException());
+              SetFailed(std::move(ft));
               return;
             }
             assert(ft.IsReady());
             Run();
-          });
+          } MFUTURE_CALLSITE_ARG);
           break;
         }
       }
     } while (true);
   }
 
+#if MFUTURE_CALLSITE_STATS
+  internal::Callsite callsite_;  // Of DoUntil().
+#endif
+#if MFUTURE_CENSUS
+  internal::CensusNode census_;
+#endif
+
  private:
   Promise<> promise_;
   Stop stop_;
@@ -635,7 +1733,7 @@ struct DoUntilState {
 }  // namespace details
 
 template <typename Stop, typename Function>
-Future<> DoUntil(Stop&& stop, Function&& function) {
+Future<> DoUntil(Stop&& stop, Function&& function MFUTURE_CALLSITE_PARAM) {
   static_assert(std::is_convertible_v<std::invoke_result_t<Stop>, bool>);
 
   // If Function doesn't return a Future, user should use do-while instead.
@@ -652,16 +1750,22 @@ Future<> DoUntil(Stop&& stop, Function&& function) {
     else {
       auto state = new details::DoUntilState<Stop, Function>(
           std::forward<Stop>(stop), std::forward<Function>(function));
+#if MFUTURE_CALLSITE_STATS
+      state->callsite_ = callsite;
+#if MFUTURE_CENSUS
+      state->census_.SetCallsite(internal::InternCallsite(callsite));
+#endif
+#endif
       auto ret = state->GetFuture();
       // Return value ignored.
       future.Then([state](Future<>&& ft) {
         if (ft.IsFailed()) {
-          state->SetFailed(ft.GetException());
+          state->SetFailed(std::move(ft));
           return;
         }
         assert(ft.IsReady());
         state->Run();
-      });
+      } MFUTURE_CALLSITE_ARG);
       return ret;
     }
   } while (true);
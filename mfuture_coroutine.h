@@ -0,0 +1,240 @@
+#pragma once
+
+// C++20 coroutine support: a function returning a Future<T...> may be a
+// coroutine, which co_awaits futures and co_returns its value.
+//
+//   Future<int> Add(Future<int> a, Future<int> b) {
+//     int x = co_await std::move(a);
+//     int y = co_await std::move(b);
+//     co_return x + y;
+//   }
+//
+// A ready future is awaited synchronously, without suspension. A failed one
+// isn't thrown into the coroutine, instead the coroutine is destroyed as if
+// unwound, and the failure is passed on to its future untouched, the same as
+// Then() skips its callback. Use `co_await Wrap(std::move(future))` to inspect
+// a failure.
+
+#include <coroutine>
+#include <optional>
+#include <utility>
+
+#include "frame_cache.h"
+#include "mfuture.h"
+
+namespace mfuture {
+
+namespace details {
+
+// Resumes an awaiting coroutine. A continuation is owned by the shared state,
+// which might outlive the coroutine frame, so it's allocated apart from the
+// awaiter.
+template <typename Awaiter, typename... U>
+class AwaitContinuation : public Continuation<U...> {
+  void OnReady(std::tuple<U...>&& val) {
+    std::exchange(awaiter_, nullptr)->OnReady(std::move(val));
+  }
+
+  void OnFail(std::exception_ptr&& e) {
+    std::exchange(awaiter_, nullptr)->OnFail(std::move(e));
+  }
+
+  void OnError(std::error_code code) {
+    std::exchange(awaiter_, nullptr)->OnError(code);
+  }
+
+  Awaiter* awaiter_;
+
+  friend class Continuation<U...>;
+
+ public:
+  explicit AwaitContinuation(Awaiter* awaiter)
+      : Continuation<U...>(
+            &Continuation<U...>::template Dispatch<AwaitContinuation>),
+        awaiter_(awaiter) {}
+
+  ~AwaitContinuation() {
+    // Abandoned by the producer, the coroutine will never be resumed, so is
+    // its future never resolved.
+    if (awaiter_) awaiter_->OnAbandoned();
+  }
+};
+
+template <typename PromiseType, typename... U>
+class FutureAwaiter {
+ public:
+  FutureAwaiter(Future<U...>&& future, PromiseType* promise)
+      : future_(std::move(future)), promise_(promise) {}
+
+  bool await_ready() const noexcept { return future_.IsReady(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    if (future_.IsFailed()) {
+      future_.Fold(*promise_);
+      handle.destroy();  // Destroys this awaiter as well.
+      return;
+    }
+    handle_ = handle;
+    SetContinuation(future_, new AwaitContinuation<FutureAwaiter, U...>(this));
+    // The state shouldn't be kept alive by the frame waiting for it.
+    future_ = Future<U...>();
+  }
+
+  auto await_resume() {
+    auto&& value = value_ ? *value_ : future_.GetValueRef();
+    if constexpr (sizeof...(U) == 1)
+      return std::get<0>(std::move(value));
+    else if constexpr (sizeof...(U) > 1)
+      return std::tuple<U...>(std::move(value));
+  }
+
+ private:
+  friend class AwaitContinuation<FutureAwaiter, U...>;
+
+  void OnReady(std::tuple<U...>&& val) {
+    value_.emplace(std::move(val));
+    handle_.resume();
+  }
+
+  void OnFail(std::exception_ptr&& e) {
+    promise_->SetException(std::move(e));
+    handle_.destroy();
+  }
+
+  void OnError(std::error_code code) {
+    promise_->SetError(code);
+    handle_.destroy();
+  }
+
+  void OnAbandoned() { handle_.destroy(); }
+
+  Future<U...> future_;
+  PromiseType* promise_;
+  std::coroutine_handle<> handle_;
+  std::optional<std::tuple<U...>> value_;
+};
+
+template <typename... U>
+class WrapAwaiter {
+ public:
+  explicit WrapAwaiter(Future<U...>&& future) : future_(std::move(future)) {}
+
+  bool await_ready() const noexcept { return future_.IsResolved(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    SetContinuation(future_, new AwaitContinuation<WrapAwaiter, U...>(this));
+    future_ = Future<U...>();
+  }
+
+  Future<U...> await_resume() { return std::move(future_); }
+
+ private:
+  friend class AwaitContinuation<WrapAwaiter, U...>;
+
+  void OnReady(std::tuple<U...>&& val) {
+    future_ = MakeReadyFuture<U...>(std::move(val));
+    handle_.resume();
+  }
+
+  void OnFail(std::exception_ptr&& e) {
+    future_ = MakeExceptionalFuture<U...>(std::move(e));
+    handle_.resume();
+  }
+
+  void OnError(std::error_code code) {
+    future_ = MakeErrorFuture<U...>(code);
+    handle_.resume();
+  }
+
+  void OnAbandoned() { handle_.destroy(); }
+
+  Future<U...> future_;
+  std::coroutine_handle<> handle_;
+};
+
+template <typename... T>
+class CoroutinePromiseBase {
+ public:
+  Future<T...> get_return_object() { return promise_.GetFuture(); }
+
+  // Frames are recycled by a thread-local cache, as coroutines are invoked at a
+  // high rate with only a few sizes of frames.
+  static void* operator new(std::size_t size) {
+    return internal::FrameCache::Local().Allocate(size);
+  }
+
+  static void operator delete(void* p, std::size_t size) {
+    internal::FrameCache::Local().Deallocate(p, size);
+  }
+
+  std::suspend_never initial_suspend() noexcept { return {}; }
+
+  // The frame is destroyed right after the future is resolved.
+  std::suspend_never final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() {
+    promise_.SetException(std::current_exception());
+  }
+
+  template <typename... U>
+  FutureAwaiter<Promise<T...>, U...> await_transform(Future<U...>&& future) {
+    return {std::move(future), &promise_};
+  }
+
+  // A future should be moved to be awaited, as it's consumed.
+  template <typename... U>
+  void await_transform(Future<U...>& future) = delete;
+
+  template <typename Awaitable>
+  Awaitable&& await_transform(Awaitable&& awaitable) {
+    return std::forward<Awaitable>(awaitable);
+  }
+
+ protected:
+  Promise<T...> promise_;
+};
+
+template <typename... T>
+class CoroutinePromise : public CoroutinePromiseBase<T...> {
+ public:
+  void return_value(std::tuple<T...>&& val) {
+    this->promise_.SetValue(std::move(val));
+  }
+
+  // Returning a future chains it, as returning one from a Then() callback.
+  void return_value(Future<T...>&& future) { future.Fold(this->promise_); }
+};
+
+template <typename T>
+class CoroutinePromise<T> : public CoroutinePromiseBase<T> {
+ public:
+  template <typename U = T>
+  void return_value(U&& val) {
+    this->promise_.SetValue(std::forward<U>(val));
+  }
+
+  void return_value(Future<T>&& future) { future.Fold(this->promise_); }
+};
+
+template <>
+class CoroutinePromise<> : public CoroutinePromiseBase<> {
+ public:
+  void return_void() { promise_.SetValue(); }
+};
+
+}  // namespace details
+
+// Awaits `future` without consuming its result, so that a failure is
+// inspected rather than passed on.
+template <typename... U>
+details::WrapAwaiter<U...> Wrap(Future<U...>&& future) {
+  return details::WrapAwaiter<U...>(std::move(future));
+}
+
+}  // namespace mfuture
+
+template <typename... T, typename... Args>
+struct std::coroutine_traits<mfuture::Future<T...>, Args...> {
+  using promise_type = mfuture::details::CoroutinePromise<T...>;
+};
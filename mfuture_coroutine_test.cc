@@ -0,0 +1,187 @@
+#include "mfuture_coroutine.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+using namespace mfuture;
+
+namespace {
+
+const std::error_code kTimedOut = std::make_error_code(std::errc::timed_out);
+
+struct Guard {
+  explicit Guard(int& counter) : counter(counter) {}
+  ~Guard() { ++counter; }
+  int& counter;
+};
+
+Future<int> Add(Future<int> a, Future<int> b) {
+  int x = co_await std::move(a);
+  int y = co_await std::move(b);
+  co_return x + y;
+}
+
+Future<> Count(Future<> future, int& counter, int& destroyed) {
+  Guard guard(destroyed);
+  co_await std::move(future);
+  ++counter;
+}
+
+}  // namespace
+
+TEST(Coroutine, ready) {
+  auto future = Add(MakeReadyFuture<int>(1), MakeReadyFuture<int>(2));
+  ASSERT_TRUE(future.IsReady());
+  EXPECT_EQ(future.GetValue<0>(), 3);
+}
+
+TEST(Coroutine, pending) {
+  Promise<int> a, b;
+  auto future = Add(a.GetFuture(), b.GetFuture());
+  ASSERT_FALSE(future.IsResolved());
+  a.SetValue(1);
+  ASSERT_FALSE(future.IsResolved());
+  b.SetValue(2);
+  ASSERT_TRUE(future.IsReady());
+  EXPECT_EQ(future.GetValue<0>(), 3);
+}
+
+TEST(Coroutine, failed) {
+  int counter = 0, destroyed = 0;
+  auto f1 = Count(MakeErrorFuture<>(kTimedOut), counter, destroyed);
+  ASSERT_TRUE(f1.HasErrorCode());
+  EXPECT_EQ(f1.GetErrorCode(), kTimedOut);
+  EXPECT_EQ(counter, 0);
+  EXPECT_EQ(destroyed, 1);
+
+  Promise<> promise;
+  auto f2 = Count(promise.GetFuture(), counter, destroyed);
+  ASSERT_FALSE(f2.IsResolved());
+  promise.SetException(std::make_exception_ptr("test"));
+  ASSERT_TRUE(f2.IsFailed());
+  EXPECT_THROW(std::rethrow_exception(f2.GetException()), const char*);
+  EXPECT_EQ(counter, 0);
+  EXPECT_EQ(destroyed, 2);
+}
+
+TEST(Coroutine, abandoned) {
+  int counter = 0, destroyed = 0;
+  auto promise = std::make_unique<Promise<>>();
+  auto future = Count(promise->GetFuture(), counter, destroyed);
+  promise.reset();
+  EXPECT_FALSE(future.IsResolved());
+  EXPECT_EQ(counter, 0);
+  EXPECT_EQ(destroyed, 1);
+}
+
+TEST(Coroutine, Wrap) {
+  Promise<int> promise;
+  auto future = [](Future<int> f) -> Future<int> {
+    auto ft = co_await Wrap(std::move(f));
+    if (ft.HasErrorCode()) co_return -1;
+    co_return ft.GetValue<0>();
+  }(promise.GetFuture());
+  ASSERT_FALSE(future.IsResolved());
+  promise.SetError(kTimedOut);
+  ASSERT_TRUE(future.IsReady());
+  EXPECT_EQ(future.GetValue<0>(), -1);
+
+  auto f2 = [](Future<int, int> f) -> Future<int> {
+    auto ft = co_await Wrap(std::move(f));
+    auto [x, y] = ft.GetValue();
+    co_return x + y;
+  }(MakeReadyFuture<int, int>(1, 2));
+  ASSERT_TRUE(f2.IsReady());
+  EXPECT_EQ(f2.GetValue<0>(), 3);
+}
+
+TEST(Coroutine, return_future) {
+  Promise<int> promise;
+  auto future = [](Future<int> f) -> Future<int> {
+    co_return std::move(f);
+  }(promise.GetFuture());
+  ASSERT_FALSE(future.IsResolved());
+  promise.SetValue(1);
+  ASSERT_TRUE(future.IsReady());
+  EXPECT_EQ(future.GetValue<0>(), 1);
+
+  auto f2 = []() -> Future<int, bool> {
+    auto [x, y] = co_await MakeReadyFuture<int, bool>(1, true);
+    co_return {x + 1, !y};
+  }();
+  ASSERT_TRUE(f2.IsReady());
+  EXPECT_EQ(f2.GetValue(), std::make_tuple(2, false));
+}
+
+TEST(Coroutine, frame_cache) {
+  auto& cache = internal::FrameCache::Local();
+  (void)Add(MakeReadyFuture<int>(1), MakeReadyFuture<int>(2));
+  auto hits = cache.GetStats().hits;
+  // The frame released just now is reused.
+  auto future = Add(MakeReadyFuture<int>(1), MakeReadyFuture<int>(2));
+  EXPECT_EQ(cache.GetStats().hits, hits + 1);
+  EXPECT_GT(cache.GetStats().retained_bytes, 0);
+}
+
+constexpr int kTimes = 1000000;
+
+// Compare to perf.ready of mfuture_test.
+TEST(perf, coroutine_ready) {
+  int counter = 0;
+  auto future = [](int& counter) -> Future<> {
+    for (int i = 0; i < kTimes; ++i) {
+      co_await MakeReadyFuture<>();
+      ++counter;
+    }
+  }(counter);
+  EXPECT_TRUE(future.IsReady());
+  ASSERT_EQ(counter, kTimes);
+}
+
+// Compare to perf.unready of mfuture_test.
+TEST(perf, coroutine_unready) {
+  int counter = 0;
+  Promise<>* last_promise = nullptr;
+  auto future = [](int& counter, Promise<>*& last_promise) -> Future<> {
+    for (int i = 0; i < kTimes; ++i) {
+      last_promise = new Promise<>();
+      ++counter;
+      co_await last_promise->GetFuture();
+    }
+    last_promise = nullptr;
+  }(counter, last_promise);
+
+  while (last_promise) {
+    // There is no underlying scheduler, so we can drive it in this way.
+    std::unique_ptr<Promise<>> promise(last_promise);
+    promise->SetValue();
+  }
+
+  EXPECT_TRUE(future.IsReady());
+  EXPECT_EQ(counter, kTimes);
+}
+
+// Compare to perf.unready_then of mfuture_test.
+TEST(perf, coroutine_unready_then) {
+  ASSERT_EQ(kTimes % 10, 0);
+
+  int counter = 0;
+  auto future = [](int& counter) -> Future<> {
+    for (int n = 0; n < kTimes / 10; ++n) {
+      Promise<> promise;
+      auto future = [](Future<> future, int& counter) -> Future<> {
+        for (int i = 0; i < 10; ++i) {
+          co_await std::move(future);
+          ++counter;
+          future = MakeReadyFuture<>();
+        }
+      }(promise.GetFuture(), counter);
+      promise.SetValue();
+      co_await std::move(future);
+    }
+  }(counter);
+
+  EXPECT_TRUE(future.IsReady());
+  ASSERT_EQ(counter, kTimes);
+}
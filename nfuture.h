@@ -3,13 +3,25 @@
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <functional>
+#include <memory>
+#include <system_error>
 #include <tuple>
 #include <type_traits>
 #include <utility>
-
+#include <vector>
+
+#include "alloc.h"
+#include "callsite.h"
+#include "census.h"
+#include "exception.h"
+#include "latency.h"
+#include "small_vector.h"
+#include "trace.h"
 #include "traits.h"
+#include "trampoline.h"
 
 namespace nfuture {
 
@@ -19,6 +31,15 @@ class Promise;
 template <class... T>
 class Future;
 
+template <class... T>
+class ReadyFuture;
+
+template <class... T>
+class PromisePool;
+
+template <class... T>
+class SharedFuture;
+
 namespace details {
 
 struct Tag;  // Is incomplete type OK?
@@ -50,37 +71,62 @@ static_assert(IsFuture_v<Futurized<void>>);
 static_assert(IsFuture_v<Futurized<int>>);
 static_assert(IsFuture_v<Futurized<Future<int>>>);
 
+template <typename T>
+struct IsReadyFuture : std::false_type {};
+
+template <typename... T>
+struct IsReadyFuture<ReadyFuture<T...>> : std::true_type {};
+
+template <typename T>
+constexpr bool IsReadyFuture_v =
+    IsReadyFuture<internal::RemoveCVRef_t<T>>::value;
+
 struct MakeReadyFutureTag {};
 struct MakeExceptionalFutureTag {};
 
 template <class... T>
 class FutureState {
+  using ValueType = std::tuple<T...>;
+
  public:
   FutureState() = default;
 
   template <class... U>
-  FutureState(MakeReadyFutureTag, U &&...value)
-      : state_(State::kValue), value_(std::forward<U>(value)...) {}
+  FutureState(MakeReadyFutureTag, U &&...value) : state_(State::kValue) {
+    new (value_.data()) ValueType(std::forward<U>(value)...);
+  }
 
   FutureState(MakeExceptionalFutureTag, std::exception_ptr &&exception)
       : state_(State::kException) {
     new (exception_.data()) std::exception_ptr(std::move(exception));
   }
 
+  FutureState(MakeExceptionalFutureTag, std::error_code code)
+      : category_(&code.category()),
+        state_(State::kErrorCode),
+        error_value_(code.value()) {}
+
   FutureState(FutureState &&other) { MoveFrom(std::move(other)); }
 
-  ~FutureState() { assert(!Available()); }
+  ~FutureState() {
+    assert(!Available());
+    if (state_ == State::kTaken) DestroyValue();
+  }
 
   FutureState &operator=(FutureState &&other) {
-    if (this != &other) MoveFrom(std::move(other));
+    if (this != &other) {
+      Reset();
+      MoveFrom(std::move(other));
+    }
     return *this;
   }
 
   [[gnu::always_inline]] void Reset() {
     switch (state_) {
-      // case State::kValue:
-      // value_ = std::tuple<T...>();
-      // break;
+      case State::kValue:
+      case State::kTaken:
+        DestroyValue();
+        break;
       case State::kException:
         ExceptionRef().~exception_ptr();
         break;
@@ -92,14 +138,29 @@ class FutureState {
 
   void SetValue(std::tuple<T...> &&value) {
     assert(Empty());
-    value_ = std::move(value);
+    new (value_.data()) ValueType(std::move(value));
     state_ = State::kValue;
   }
 
   template <class... U>
   void SetValue(U &&...value) {
     assert(Empty());
-    value_ = std::make_tuple(std::move(value)...);
+    new (value_.data()) ValueType(std::forward<U>(value)...);
+    state_ = State::kValue;
+  }
+
+  template <class... Args>
+  void Emplace(Args &&...args) {
+    assert(Empty());
+    if constexpr (std::is_constructible_v<ValueType, Args &&...>) {
+      new (value_.data()) ValueType(std::forward<Args>(args)...);
+    } else {
+      static_assert(sizeof...(T) == 1,
+                    "Values should be constructed elementwise.");
+      // std::tuple is unable to construct its element from several arguments,
+      // so it costs a move.
+      new (value_.data()) ValueType(T(std::forward<Args>(args)...)...);
+    }
     state_ = State::kValue;
   }
 
@@ -110,22 +171,46 @@ class FutureState {
     state_ = State::kException;
   }
 
+  void SetError(std::error_code code) {
+    assert(Empty());
+    category_ = &code.category();
+    error_value_ = code.value();
+    state_ = State::kErrorCode;
+  }
+
   void SetInvalid() { state_ = State::kInvalid; }
 
-  bool Valid() const { return state_ != State::kInvalid; }
+  bool Valid() const {
+    return state_ != State::kInvalid && state_ != State::kTaken;
+  }
   bool Empty() const { return state_ == State::kEmpty; }
   bool Ready() const { return state_ == State::kValue; }
-  bool Failed() const { return state_ == State::kException; }
+  bool Failed() const {
+    return state_ == State::kException || state_ == State::kErrorCode;
+  }
+  bool HasErrorCode() const { return state_ == State::kErrorCode; }
   bool Available() const { return Ready() || Failed(); }
 
   std::tuple<T...> &&Value() && {
     assert(Ready());
-    state_ = State::kInvalid;
-    return std::move(value_);
+    // The value is kept alive until `Reset()` or destruction, so that the
+    // returned reference is usable as long as this state is.
+    state_ = State::kTaken;
+    return std::move(ValueRef());
+  }
+
+  ValueType &ValueRef() {
+    // std::launder?
+    return *reinterpret_cast<ValueType *>(value_.data());
   }
 
   std::exception_ptr Exception() && {
     assert(Failed());
+    if (HasErrorCode()) {
+      // The slow path, only for those who insist on an exception.
+      return std::make_exception_ptr(
+          std::system_error(std::move(*this).ErrorCode()));
+    }
     auto e = ExceptionRef();
 #ifndef __GLIBCXX__
     // A moved std::exception_ptr might be different from an empty one, so
@@ -136,7 +221,38 @@ class FutureState {
     return e;
   }
 
+  // Peeks at the exception without taking it.
+  const std::exception_ptr &PeekException() const {
+    assert(state_ == State::kException);
+    return *reinterpret_cast<const std::exception_ptr *>(exception_.data());
+  }
+
+  std::error_code PeekErrorCode() const {
+    assert(HasErrorCode());
+    return std::error_code(error_value_, *category_);
+  }
+
+  std::error_code ErrorCode() && {
+    assert(HasErrorCode());
+    state_ = State::kInvalid;
+    return std::error_code(error_value_, *category_);
+  }
+
+  // Passes the failure on to `promise`, keeping an error code as it is.
+  template <class PromiseType>
+  void ForwardFailure(PromiseType &promise) && {
+    if (HasErrorCode())
+      promise.SetError(std::move(*this).ErrorCode());
+    else
+      promise.SetException(std::move(*this).Exception());
+  }
+
  private:
+  void DestroyValue() {
+    if constexpr (!std::is_trivially_destructible_v<ValueType>)
+      ValueRef().~ValueType();
+  }
+
   std::exception_ptr &&ExceptionRef() {
     // std::launder?
     auto p = reinterpret_cast<std::exception_ptr *>(exception_.data());
@@ -147,7 +263,8 @@ class FutureState {
     state_ = std::exchange(other.state_, State::kInvalid);
     switch (state_) {
       case State::kValue:
-        value_ = std::move(other.value_);
+        new (value_.data()) ValueType(std::move(other.ValueRef()));
+        other.DestroyValue();
         break;
       case State::kException:
         new (exception_.data()) std::exception_ptr(other.ExceptionRef());
@@ -155,6 +272,15 @@ class FutureState {
         other.ExceptionRef().~exception_ptr();
 #endif
         break;
+      case State::kErrorCode:
+        category_ = other.category_;
+        error_value_ = other.error_value_;
+        break;
+      case State::kTaken:
+        // Nothing left to move but the husk of the taken value.
+        other.DestroyValue();
+        state_ = State::kInvalid;
+        break;
       default:
         break;
     }
@@ -164,45 +290,147 @@ class FutureState {
   FutureState &operator=(const FutureState &) = delete;
 
  private:
-  enum class State {
+  // A value and an exception are never alive at the same time, so they share
+  // the storage.
+  union {
+    // The value is constructed in place only when it's set, so neither a
+    // pending future pays for a default construction nor `T` is required to
+    // be default-constructible.
+    alignas(ValueType) std::array<std::byte, sizeof(ValueType)> value_;
+
+    // C++ destructor always destroys their members. However, for an empty
+    // std::exception_ptr, it's unnecessary and heavy (it's defined by c++
+    // runtime library, which might prevent compiler to further optimize), so
+    // we try to avoid its destruction. Actually after this optimization,
+    // compilers are able to archive zero-cost for ready futures.
+    alignas(std::exception_ptr)
+        std::array<std::byte, sizeof(std::exception_ptr)> exception_;
+
+    // An error code is carried inline, without any allocation or throwing.
+    // It's split, so that the value fits in the tail padding as well.
+    const std::error_category *category_;
+  };
+
+  // Placed after the storage so that it fits in the tail padding.
+  enum class State : std::uint8_t {
     kEmpty,
     kValue,
     kException,
-    kInvalid
+    kErrorCode,
+    kInvalid,
+    kTaken,  // Invalid, but the moved-from value is still to be destroyed.
   } state_{State::kEmpty};
 
-  std::tuple<T...> value_;
-
-  // C++ destructor always destroys their members. However, for an empty
-  // std::exception_ptr, it's unnecessary and heavy (it's defined by c++ runtime
-  // library, which might prevent compiler to further optimize), so we try to
-  // avoid its destruction. Actually after this optimization, compilers are able
-  // to archive zero-cost for ready futures.
-  alignas(std::exception_ptr)
-      std::array<std::byte, sizeof(std::exception_ptr)> exception_;
+  int error_value_;
 };
 
+// For the dominant Future<> and Future<T> cases, the state takes no more than
+// an exception_ptr (or the value, whichever is larger) plus a word.
+static_assert(sizeof(FutureState<>) <= 2 * sizeof(void *));
+static_assert(sizeof(FutureState<int>) <= 2 * sizeof(void *));
+static_assert(sizeof(FutureState<void *>) <= 2 * sizeof(void *));
+static_assert(sizeof(FutureState<std::tuple<void *, void *>>) <=
+              3 * sizeof(void *));
+
+// Continuations are dispatched through a single function pointer instead of
+// virtual functions, so there is neither a vtable nor a virtual destructor, and
+// each dispatcher is specialized for its own continuation type.
 template <class... T>
 struct ContinuationBase {
-  FutureState<T...> state_;
+  enum class Op { kRun, kDestroy };
+  using Dispatcher = void (*)(ContinuationBase *, Op);
+
+  explicit ContinuationBase(Dispatcher dispatcher) : dispatcher_(dispatcher) {}
 
-  virtual ~ContinuationBase() = default;
-  virtual void Run() = 0;
+  // Runs with `state_` available, then releases the continuation.
+  void Run() {
+#if MFUTURE_LATENCY_STATS
+    internal::ContinuationTimer timer(resolved_);
+#endif
+#if MFUTURE_TRACE
+    internal::TraceRun trace(flow_);
+#endif
+#if MFUTURE_CALLSITE_STATS
+    internal::CallsiteTimer callsite(callsite_);
+#endif
+#if MFUTURE_CENSUS
+    internal::CensusRun census(census_);
+#endif
+    dispatcher_(this, Op::kRun);
+  }
+
+  // Releases the continuation without running it.
+  void Destroy() {
+#if MFUTURE_CENSUS
+    census_.Unlink();
+#endif
+    dispatcher_(this, Op::kDestroy);
+  }
+
+  FutureState<T...> state_;
+  Dispatcher dispatcher_;
+#if MFUTURE_LATENCY_STATS
+  std::uint64_t resolved_ = 0;  // When the promise is resolved.
+#endif
+#if MFUTURE_TRACE
+  std::uint64_t flow_ = 0;
+#endif
+#if MFUTURE_CALLSITE_STATS
+  std::uint32_t callsite_ = 0;  // Where it's chained.
+#endif
+#if MFUTURE_CENSUS
+  internal::CensusNode census_;
+#endif
 };
 
 template <class Callback, class... T>
 struct Continuation : public ContinuationBase<T...> {
+  using Op = typename ContinuationBase<T...>::Op;
+
   Continuation(Callback &&callback)
-      : callback_(std::forward<Callback>(callback)) {}
+      : ContinuationBase<T...>(&Continuation::Dispatch),
+        callback_(std::forward<Callback>(callback)) {}
 
-  void Run() override {
+  static void Dispatch(ContinuationBase<T...> *base, Op op) {
     static_assert(
         std::is_void_v<std::invoke_result_t<Callback, FutureState<T...> &&>>);
-    std::invoke(callback_, std::move(ContinuationBase<T...>::state_));
-    delete this;
+    auto continuation = static_cast<Continuation *>(base);
+    if (op == Op::kRun) {
+      std::invoke(continuation->callback_, std::move(continuation->state_));
+    }
+    delete continuation;
+  }
+
+  // Async tail call: a callback which returns a future chained by Then() with
+  // the same callback type (i.e. a recursive asynchronous loop) allocates the
+  // next continuation while this one is still running, and releases this one
+  // right after. Keeping the last released object of each type makes such
+  // loops run in constant memory without any allocation.
+  static void *operator new(std::size_t size) {
+    if (auto p = std::exchange(recycled_.object, nullptr)) return p;
+    return internal::Allocate(internal::AllocSite::kContinuation, size);
+  }
+
+  static void operator delete(void *p, std::size_t size) {
+    if (!recycled_.object)
+      recycled_.object = p;
+    else
+      internal::Deallocate(internal::AllocSite::kContinuation, p, size);
   }
 
   Callback callback_;
+
+ private:
+  struct Recycled {
+    ~Recycled() {
+      if (object) {
+        internal::Deallocate(internal::AllocSite::kContinuation, object,
+                             sizeof(Continuation));
+      }
+    }
+    void *object = nullptr;
+  };
+  static inline thread_local Recycled recycled_;
 };
 
 // Perhaps users also need this function.
@@ -211,6 +439,19 @@ FutureType MakeExceptionalFuture(std::exception_ptr &&exception) {
   return FutureType(details::MakeExceptionalFutureTag{}, std::move(exception));
 }
 
+template <typename FutureType>
+FutureType MakeErrorFuture(std::error_code code) {
+  return FutureType(details::MakeExceptionalFutureTag{}, code);
+}
+
+// Makes a future of `FutureType` failed the same way as `state`.
+template <typename FutureType, typename... T>
+FutureType MakeFailedFuture(FutureState<T...> &&state) {
+  if (state.HasErrorCode())
+    return MakeErrorFuture<FutureType>(std::move(state).ErrorCode());
+  return MakeExceptionalFuture<FutureType>(std::move(state).Exception());
+}
+
 template <typename... T>
 void SetContinuation(Future<T...> &future,
                      ContinuationBase<T...> *continuation) {
@@ -236,6 +477,13 @@ Future<T...> MakeExceptionalFuture(std::exception_ptr &&exception) {
                       std::move(exception));
 }
 
+// Unlike an exception, an error code is carried inline, so a future failed
+// this way costs neither an allocation nor a throw.
+template <typename... T>
+Future<T...> MakeErrorFuture(std::error_code code) {
+  return Future<T...>(details::MakeExceptionalFutureTag{}, code);
+}
+
 template <class... T>
 class [[nodiscard]] Future {
   static_assert(internal::IsNotVoid_v<T...>,
@@ -265,7 +513,7 @@ class [[nodiscard]] Future {
   }
 
   template <class Callback, class R = std::invoke_result_t<Callback, T &&...>>
-  auto Then(Callback &&callback) {
+  auto Then(Callback &&callback MFUTURE_CALLSITE_PARAM) {
     assert(state_.Valid());  // Detect doubly Then.
 
     using FR =
@@ -274,10 +522,13 @@ class [[nodiscard]] Future {
       return FuturizeApply(std::forward<Callback>(callback),
                            std::move(state_).Value());
     } else if (state_.Failed()) {
-      return details::MakeExceptionalFuture<FR>(std::move(state_).Exception());
+      return details::MakeFailedFuture<FR>(std::move(state_));
     } else {
       assert(promise_);
       assert(!promise_->continuation_);
+#if MFUTURE_TRACE
+      internal::TraceScope trace(promise_->flow_);
+#endif
 
       FR future;
       auto cb = [promise = future.GetPromise(),
@@ -295,11 +546,14 @@ class [[nodiscard]] Future {
           }
         } else {
           assert(state.Failed());
-          promise.SetException(std::move(state).Exception());
+          std::move(state).ForwardFailure(promise);
         }
       };
       auto continuation =
           new details::Continuation<decltype(cb), T...>(std::move(cb));
+#if MFUTURE_CALLSITE_STATS
+      continuation->callsite_ = internal::InternCallsite(callsite);
+#endif
       SetContinuation(continuation);
 
       return future;  // NRVO?
@@ -308,7 +562,7 @@ class [[nodiscard]] Future {
 
   template <class Callback,
             class R = std::invoke_result_t<Callback, Future<T...> &&>>
-  auto ThenWrap(Callback &&callback) {
+  auto ThenWrap(Callback &&callback MFUTURE_CALLSITE_PARAM) {
     assert(state_.Valid());  // Detect doubly Then.
 
     using FR =
@@ -318,6 +572,9 @@ class [[nodiscard]] Future {
     } else {
       assert(promise_);
       assert(!promise_->continuation_);
+#if MFUTURE_TRACE
+      internal::TraceScope trace(promise_->flow_);
+#endif
 
       FR future;
       auto cb = [promise = future.GetPromise(),
@@ -336,6 +593,9 @@ class [[nodiscard]] Future {
 
       auto continuation =
           new details::Continuation<decltype(cb), T...>(std::move(cb));
+#if MFUTURE_CALLSITE_STATS
+      continuation->callsite_ = internal::InternCallsite(callsite);
+#endif
       SetContinuation(continuation);
 
       return future;  // NRVO?
@@ -364,29 +624,176 @@ class [[nodiscard]] Future {
     return std::get<Index>(Value());
   }
 
+  // Accesses the value in place, without consuming it.
+  std::tuple<T...> &ValueRef() {
+    assert(Ready());
+    return state_.ValueRef();
+  }
+
+  template <size_t Index>
+  auto &ValueRef() {
+    return std::get<Index>(ValueRef());
+  }
+
+  // Consumes the value by passing its elements to `function` as rvalues.
+  template <class Function>
+  decltype(auto) ConsumeValue(Function &&function) {
+    return std::apply(std::forward<Function>(function), Value());
+  }
+
+  // Note that a future failed by an error code makes a std::system_error here,
+  // use `ErrorCode()` instead to avoid the cost.
   std::exception_ptr Exception() {
     return std::move(state_).Exception();  // NRVO?
   }
 
+  bool HasErrorCode() const {
+    assert(state_.Valid());
+    return state_.HasErrorCode();
+  }
+
+  std::error_code ErrorCode() { return std::move(state_).ErrorCode(); }
+
+  // Handles a failure without rethrowing it: `handler` is invoked with the
+  // std::error_code of a future failed by an error code, or the
+  // std::exception_ptr of one failed by an exception, if it's invocable with
+  // that; otherwise the failure is passed on untouched, so is a value. To
+  // recover, `handler` returns a Future<T...>, or the value of a Future<T>, or
+  // nothing for a Future<>.
+  template <class Handler>
+  Future<T...> ThenOnError(Handler &&handler) {
+    assert(state_.Valid());  // Detect doubly Then.
+    static_assert(std::is_invocable_v<Handler, std::error_code> ||
+                      std::is_invocable_v<Handler, std::exception_ptr>,
+                  "Handler should accept std::error_code or "
+                  "std::exception_ptr.");
+
+    if (state_.Ready()) {
+      return std::move(*this);
+    } else if (state_.Failed()) {
+      return HandleFailure<Future<T...>>(std::forward<Handler>(handler));
+    } else {
+      return ThenWrap([handler = std::forward<Handler>(handler)](
+                          Future<T...> &&future) mutable {
+        return future.ThenOnError(std::move(handler));
+      });
+    }
+  }
+
+  // Recovers from an exception of type E, or derived from E: `handler` is
+  // invoked with `const E &`, and recovers as a ThenOnError() handler does.
+  // The type is matched without rethrowing. Other failures, as well as a
+  // value, are passed on untouched.
+  template <class E, class Handler>
+  Future<T...> HandleException(Handler &&handler) {
+    assert(state_.Valid());  // Detect doubly Then.
+    if (state_.Ready() || state_.HasErrorCode()) {
+      return std::move(*this);
+    } else if (state_.Failed()) {
+      if (auto e = internal::ExceptionCast<E>(state_.PeekException()))
+        return Recover(std::forward<Handler>(handler), *e);
+      return std::move(*this);
+    } else {
+      return ThenWrap([handler = std::forward<Handler>(handler)](
+                          Future<T...> &&future) mutable {
+        return future.template HandleException<E>(std::move(handler));
+      });
+    }
+  }
+
+  // Same as HandleException(), with E deduced from `handler`'s parameter.
+  template <class Handler>
+  Future<T...> HandleExceptionType(Handler &&handler) {
+    using E = internal::RemoveCVRef_t<
+        typename internal::ClosureTraits<Handler>::ArgType>;
+    return HandleException<E>(std::forward<Handler>(handler));
+  }
+
+  // Invokes `function` once this future is resolved, whatever the result is,
+  // then passes the result on untouched.
+  template <class Function>
+  Future<T...> Finally(Function &&function) {
+    return ThenWrap([function = std::forward<Function>(function)](
+                        Future<T...> &&future) mutable {
+      function();
+      return std::move(future);
+    });
+  }
+
+  // Handles both results at once: `on_value` is invoked as a Then() callback
+  // is, and `on_error` as a ThenOnError() handler is, and both should result
+  // in the same type of future. A value costs the same as with Then().
+  template <class OnValue, class OnError,
+            class R = std::invoke_result_t<OnValue, T &&...>>
+  auto ThenValueOrError(OnValue &&on_value, OnError &&on_error) {
+    assert(state_.Valid());  // Detect doubly Then.
+
+    using FR =
+        std::conditional_t<std::is_void_v<R>, Future<>, details::Futurized<R>>;
+    if (state_.Ready()) {
+      return Then(std::forward<OnValue>(on_value));
+    } else if (state_.Failed()) {
+      return HandleFailure<FR>(std::forward<OnError>(on_error));
+    } else {
+      return ThenWrap([on_value = std::forward<OnValue>(on_value),
+                       on_error = std::forward<OnError>(on_error)](
+                          Future<T...> &&future) mutable {
+        return future.ThenValueOrError(std::move(on_value),
+                                       std::move(on_error));
+      });
+    }
+  }
+
   [[gnu::always_inline]] void Ignore() {
     if (state_.Available()) state_.Reset();
   }
 
+  // Converts to a future shared by several consumers, which stores the result
+  // once for all of them.
+  SharedFuture<T...> Share() { return SharedFuture<T...>(std::move(*this)); }
+
+  // Forwards the result of this future to `promise`. If this future is still
+  // pending, `promise` takes over the counterpart promise's slot, so that the
+  // downstream future is resolved directly by the upstream producer. This is
+  // how a Then() callback returning a future is chained, and it keeps a
+  // recursive asynchronous loop from growing.
+  void Fold(Promise<T...> &&promise) {
+    assert(state_.Valid());
+    if (state_.Ready()) {
+      promise.SetValue(std::move(state_).Value());
+    } else if (state_.Failed()) {
+      std::move(state_).ForwardFailure(promise);
+    } else {
+      assert(promise_);
+      *promise_ = std::move(promise);
+    }
+  }
+
  private:
   friend class Promise<T...>;
 
   template <typename... U>
   friend class Future;
 
+  friend class ReadyFuture<T...>;
+
+  friend class SharedFuture<T...>;
+
   template <typename... U, typename... V>
   friend Future<U...> MakeReadyFuture(V &&...);
 
   template <typename... U>
   friend Future<U...> MakeExceptionalFuture(std::exception_ptr &&);
 
+  template <typename... U>
+  friend Future<U...> MakeErrorFuture(std::error_code);
+
   template <typename FutureType>
   friend FutureType details::MakeExceptionalFuture(std::exception_ptr &&);
 
+  template <typename FutureType>
+  friend FutureType details::MakeErrorFuture(std::error_code);
+
   template <typename... U>
   friend void details::SetContinuation(Future<U...> &,
                                        details::ContinuationBase<U...> *);
@@ -395,11 +802,42 @@ class [[nodiscard]] Future {
 
   template <typename... U>
   Future(details::MakeReadyFutureTag tag, U &&...val)
-      : state_(tag, std::move(val)...), promise_(nullptr) {}
+      : state_(tag, std::forward<U>(val)...), promise_(nullptr) {}
 
   Future(details::MakeExceptionalFutureTag tag, std::exception_ptr &&exception)
       : state_(tag, std::move(exception)), promise_(nullptr) {}
 
+  Future(details::MakeExceptionalFutureTag tag, std::error_code code)
+      : state_(tag, code), promise_(nullptr) {}
+
+  template <class FR = Future<T...>, class Handler, class Error>
+  static FR Recover(Handler &&handler, Error &&error) {
+    auto future = FuturizeInvoke(std::forward<Handler>(handler),
+                                 std::forward<Error>(error));
+    static_assert(std::is_same_v<decltype(future), FR>,
+                  "Handler should recover with the same type.");
+    return future;
+  }
+
+  // Invokes `handler` with the failure if it's invocable with that, or passes
+  // the failure on to a future of type FR.
+  template <class FR, class Handler>
+  FR HandleFailure(Handler &&handler) {
+    static_assert(std::is_invocable_v<Handler, std::error_code> ||
+                      std::is_invocable_v<Handler, std::exception_ptr>,
+                  "Handler should accept std::error_code or "
+                  "std::exception_ptr.");
+    assert(state_.Failed());
+    if (state_.HasErrorCode()) {
+      if constexpr (std::is_invocable_v<Handler, std::error_code>)
+        return Recover<FR>(std::forward<Handler>(handler), ErrorCode());
+    } else {
+      if constexpr (std::is_invocable_v<Handler, std::exception_ptr>)
+        return Recover<FR>(std::forward<Handler>(handler), Exception());
+    }
+    return details::MakeFailedFuture<FR>(std::move(state_));
+  }
+
   Future(Promise<T...> *promise)
       : state_(std::move(*(promise->p_state_))), promise_(promise) {
     promise_->p_state_ = &state_;
@@ -415,6 +853,10 @@ class [[nodiscard]] Future {
       if (promise_->p_state_ == &state_) {
         assert(!promise_->continuation_);
         promise_->p_state_ = nullptr;
+#if MFUTURE_CENSUS
+        // Nothing waits for it any longer.
+        promise_->census_.Unlink();
+#endif
       }
       return std::exchange(promise_, nullptr);
     }
@@ -436,22 +878,23 @@ class [[nodiscard]] Future {
     return Promise<T...>(this);
   }
 
-  // TODO(monte): Make it public.
-  void Fold(Promise<T...> &&promise) {
-    if (state_.Ready()) {
-      promise.SetValue(std::move(state_).Value());
-    } else if (state_.Failed()) {
-      promise.SetException(std::move(state_).Exception());
-    } else {
-      assert(promise_);
-      *promise_ = std::move(promise);
-    }
-  }
-
   void SetContinuation(details::ContinuationBase<T...> *continuation) {
     assert(!Available());
     assert(!promise_->continuation_);
     promise_->continuation_ = continuation;
+#if MFUTURE_TRACE
+    continuation->flow_ = promise_->flow_;
+    internal::Trace(internal::TraceEvent::kAttach, continuation->flow_);
+#endif
+#if MFUTURE_CENSUS
+    std::uint32_t callsite = 0;
+#if MFUTURE_CALLSITE_STATS
+    callsite = continuation->callsite_;
+#endif
+    continuation->census_.Link(internal::CensusKind::kContinuation,
+                               internal::CensusType<T...>(), callsite);
+    promise_->census_.SetCallsite(callsite);
+#endif
     assert(promise_->p_state_ == &state_);
     continuation->state_ = std::move(state_);  // Invalidates `state_`.
     promise_->p_state_ = &continuation->state_;
@@ -476,16 +919,23 @@ class Promise {
       "Promise's template arguments are NOT allowed to be reference.");
 
  public:
-  Promise() : p_state_(&state_), future_(nullptr), continuation_(nullptr) {}
+  Promise() : p_state_(&state_), future_(nullptr), continuation_(nullptr) {
+#if MFUTURE_TRACE
+    flow_ = internal::TraceCreate();
+#endif
+  }
 
   Promise(Promise &&other) { MoveFrom(std::move(other)); }
 
-  ~Promise() { Reset(); }
+  ~Promise() { Recycle(); }
 
   Future<T...> GetFuture() {
     assert(!future_);
     assert(p_state_);
     assert(!continuation_);
+#if MFUTURE_CENSUS
+    census_.Link(internal::CensusKind::kPromise, internal::CensusType<T...>());
+#endif
     return Future<T...>(this);
   }
 
@@ -496,14 +946,19 @@ class Promise {
     if (!p_state_) return;
 
     p_state_->SetValue(std::forward<U>(value)...);
+    RunContinuation();
+  }
 
-    // Clear the continuation member before scheduling, because this promise
-    // might be destructed before the continuation is done.
-    if (auto continuation = std::exchange(continuation_, nullptr)) {
-      p_state_ = nullptr;
-      // TODO(monte): Schedule?
-      continuation->Run();
-    }
+  // Constructs the value in place from `args`, which are forwarded to the
+  // constructor of `T` for a Promise<T>, or elementwise otherwise.
+  template <class... Args>
+  void Emplace(Args &&...args) {
+    // In case that the counterpart Future has been destructed, such as the ones
+    // returned by Then() abandoned by user.
+    if (!p_state_) return;
+
+    p_state_->Emplace(std::forward<Args>(args)...);
+    RunContinuation();
   }
 
   void SetException(std::exception_ptr &&exception) {
@@ -512,23 +967,83 @@ class Promise {
     if (!p_state_) return;
 
     p_state_->SetException(std::move(exception));
+    RunContinuation();
+  }
 
+  // Fails with an error code, which is carried inline, without any allocation
+  // or throwing.
+  void SetError(std::error_code code) {
+    // In case that the counterpart Future has been destructed, such as the ones
+    // returned by Then() abandoned by user.
+    if (!p_state_) return;
+
+    p_state_->SetError(code);
+    RunContinuation();
+  }
+
+  // Re-arms this promise for another round, once the previous one is resolved,
+  // and returns its future. The storage of the promise is reused, while the
+  // previous future, if still around, keeps its result. It's fine to be called
+  // from within the continuation of the previous round.
+  Future<T...> Rearm() {
+    assert(!continuation_);
+    // The state is gone once consumed by the continuation of a Then().
+    assert(!future_ || !p_state_ || p_state_->Available());
+    Reset();
+    return GetFuture();
+  }
+
+ private:
+  friend class Future<T...>;
+
+  friend class PromisePool<T...>;
+
+  void Recycle() {
+    // A promise abandoned before being resolved releases its continuation, so
+    // that nothing is leaked, even though the downstream future will never be
+    // resolved.
+    if (continuation_) std::exchange(continuation_, nullptr)->Destroy();
+    Reset();
+  }
+
+  void RunContinuation() {
+#if MFUTURE_TRACE
+    internal::Trace(internal::TraceEvent::kResolve, flow_);
+#endif
+#if MFUTURE_CENSUS
+    census_.Unlink();
+#endif
     // Clear the continuation member before scheduling, because this promise
     // might be destructed before the continuation is done.
     if (auto continuation = std::exchange(continuation_, nullptr)) {
       p_state_ = nullptr;
+#if MFUTURE_LATENCY_STATS
+      continuation->resolved_ = internal::NowNanoseconds();
+#endif
       // TODO(monte): Schedule?
-      continuation->Run();
+      // The continuation owns the result, so it's good to be deferred.
+      if (internal::Trampoline::CanRunInline())
+        internal::Trampoline::RunInline(
+            [continuation]() { continuation->Run(); });
+      else
+        internal::Trampoline::Defer(&Promise::Run, continuation);
     }
   }
 
- private:
-  friend class Future<T...>;
+  static void Run(void *continuation) {
+    static_cast<details::ContinuationBase<T...> *>(continuation)->Run();
+  }
 
   Promise(Future<T...> *future)
       : p_state_(&future->state_), future_(future), continuation_(nullptr) {
     state_.SetInvalid();
     future_->promise_ = this;
+#if MFUTURE_TRACE
+    flow_ = internal::TraceCreate();
+#endif
+#if MFUTURE_CENSUS
+    census_.Link(internal::CensusKind::kPromise, internal::CensusType<T...>());
+#endif
   }
 
   Promise &operator=(Promise &&other) {
@@ -547,6 +1062,9 @@ class Promise {
     }
     state_.Reset();
     p_state_ = &state_;
+#if MFUTURE_CENSUS
+    census_.Unlink();
+#endif
   }
 
   void MoveFrom(Promise &&other) {
@@ -554,12 +1072,19 @@ class Promise {
     // TODO(monte): Restore to its original state?
     if (other.p_state_ == &other.state_) {
       state_ = std::move(other.state_);
+      p_state_ = &state_;
     } else {
       p_state_ = std::exchange(other.p_state_, nullptr);
     }
 
     future_ = std::exchange(other.future_, nullptr);
     continuation_ = std::exchange(other.continuation_, nullptr);
+#if MFUTURE_TRACE
+    flow_ = other.flow_;
+#endif
+#if MFUTURE_CENSUS
+    census_.MoveFrom(other.census_);
+#endif
 
     if (future_) {
       future_->promise_ = this;
@@ -571,11 +1096,262 @@ class Promise {
   details::FutureState<T...> *p_state_;
   Future<T...> *future_;
   details::ContinuationBase<T...> *continuation_;
+#if MFUTURE_TRACE
+  std::uint64_t flow_ = 0;  // The chain the future belongs to.
+#endif
+#if MFUTURE_CENSUS
+  internal::CensusNode census_;
+#endif
 };
 
 template <>
 class Promise<void> : public Promise<> {};
 
+static_assert(sizeof(Future<>) <= 3 * sizeof(void *));
+static_assert(sizeof(Future<void *>) <= 3 * sizeof(void *));
+
+// A pool of promises for request slots, e.g. of a connection. A promise is
+// acquired for a request, and released once the request is done with, to be
+// re-armed for the next one, so that a steady loop of requests constructs none.
+template <class... T>
+class PromisePool {
+ public:
+  explicit PromisePool(size_t size)
+      : promises_(size) {
+    free_.reserve(size);
+    for (size_t i = size; i > 0; --i) free_.push_back(&promises_[i - 1]);
+  }
+
+  PromisePool(const PromisePool &) = delete;
+  PromisePool &operator=(const PromisePool &) = delete;
+
+  // Hands out a promise ready for `GetFuture()`, or nullptr if all are in use.
+  Promise<T...> *Acquire() {
+    if (free_.empty()) return nullptr;
+    auto promise = free_.back();
+    free_.pop_back();
+    return promise;
+  }
+
+  // Takes back a promise handed out by `Acquire()`. A round left unresolved
+  // is abandoned, as if the promise were destroyed.
+  void Release(Promise<T...> *promise) {
+    assert(promise >= promises_.data() &&
+           promise < promises_.data() + promises_.size());
+    promise->Recycle();
+    free_.push_back(promise);
+  }
+
+  size_t Size() const { return promises_.size(); }
+
+  size_t Available() const { return free_.size(); }
+
+ private:
+  template <class U>
+  using Vector = internal::SiteVector<U, internal::AllocSite::kPromisePool>;
+
+  Vector<Promise<T...>> promises_;
+  Vector<Promise<T...> *> free_;
+};
+
+namespace details {
+
+// The shared state of a SharedFuture, which is the continuation of the source
+// future as well, so that sharing allocates nothing else. It's released once
+// neither any SharedFuture nor the source refers to it.
+template <class... T>
+class SharedState
+    : public ContinuationBase<T...>,
+      public internal::Allocated<internal::AllocSite::kSharedState> {
+  using Op = typename ContinuationBase<T...>::Op;
+
+ public:
+  // The first few waiters are kept inline.
+  static constexpr size_t kInlineWaiters = 3;
+
+  SharedState() : ContinuationBase<T...>(&SharedState::Dispatch) {}
+
+  // The result is only peeked at, so it's still there.
+  ~SharedState() { this->state_.Reset(); }
+
+  void Ref() { ++refs_; }
+
+  void Unref() {
+    if (--refs_ == 0) delete this;
+  }
+
+  Future<T...> GetFuture() {
+    static_assert(std::is_copy_constructible_v<std::tuple<T...>>,
+                  "A shared value is copied to each future.");
+    auto &state = this->state_;
+    if (state.Ready())
+      return nfuture::MakeReadyFuture<T...>(state.ValueRef());
+    if (state.HasErrorCode())
+      return nfuture::MakeErrorFuture<T...>(state.PeekErrorCode());
+    if (state.Failed())
+      return nfuture::MakeExceptionalFuture<T...>(
+          std::exception_ptr(state.PeekException()));
+    return waiters_.emplace_back().GetFuture();
+  }
+
+ private:
+  static void Dispatch(ContinuationBase<T...> *base, Op op) {
+    auto shared = static_cast<SharedState *>(base);
+    // Taken out first, in case that a waiter releases the shared state.
+    auto waiters = std::move(shared->waiters_);
+    if (op == Op::kRun) {
+      auto &state = shared->state_;
+      for (auto &promise : waiters) {
+        if (state.Ready())
+          promise.SetValue(state.ValueRef());
+        else if (state.HasErrorCode())
+          promise.SetError(state.PeekErrorCode());
+        else
+          promise.SetException(std::exception_ptr(state.PeekException()));
+      }
+    }
+    // Otherwise abandoned by the producer, so are the waiters.
+    shared->Unref();  // The reference of the source.
+  }
+
+  int refs_ = 1;
+  internal::SmallVector<Promise<T...>, kInlineWaiters,
+                        internal::AllocSite::kWaiters>
+      waiters_;
+};
+
+}  // namespace details
+
+// A future shared by several consumers, made by `Future::Share()`. The result
+// is stored once, and either accessed in place by `ValueRef()` once ready, or
+// copied to a future of each consumer by `GetFuture()`. A handle is cheap to
+// copy, though not thread-safe, the same as Future.
+template <class... T>
+class SharedFuture {
+ public:
+  SharedFuture(const SharedFuture &other) : shared_(other.shared_) {
+    if (shared_) shared_->Ref();
+  }
+
+  SharedFuture(SharedFuture &&other)
+      : shared_(std::exchange(other.shared_, nullptr)) {}
+
+  SharedFuture &operator=(SharedFuture other) {
+    std::swap(shared_, other.shared_);
+    return *this;
+  }
+
+  ~SharedFuture() {
+    if (shared_) shared_->Unref();
+  }
+
+  bool Available() const { return shared_->state_.Available(); }
+
+  bool Ready() const { return shared_->state_.Ready(); }
+
+  bool Failed() const { return shared_->state_.Failed(); }
+
+  const std::tuple<T...> &ValueRef() const {
+    assert(Ready());
+    return shared_->state_.ValueRef();
+  }
+
+  template <size_t Index>
+  const auto &ValueRef() const {
+    return std::get<Index>(ValueRef());
+  }
+
+  // A future of a copy of the result, resolved along with this one.
+  Future<T...> GetFuture() { return shared_->GetFuture(); }
+
+ private:
+  friend class Future<T...>;
+
+  explicit SharedFuture(Future<T...> &&future)
+      : shared_(new details::SharedState<T...>()) {
+    if (future.Available()) {
+      shared_->state_ = std::move(future.state_);
+    } else {
+      shared_->Ref();  // Released by the source.
+      details::SetContinuation(future, shared_);
+    }
+  }
+
+  details::SharedState<T...> *shared_;
+};
+
+// A future statically known to be ready, such as a cache hit. Its Then()
+// invokes the callback right away, and returns the future the callback
+// returns, or a ReadyFuture of its result, so that a chain of them compiles to
+// plain function calls. It converts to a Future<T...> where that's wanted.
+template <class... T>
+class [[nodiscard]] ReadyFuture {
+  static_assert(internal::IsNotVoid_v<T...>,
+                "ReadyFuture's template arguments are NOT allowed to be void, "
+                "use ReadyFuture<> instead of ReadyFuture<void>.");
+
+  static_assert(internal::IsNotReference_v<T...>,
+                "ReadyFuture's template arguments are NOT allowed to be "
+                "reference.");
+
+ public:
+  explicit ReadyFuture(std::tuple<T...> &&value) : value_(std::move(value)) {}
+
+  ReadyFuture(ReadyFuture &&) = default;
+  ReadyFuture &operator=(ReadyFuture &&) = default;
+
+  template <class Callback,
+            class R = internal::ApplyResultType<Callback, std::tuple<T...>>>
+  auto Then(Callback &&callback) {
+    if constexpr (details::IsFuture_v<R> || details::IsReadyFuture_v<R>) {
+      return std::apply(std::forward<Callback>(callback), std::move(value_));
+    } else if constexpr (std::is_void_v<R>) {
+      std::apply(std::forward<Callback>(callback), std::move(value_));
+      return ReadyFuture<>(std::tuple<>());
+    } else {
+      return ReadyFuture<R>(std::tuple<R>(
+          std::apply(std::forward<Callback>(callback), std::move(value_))));
+    }
+  }
+
+  constexpr bool Available() const { return true; }
+
+  constexpr bool Ready() const { return true; }
+
+  constexpr bool Failed() const { return false; }
+
+  std::tuple<T...> &&Value() { return std::move(value_); }
+
+  template <size_t Index>
+  auto &&Value() {
+    return std::get<Index>(Value());
+  }
+
+  std::tuple<T...> &ValueRef() { return value_; }
+
+  template <size_t Index>
+  auto &ValueRef() {
+    return std::get<Index>(ValueRef());
+  }
+
+  template <class Function>
+  decltype(auto) ConsumeValue(Function &&function) {
+    return std::apply(std::forward<Function>(function), Value());
+  }
+
+  operator Future<T...>() && {
+    return Future<T...>(details::MakeReadyFutureTag{}, std::move(value_));
+  }
+
+ private:
+  std::tuple<T...> value_;
+};
+
+template <typename... T, typename... U>
+ReadyFuture<T...> MakeReady(U &&...val) {
+  return ReadyFuture<T...>(std::tuple<T...>(std::forward<U>(val)...));
+}
+
 template <typename Function, typename... Args>
 auto FuturizeInvoke(Function &&f, Args &&...args) {
   using R = std::invoke_result_t<Function, decltype(args)...>;
@@ -609,15 +1385,31 @@ auto FuturizeApply(Function &&f, Tuple &&t) {
 namespace details {
 
 template <typename Stop, typename Function>
-struct DoUntilState : public ContinuationBase<> {
+struct DoUntilState
+    : public ContinuationBase<>,
+      public internal::Allocated<internal::AllocSite::kDoUntilState> {
   DoUntilState(Stop &&stop, Function &&function)
-      : stop_(std::forward<Stop>(stop)),
-        function_(std::forward<Function>(function)) {}
+      : ContinuationBase<>(&DoUntilState::Dispatch),
+        stop_(std::forward<Stop>(stop)),
+        function_(std::forward<Function>(function)) {
+#if MFUTURE_CENSUS
+    loop_census_.Link(internal::CensusKind::kDoUntilState,
+                      internal::CensusType<>());
+#endif
+  }
 
-  void Run() override {
+  static void Dispatch(ContinuationBase<> *base, Op op) {
+    auto state = static_cast<DoUntilState *>(base);
+    if (op == Op::kRun)
+      state->Resume();
+    else
+      delete state;
+  }
+
+  void Resume() {
     assert(state_.Available());
     if (state_.Failed()) {
-      promise_.SetException(std::move(state_).Exception());
+      std::move(state_).ForwardFailure(promise_);
       delete this;
       return;
     }
@@ -631,7 +1423,7 @@ struct DoUntilState : public ContinuationBase<> {
         auto future = FuturizeInvoke(function_);
         if (future.Ready()) {
         } else if (future.Failed()) {
-          promise_.SetException(future.Exception());
+          future.Fold(std::move(promise_));
           state_.Reset();
           delete this;
           break;
@@ -646,12 +1438,15 @@ struct DoUntilState : public ContinuationBase<> {
   Promise<> promise_;
   Stop stop_;
   Function function_;
+#if MFUTURE_CENSUS
+  internal::CensusNode loop_census_;
+#endif
 };
 
 }  // namespace details
 
 template <typename Stop, typename Function>
-Future<> DoUntil(Stop &&stop, Function &&function) {
+Future<> DoUntil(Stop &&stop, Function &&function MFUTURE_CALLSITE_PARAM) {
   static_assert(std::is_convertible_v<std::invoke_result_t<Stop>, bool>);
 
   // If Function doesn't return a Future, user should use do-while instead.
@@ -669,6 +1464,12 @@ Future<> DoUntil(Stop &&stop, Function &&function) {
     else {
       auto state = new details::DoUntilState<Stop, Function>(
           std::forward<Stop>(stop), std::forward<Function>(function));
+#if MFUTURE_CALLSITE_STATS
+      state->callsite_ = internal::InternCallsite(callsite);
+#if MFUTURE_CENSUS
+      state->loop_census_.SetCallsite(state->callsite_);
+#endif
+#endif
       details::SetContinuation(future, state);
       return state->promise_.GetFuture();
     }
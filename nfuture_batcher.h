@@ -0,0 +1,105 @@
+#pragma once
+
+// Request batching. Point lookups are collected into a batch, which is loaded
+// by a single bulk call, e.g. a multi-get of the backend:
+//
+//   Batcher<Key, Value> batcher(
+//       [&](std::vector<Key> keys) { return backend.MultiGet(keys); }, 64);
+//   auto future = batcher.Load(key);
+//
+// A batch is flushed once it reaches the size limit, or by Flush(), which the
+// owner calls at the end of its loop tick, or from a timer, so that a partial
+// batch doesn't wait for long. The promise of a key is kept by value in the
+// batch, so a key costs no allocation beyond the batch vectors.
+
+#include <cassert>
+#include <functional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "nfuture.h"
+
+namespace nfuture {
+
+// Not thread-safe, the same as the futures. Keys are passed to the bulk load
+// as they come, duplicates included.
+template <class K, class V>
+class Batcher {
+ public:
+  // Loads the values of `keys` in the same order.
+  using BulkLoad = std::function<Future<std::vector<V>>(std::vector<K>)>;
+
+  Batcher(BulkLoad bulk_load, size_t max_batch)
+      : bulk_load_(std::move(bulk_load)), max_batch_(max_batch) {
+    assert(max_batch_ > 0);
+    Reserve();
+  }
+
+  Batcher(const Batcher &) = delete;
+  Batcher &operator=(const Batcher &) = delete;
+
+  // The keys collected and not flushed yet are abandoned.
+  ~Batcher() = default;
+
+  Future<V> Load(K key) {
+    keys_.push_back(std::move(key));
+    auto future = promises_.emplace_back().GetFuture();
+    if (keys_.size() == max_batch_) Flush();
+    return future;
+  }
+
+  // Loads the keys collected so far, if any. The futures of a batch are
+  // resolved together once the bulk load is done. If it fails, so do they, as
+  // well as if it loads a different number of values than the keys, with
+  // std::errc::bad_message.
+  void Flush() {
+    if (keys_.empty()) return;
+    auto keys = std::move(keys_);
+    auto promises = std::move(promises_);
+    Reserve();
+    bulk_load_(std::move(keys))
+        .ThenWrap([promises = std::move(promises)](
+                      Future<std::vector<V>> &&future) mutable {
+          Resolve(promises, std::move(future));
+        })
+        .Ignore();
+  }
+
+  // The number of keys collected.
+  size_t Size() const { return keys_.size(); }
+
+ private:
+  void Reserve() {
+    keys_.reserve(max_batch_);
+    promises_.reserve(max_batch_);
+  }
+
+  static void Resolve(std::vector<Promise<V>> &promises,
+                      Future<std::vector<V>> &&future) {
+    if (future.Ready()) {
+      auto values = std::get<0>(future.Value());
+      if (values.size() == promises.size()) {
+        for (size_t i = 0; i < promises.size(); ++i)
+          promises[i].SetValue(std::move(values[i]));
+        return;
+      }
+      for (auto &promise : promises)
+        promise.SetError(std::make_error_code(std::errc::bad_message));
+    } else if (future.HasErrorCode()) {
+      auto code = future.ErrorCode();
+      for (auto &promise : promises) promise.SetError(code);
+    } else {
+      auto exception = future.Exception();
+      for (auto &promise : promises)
+        promise.SetException(std::exception_ptr(exception));
+    }
+  }
+
+  BulkLoad bulk_load_;
+  size_t max_batch_;
+  std::vector<K> keys_;
+  std::vector<Promise<V>> promises_;
+};
+
+}  // namespace nfuture
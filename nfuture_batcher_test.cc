@@ -0,0 +1,102 @@
+#include "nfuture_batcher.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using namespace nfuture;
+
+TEST(Batcher, basic) {
+  std::vector<std::vector<int>> batches;
+  Batcher<int, std::string> batcher(
+      [&batches](std::vector<int> keys) {
+        batches.push_back(keys);
+        std::vector<std::string> values;
+        for (auto key : keys) values.push_back(std::to_string(key));
+        return MakeReadyFuture<std::vector<std::string>>(std::move(values));
+      },
+      3);
+
+  auto f1 = batcher.Load(1);
+  auto f2 = batcher.Load(2);
+  EXPECT_FALSE(f1.Available());
+  EXPECT_EQ(batcher.Size(), 2);
+  // Full.
+  auto f3 = batcher.Load(3);
+  EXPECT_EQ(batcher.Size(), 0);
+  ASSERT_TRUE(f1.Ready());
+  ASSERT_TRUE(f3.Ready());
+  EXPECT_EQ(f1.Value<0>(), "1");
+  EXPECT_EQ(f2.Value<0>(), "2");
+  EXPECT_EQ(f3.Value<0>(), "3");
+
+  // A partial batch, by the end of a tick.
+  auto f4 = batcher.Load(4);
+  batcher.Flush();
+  ASSERT_TRUE(f4.Ready());
+  EXPECT_EQ(f4.Value<0>(), "4");
+  batcher.Flush();  // Nothing.
+
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[0], std::vector<int>({1, 2, 3}));
+  EXPECT_EQ(batches[1], std::vector<int>({4}));
+}
+
+TEST(Batcher, pending) {
+  Promise<std::vector<int>> promise;
+  Batcher<int, int> batcher(
+      [&promise](std::vector<int>) { return promise.GetFuture(); }, 8);
+  auto f1 = batcher.Load(1);
+  auto f2 = batcher.Load(2);
+  batcher.Flush();
+  EXPECT_FALSE(f1.Available());
+  promise.SetValue(std::vector<int>{10, 20});
+  ASSERT_TRUE(f1.Ready());
+  ASSERT_TRUE(f2.Ready());
+  EXPECT_EQ(f1.Value<0>(), 10);
+  EXPECT_EQ(f2.Value<0>(), 20);
+}
+
+TEST(Batcher, failed) {
+  const auto kTimedOut = std::make_error_code(std::errc::timed_out);
+  Batcher<int, int> batcher(
+      [&kTimedOut](std::vector<int> keys) {
+        if (keys.size() == 1)
+          return MakeReadyFuture<std::vector<int>>(std::vector<int>{});
+        return MakeErrorFuture<std::vector<int>>(kTimedOut);
+      },
+      2);
+  auto f1 = batcher.Load(1);
+  auto f2 = batcher.Load(2);
+  ASSERT_TRUE(f1.HasErrorCode());
+  ASSERT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.ErrorCode(), kTimedOut);
+
+  // Values missing.
+  auto f3 = batcher.Load(3);
+  batcher.Flush();
+  ASSERT_TRUE(f3.HasErrorCode());
+  EXPECT_EQ(f3.ErrorCode(), std::errc::bad_message);
+}
+
+constexpr int kTimes = 1000000;
+
+// Point loads served by bulk loads of 64 keys each.
+TEST(perf, batcher) {
+  constexpr int kBatch = 64;
+  static_assert(kTimes % kBatch == 0);
+  Batcher<int, int> batcher(
+      [](std::vector<int> keys) {
+        return MakeReadyFuture<std::vector<int>>(std::move(keys));
+      },
+      kBatch);
+  std::vector<Future<int>> futures;
+  futures.reserve(kBatch);
+  int counter = 0;
+  for (int i = 0; i < kTimes / kBatch; ++i) {
+    for (int j = 0; j < kBatch; ++j) futures.push_back(batcher.Load(1));
+    for (auto &future : futures) counter += future.Value<0>();
+    futures.clear();
+  }
+  EXPECT_EQ(counter, kTimes);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+// C++20 coroutine support: a function returning a Future<T...> may be a
+// coroutine, which co_awaits futures and co_returns its value.
+//
+//   Future<int> Add(Future<int> a, Future<int> b) {
+//     int x = co_await std::move(a);
+//     int y = co_await std::move(b);
+//     co_return x + y;
+//   }
+//
+// A ready future is awaited synchronously, without suspension. A failed one
+// isn't thrown into the coroutine, instead the coroutine is destroyed as if
+// unwound, and the failure is passed on to its future untouched, the same as
+// Then() skips its callback. Use `co_await Wrap(std::move(future))` to inspect
+// a failure.
+
+#include <coroutine>
+
+#include "frame_cache.h"
+#include "nfuture.h"
+
+namespace nfuture {
+
+namespace details {
+
+// The awaiter is itself the continuation. It lives in the coroutine frame, so a
+// suspension allocates nothing.
+template <class PromiseType, class... U>
+class FutureAwaiter : public ContinuationBase<U...> {
+  using Op = typename ContinuationBase<U...>::Op;
+
+ public:
+  FutureAwaiter(Future<U...> &&future, PromiseType *promise)
+      : ContinuationBase<U...>(&FutureAwaiter::Dispatch),
+        future_(std::move(future)),
+        promise_(promise) {}
+
+  bool await_ready() const { return future_.Ready(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    if (future_.Failed()) {
+      future_.Fold(std::move(*promise_));
+      handle.destroy();  // Destroys this awaiter as well.
+      return;
+    }
+    handle_ = handle;
+    SetContinuation(future_, this);
+  }
+
+  auto await_resume() {
+    auto &&value = handle_ ? std::move(this->state_).Value() : future_.Value();
+    if constexpr (sizeof...(U) == 1)
+      return std::get<0>(std::move(value));
+    else if constexpr (sizeof...(U) > 1)
+      return std::tuple<U...>(std::move(value));
+  }
+
+ private:
+  static void Dispatch(ContinuationBase<U...> *base, Op op) {
+    auto awaiter = static_cast<FutureAwaiter *>(base);
+    auto handle = awaiter->handle_;
+    if (op == Op::kRun) {
+      if (awaiter->state_.Ready()) {
+        handle.resume();
+        return;
+      }
+      std::move(awaiter->state_).ForwardFailure(*awaiter->promise_);
+    }
+    // Failed, or abandoned by the producer, in which case the coroutine will
+    // never be resumed, so is its future never resolved.
+    handle.destroy();
+  }
+
+  Future<U...> future_;
+  PromiseType *promise_;
+  std::coroutine_handle<> handle_;
+};
+
+template <class... U>
+class WrapAwaiter : public ContinuationBase<U...> {
+  using Op = typename ContinuationBase<U...>::Op;
+
+ public:
+  explicit WrapAwaiter(Future<U...> &&future)
+      : ContinuationBase<U...>(&WrapAwaiter::Dispatch),
+        future_(std::move(future)) {}
+
+  bool await_ready() const { return future_.Available(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    SetContinuation(future_, this);
+  }
+
+  Future<U...> await_resume() {
+    if (!handle_) return std::move(future_);
+    if (this->state_.Failed())
+      return MakeFailedFuture<Future<U...>>(std::move(this->state_));
+    return MakeReadyFuture<U...>(std::move(this->state_).Value());
+  }
+
+ private:
+  static void Dispatch(ContinuationBase<U...> *base, Op op) {
+    auto awaiter = static_cast<WrapAwaiter *>(base);
+    if (op == Op::kRun)
+      awaiter->handle_.resume();
+    else
+      awaiter->handle_.destroy();
+  }
+
+  Future<U...> future_;
+  std::coroutine_handle<> handle_;
+};
+
+template <class... T>
+class CoroutinePromiseBase {
+ public:
+  Future<T...> get_return_object() { return promise_.GetFuture(); }
+
+  // Frames are recycled by a thread-local cache, as coroutines are invoked at a
+  // high rate with only a few sizes of frames.
+  static void *operator new(std::size_t size) {
+    return internal::FrameCache::Local().Allocate(size);
+  }
+
+  static void operator delete(void *p, std::size_t size) {
+    internal::FrameCache::Local().Deallocate(p, size);
+  }
+
+  std::suspend_never initial_suspend() noexcept { return {}; }
+
+  // The frame is destroyed right after the future is resolved.
+  std::suspend_never final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() {
+    promise_.SetException(std::current_exception());
+  }
+
+  // Fails the coroutine's future, as a failure is passed on by an awaiter.
+  void SetException(std::exception_ptr &&exception) {
+    promise_.SetException(std::move(exception));
+  }
+
+  void SetError(std::error_code code) { promise_.SetError(code); }
+
+  template <class... U>
+  FutureAwaiter<Promise<T...>, U...> await_transform(Future<U...> &&future) {
+    return {std::move(future), &promise_};
+  }
+
+  // A future should be moved to be awaited, as it's consumed.
+  template <class... U>
+  void await_transform(Future<U...> &future) = delete;
+
+  template <class Awaitable>
+  Awaitable &&await_transform(Awaitable &&awaitable) {
+    return std::forward<Awaitable>(awaitable);
+  }
+
+ protected:
+  Promise<T...> promise_;
+};
+
+template <class... T>
+class CoroutinePromise : public CoroutinePromiseBase<T...> {
+ public:
+  void return_value(std::tuple<T...> &&value) {
+    this->promise_.SetValue(std::move(value));
+  }
+
+  // Returning a future chains it, as returning one from a Then() callback.
+  void return_value(Future<T...> &&future) {
+    future.Fold(std::move(this->promise_));
+  }
+};
+
+template <class T>
+class CoroutinePromise<T> : public CoroutinePromiseBase<T> {
+ public:
+  template <class U = T>
+  void return_value(U &&value) {
+    this->promise_.SetValue(std::forward<U>(value));
+  }
+
+  void return_value(Future<T> &&future) {
+    future.Fold(std::move(this->promise_));
+  }
+};
+
+template <>
+class CoroutinePromise<> : public CoroutinePromiseBase<> {
+ public:
+  void return_void() { promise_.SetValue(); }
+};
+
+}  // namespace details
+
+// Awaits `future` without consuming its result, so that a failure is
+// inspected rather than passed on.
+template <class... U>
+details::WrapAwaiter<U...> Wrap(Future<U...> &&future) {
+  return details::WrapAwaiter<U...>(std::move(future));
+}
+
+}  // namespace nfuture
+
+template <class... T, class... Args>
+struct std::coroutine_traits<nfuture::Future<T...>, Args...> {
+  using promise_type = nfuture::details::CoroutinePromise<T...>;
+};
@@ -0,0 +1,487 @@
+#pragma once
+
+// Lazy pipelines. A Future runs its continuations eagerly, so every Then() on
+// a pending future allocates a continuation. A sender, however, only describes
+// the work: nothing runs or allocates until it's started, and the whole
+// pipeline is fused into a single operation state of a static type.
+//
+//   auto future = lazy::ToFuture(lazy::Just(1) |
+//                                lazy::Then([](int v) { return v + 1; }) |
+//                                lazy::Then([](int v) { return v * 2; }));
+//
+// A sender is connected to a receiver, which is anything with SetValue(),
+// SetException() and SetError() as a Promise has, into an operation state. The
+// operation state is started by Start(), and should stay in place until the
+// receiver is completed, so it's neither copyable nor movable.
+//
+// Futures come in by FromFuture(), or by a Then() callback returning one, and
+// go out by ToFuture(), which allocates once for the whole pipeline unless it
+// completes synchronously, or by co_await in a coroutine, which allocates
+// nothing at all.
+
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "nfuture.h"
+
+#if __cpp_impl_coroutine
+#include "nfuture_coroutine.h"
+#endif
+
+namespace nfuture {
+
+namespace lazy {
+
+namespace details {
+
+using nfuture::details::ContinuationBase;
+using nfuture::details::FutureState;
+using nfuture::details::IsFuture_v;
+
+template <class Receiver, class = void>
+constexpr bool HasAbandon_v = false;
+
+template <class Receiver>
+constexpr bool HasAbandon_v<
+    Receiver, std::void_t<decltype(std::declval<Receiver &>().Abandon())>> =
+    true;
+
+// Tells `receiver` that it will never be completed, if it cares.
+template <class Receiver>
+void Abandon(Receiver &receiver) {
+  if constexpr (HasAbandon_v<Receiver>) receiver.Abandon();
+}
+
+template <class R>
+struct ValueTypeOf {
+  using type = std::tuple<R>;
+};
+
+template <>
+struct ValueTypeOf<void> {
+  using type = std::tuple<>;
+};
+
+template <class... T>
+struct ValueTypeOf<Future<T...>> {
+  using type = std::tuple<T...>;
+};
+
+template <class ValueType>
+struct FutureOf;
+
+template <class... T>
+struct FutureOf<std::tuple<T...>> {
+  using type = Future<T...>;
+};
+
+template <class ValueType>
+using FutureOf_t = typename FutureOf<ValueType>::type;
+
+// A tag for operator| and co_await to recognize senders.
+struct SenderBase {};
+
+template <class Sender>
+constexpr bool IsSender_v =
+    std::is_base_of_v<SenderBase, internal::RemoveCVRef_t<Sender>>;
+
+// Delivers the result of a future to `receiver`. It's the continuation of the
+// future if it's pending, living inside the operation state.
+template <class Receiver, class... T>
+class FutureBridge : public ContinuationBase<T...> {
+  using Op = typename ContinuationBase<T...>::Op;
+
+ public:
+  FutureBridge() : ContinuationBase<T...>(&FutureBridge::Dispatch) {}
+
+  // Only an idle bridge is moved, while the pipeline is being connected.
+  FutureBridge(FutureBridge &&other) : FutureBridge() {
+    assert(!other.receiver_);
+  }
+
+  FutureBridge &operator=(const FutureBridge &) = delete;
+
+  void Await(Future<T...> &&future, Receiver *receiver) {
+    if (future.Ready()) {
+      std::apply(
+          [receiver](T &&...value) { receiver->SetValue(std::move(value)...); },
+          future.Value());
+    } else if (future.HasErrorCode()) {
+      receiver->SetError(future.ErrorCode());
+    } else if (future.Failed()) {
+      receiver->SetException(future.Exception());
+    } else {
+      receiver_ = receiver;
+      nfuture::details::SetContinuation(future, this);
+    }
+  }
+
+ private:
+  static void Dispatch(ContinuationBase<T...> *base, Op op) {
+    auto bridge = static_cast<FutureBridge *>(base);
+    auto receiver = bridge->receiver_;
+    if (op == Op::kDestroy) {
+      Abandon(*receiver);
+    } else if (bridge->state_.Ready()) {
+      std::apply(
+          [receiver](T &&...value) { receiver->SetValue(std::move(value)...); },
+          std::move(bridge->state_).Value());
+    } else {
+      std::move(bridge->state_).ForwardFailure(*receiver);
+    }
+  }
+
+  Receiver *receiver_ = nullptr;
+};
+
+template <class... T>
+class JustSender : public SenderBase {
+ public:
+  using ValueType = std::tuple<T...>;
+  static constexpr bool kSynchronous = true;
+
+  template <class Receiver>
+  class Operation {
+   public:
+    Operation(std::tuple<T...> &&values, Receiver &&receiver)
+        : values_(std::move(values)), receiver_(std::move(receiver)) {}
+
+    Operation(const Operation &) = delete;
+    Operation &operator=(const Operation &) = delete;
+
+    void Start() {
+      std::apply(
+          [this](T &&...value) { receiver_.SetValue(std::move(value)...); },
+          std::move(values_));
+    }
+
+   private:
+    std::tuple<T...> values_;
+    Receiver receiver_;
+  };
+
+  explicit JustSender(std::tuple<T...> &&values) : values_(std::move(values)) {}
+
+  template <class Receiver>
+  Operation<Receiver> Connect(Receiver &&receiver) && {
+    return Operation<Receiver>(std::move(values_), std::move(receiver));
+  }
+
+ private:
+  std::tuple<T...> values_;
+};
+
+template <class... T>
+class FutureSender : public SenderBase {
+ public:
+  using ValueType = std::tuple<T...>;
+  static constexpr bool kSynchronous = false;
+
+  template <class Receiver>
+  class Operation {
+   public:
+    Operation(Future<T...> &&future, Receiver &&receiver)
+        : future_(std::move(future)), receiver_(std::move(receiver)) {}
+
+    Operation(const Operation &) = delete;
+    Operation &operator=(const Operation &) = delete;
+
+    void Start() { bridge_.Await(std::move(future_), &receiver_); }
+
+   private:
+    Future<T...> future_;
+    Receiver receiver_;
+    FutureBridge<Receiver, T...> bridge_;
+  };
+
+  explicit FutureSender(Future<T...> &&future) : future_(std::move(future)) {}
+
+  template <class Receiver>
+  Operation<Receiver> Connect(Receiver &&receiver) && {
+    return Operation<Receiver>(std::move(future_), std::move(receiver));
+  }
+
+ private:
+  Future<T...> future_;
+};
+
+struct Empty {};
+
+template <class Receiver, class R>
+struct BridgeFor {
+  using type = Empty;
+};
+
+template <class Receiver, class... T>
+struct BridgeFor<Receiver, Future<T...>> {
+  using type = FutureBridge<Receiver, T...>;
+};
+
+// Invokes the callback with the value, and passes a failure on untouched, the
+// same as Future::Then(). A future returned by the callback is awaited in
+// place.
+template <class Function, class Receiver, class R>
+class ThenReceiver {
+ public:
+  ThenReceiver(Function &&function, Receiver &&receiver)
+      : function_(std::move(function)), receiver_(std::move(receiver)) {}
+
+  template <class... U>
+  void SetValue(U &&...value) {
+    if constexpr (IsFuture_v<R>) {
+      bridge_.Await(std::invoke(function_, std::forward<U>(value)...),
+                    &receiver_);
+    } else if constexpr (std::is_void_v<R>) {
+      std::invoke(function_, std::forward<U>(value)...);
+      receiver_.SetValue();
+    } else {
+      receiver_.SetValue(std::invoke(function_, std::forward<U>(value)...));
+    }
+  }
+
+  void SetException(std::exception_ptr &&exception) {
+    receiver_.SetException(std::move(exception));
+  }
+
+  void SetError(std::error_code code) { receiver_.SetError(code); }
+
+  void Abandon() { details::Abandon(receiver_); }
+
+ private:
+  Function function_;
+  Receiver receiver_;
+  typename BridgeFor<Receiver, R>::type bridge_;
+};
+
+template <class Sender, class Function>
+class ThenSender : public SenderBase {
+  using R = internal::ApplyResultType<Function, typename Sender::ValueType>;
+
+ public:
+  using ValueType = typename ValueTypeOf<R>::type;
+  static constexpr bool kSynchronous = Sender::kSynchronous && !IsFuture_v<R>;
+
+  ThenSender(Sender &&sender, Function &&function)
+      : sender_(std::move(sender)), function_(std::move(function)) {}
+
+  template <class Receiver>
+  auto Connect(Receiver &&receiver) && {
+    return std::move(sender_).Connect(ThenReceiver<Function, Receiver, R>(
+        std::move(function_), std::move(receiver)));
+  }
+
+ private:
+  Sender sender_;
+  Function function_;
+};
+
+template <class Function>
+struct ThenAdaptor {
+  Function function;
+};
+
+template <class Sender, class Function,
+          class = std::enable_if_t<IsSender_v<Sender>>>
+ThenSender<internal::RemoveCVRef_t<Sender>, Function> operator|(
+    Sender &&sender, ThenAdaptor<Function> &&adaptor) {
+  return {std::forward<Sender>(sender), std::move(adaptor.function)};
+}
+
+// Owns a started operation which outlives its starter, and releases it when
+// the operation is done.
+template <class Sender>
+class HeapOperation
+    : public internal::Allocated<internal::AllocSite::kContinuation> {
+  using PromiseType = typename FutureOf_t<typename Sender::ValueType>::PromiseType;
+
+  class Receiver {
+   public:
+    Receiver(HeapOperation *owner, PromiseType &&promise)
+        : owner_(owner), promise_(std::move(promise)) {}
+
+    template <class... U>
+    void SetValue(U &&...value) {
+      promise_.SetValue(std::forward<U>(value)...);
+      delete owner_;
+    }
+
+    void SetException(std::exception_ptr &&exception) {
+      promise_.SetException(std::move(exception));
+      delete owner_;
+    }
+
+    void SetError(std::error_code code) {
+      promise_.SetError(code);
+      delete owner_;
+    }
+
+    void Abandon() { delete owner_; }
+
+   private:
+    HeapOperation *owner_;
+    PromiseType promise_;
+  };
+
+ public:
+  HeapOperation(Sender &&sender, PromiseType &&promise)
+      : operation_(std::move(sender).Connect(Receiver(this, std::move(promise)))) {}
+
+  void Start() { operation_.Start(); }
+
+ private:
+  decltype(std::declval<Sender>().Connect(std::declval<Receiver>())) operation_;
+};
+
+#if __cpp_impl_coroutine
+
+// Awaits a sender in a coroutine returning a future, with its operation state
+// in the coroutine frame. Same as awaiting a future, a failure is passed on to
+// the coroutine's future, and the coroutine is destroyed.
+template <class Sender>
+class SenderAwaiter {
+  template <class ValueType>
+  struct StateOf;
+
+  template <class... T>
+  struct StateOf<std::tuple<T...>> {
+    using type = FutureState<T...>;
+  };
+
+  using StateType = typename StateOf<typename Sender::ValueType>::type;
+
+  class Receiver {
+   public:
+    explicit Receiver(SenderAwaiter *awaiter) : awaiter_(awaiter) {}
+
+    template <class... U>
+    void SetValue(U &&...value) {
+      awaiter_->state_.SetValue(std::forward<U>(value)...);
+      awaiter_->Complete();
+    }
+
+    void SetException(std::exception_ptr &&exception) {
+      awaiter_->state_.SetException(std::move(exception));
+      awaiter_->Complete();
+    }
+
+    void SetError(std::error_code code) {
+      awaiter_->state_.SetError(code);
+      awaiter_->Complete();
+    }
+
+    void Abandon() { awaiter_->handle_.destroy(); }
+
+   private:
+    SenderAwaiter *awaiter_;
+  };
+
+ public:
+  explicit SenderAwaiter(Sender &&sender)
+      : operation_(std::move(sender).Connect(Receiver(this))) {}
+
+  bool await_ready() const { return false; }
+
+  template <class PromiseType>
+  bool await_suspend(std::coroutine_handle<PromiseType> handle) {
+    handle_ = handle;
+    fail_ = [](std::coroutine_handle<> handle, StateType &&state) {
+      std::move(state).ForwardFailure(
+          std::coroutine_handle<PromiseType>::from_address(handle.address())
+              .promise());
+      handle.destroy();
+    };
+    operation_.Start();
+    if (!state_.Available()) {
+      suspended_ = true;
+      return true;
+    }
+    if (state_.Ready()) return false;  // Resumes without a hop.
+    fail_(handle_, std::move(state_));
+    return true;
+  }
+
+  auto await_resume() {
+    auto &&value = std::move(state_).Value();
+    if constexpr (std::tuple_size_v<typename Sender::ValueType> == 1)
+      return std::get<0>(std::move(value));
+    else if constexpr (std::tuple_size_v<typename Sender::ValueType> > 1)
+      return typename Sender::ValueType(std::move(value));
+  }
+
+ private:
+  // Completed asynchronously, otherwise it's left to await_suspend().
+  void Complete() {
+    if (!suspended_) return;
+    if (state_.Ready())
+      handle_.resume();
+    else
+      fail_(handle_, std::move(state_));
+  }
+
+  decltype(std::declval<Sender>().Connect(std::declval<Receiver>())) operation_;
+  StateType state_;
+  std::coroutine_handle<> handle_;
+  void (*fail_)(std::coroutine_handle<>, StateType &&) = nullptr;
+  bool suspended_ = false;
+};
+
+template <class Sender, class = std::enable_if_t<IsSender_v<Sender>>>
+SenderAwaiter<internal::RemoveCVRef_t<Sender>> operator co_await(
+    Sender &&sender) {
+  return SenderAwaiter<internal::RemoveCVRef_t<Sender>>(std::move(sender));
+}
+
+#endif  // __cpp_impl_coroutine
+
+}  // namespace details
+
+// A sender of `values`.
+template <class... T, class... U>
+details::JustSender<T...> Just(U &&...values) {
+  return details::JustSender<T...>(
+      std::tuple<T...>(std::forward<U>(values)...));
+}
+
+template <class T>
+details::JustSender<std::decay_t<T>> Just(T &&value) {
+  return details::JustSender<std::decay_t<T>>(
+      std::tuple<std::decay_t<T>>(std::forward<T>(value)));
+}
+
+// A sender of the result of `future`.
+template <class... T>
+details::FutureSender<T...> FromFuture(Future<T...> &&future) {
+  return details::FutureSender<T...>(std::move(future));
+}
+
+// Pipes a sender into `function`, e.g. `sender | Then(function)`, which is
+// invoked as a Future::Then() callback is.
+template <class Function>
+details::ThenAdaptor<std::decay_t<Function>> Then(Function &&function) {
+  return {std::forward<Function>(function)};
+}
+
+// Starts `sender`, with its result delivered to the returned future. A
+// pipeline known to complete synchronously runs on the stack, otherwise its
+// operation state is allocated once.
+template <class Sender>
+auto ToFuture(Sender &&sender) {
+  using S = internal::RemoveCVRef_t<Sender>;
+  using FutureType = details::FutureOf_t<typename S::ValueType>;
+  typename FutureType::PromiseType promise;
+  auto future = promise.GetFuture();
+  if constexpr (S::kSynchronous) {
+    auto operation = S(std::move(sender)).Connect(std::move(promise));
+    operation.Start();
+  } else {
+    (new details::HeapOperation<S>(std::move(sender), std::move(promise)))
+        ->Start();
+  }
+  return future;
+}
+
+}  // namespace lazy
+
+}  // namespace nfuture
@@ -0,0 +1,161 @@
+#include "nfuture_lazy.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+using namespace nfuture;
+
+namespace {
+
+const std::error_code kTimedOut = std::make_error_code(std::errc::timed_out);
+
+}  // namespace
+
+TEST(Lazy, Just) {
+  auto future = lazy::ToFuture(lazy::Just(1));
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), 1);
+
+  auto f2 = lazy::ToFuture(lazy::Just<int, bool>(1, true));
+  ASSERT_TRUE(f2.Ready());
+  EXPECT_EQ(f2.Value(), std::make_tuple(1, true));
+
+  EXPECT_TRUE(lazy::ToFuture(lazy::Just()).Ready());
+}
+
+TEST(Lazy, Then) {
+  int counter = 0;
+  auto sender = lazy::Just(1) | lazy::Then([&counter](int v) {
+                  ++counter;
+                  return v + 1;
+                }) |
+                lazy::Then([&counter](int v) {
+                  ++counter;
+                  EXPECT_EQ(v, 2);
+                });
+  static_assert(decltype(sender)::kSynchronous);
+  // Nothing runs until started.
+  EXPECT_EQ(counter, 0);
+
+  auto future = lazy::ToFuture(std::move(sender));
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, 2);
+}
+
+TEST(Lazy, FromFuture) {
+  Promise<int> promise;
+  auto future = lazy::ToFuture(lazy::FromFuture(promise.GetFuture()) |
+                               lazy::Then([](int v) { return v + 1; }));
+  ASSERT_FALSE(future.Available());
+  promise.SetValue(1);
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), 2);
+
+  // A failure skips the callbacks.
+  Promise<int> p2;
+  auto f2 = lazy::ToFuture(lazy::FromFuture(p2.GetFuture()) |
+                           lazy::Then([](int v) {
+                             ADD_FAILURE();
+                             return v;
+                           }));
+  p2.SetError(kTimedOut);
+  ASSERT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.ErrorCode(), kTimedOut);
+}
+
+TEST(Lazy, then_future) {
+  Promise<> promise;
+  auto sender = lazy::Just(1) | lazy::Then([&promise](int v) {
+                  return promise.GetFuture().Then([v]() { return v + 1; });
+                }) |
+                lazy::Then([](int v) { return v * 2; });
+  static_assert(!decltype(sender)::kSynchronous);
+  auto future = lazy::ToFuture(std::move(sender));
+  ASSERT_FALSE(future.Available());
+  promise.SetValue();
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), 4);
+
+  auto f2 = lazy::ToFuture(lazy::Just() | lazy::Then([]() {
+                             return MakeExceptionalFuture<int>(
+                                 std::make_exception_ptr("test"));
+                           }));
+  ASSERT_TRUE(f2.Failed());
+  EXPECT_THROW(std::rethrow_exception(f2.Exception()), const char *);
+}
+
+TEST(Lazy, abandoned) {
+  auto promise = std::make_unique<Promise<int>>();
+  auto future = lazy::ToFuture(lazy::FromFuture(promise->GetFuture()) |
+                               lazy::Then([](int v) { return v; }));
+  // The operation state is released, and the future is never resolved.
+  promise.reset();
+  EXPECT_FALSE(future.Available());
+}
+
+#if __cpp_impl_coroutine
+
+TEST(Lazy, co_await) {
+  Promise<int> promise;
+  auto future = [](Future<int> f) -> Future<int> {
+    int v = co_await (lazy::FromFuture(std::move(f)) |
+                      lazy::Then([](int v) { return v + 1; }));
+    auto [x, y] = co_await lazy::Just<int, int>(v, 1);
+    co_return x + y;
+  }(promise.GetFuture());
+  ASSERT_FALSE(future.Available());
+  promise.SetValue(1);
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), 3);
+
+  auto f2 = []() -> Future<int> {
+    co_await (lazy::Just() |
+              lazy::Then([]() { return MakeErrorFuture<>(kTimedOut); }));
+    ADD_FAILURE();
+    co_return 0;
+  }();
+  ASSERT_TRUE(f2.HasErrorCode());
+}
+
+#endif  // __cpp_impl_coroutine
+
+constexpr int kTimes = 1000000;
+
+// Compare to perf.ready_then3 of nfuture_test.
+TEST(perf, lazy_then) {
+  int counter = 0;
+  for (int i = 0; i < kTimes / 10; ++i) {
+    auto future = lazy::ToFuture(
+        lazy::Just(0) | lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }) |
+        lazy::Then([&](int v) { return ++counter, v + 1; }));
+    ASSERT_EQ(future.Value<0>(), 10);
+  }
+  ASSERT_EQ(counter, kTimes);
+}
+
+// Compare to perf.unready_then of nfuture_test.
+TEST(perf, lazy_unready_then) {
+  int counter = 0;
+  for (int i = 0; i < kTimes / 10; ++i) {
+    Promise<> promise;
+    auto future = lazy::ToFuture(
+        lazy::FromFuture(promise.GetFuture()) | lazy::Then([&]() { ++counter; }) |
+        lazy::Then([&]() { ++counter; }) | lazy::Then([&]() { ++counter; }) |
+        lazy::Then([&]() { ++counter; }) | lazy::Then([&]() { ++counter; }) |
+        lazy::Then([&]() { ++counter; }) | lazy::Then([&]() { ++counter; }) |
+        lazy::Then([&]() { ++counter; }) | lazy::Then([&]() { ++counter; }) |
+        lazy::Then([&]() { ++counter; }));
+    promise.SetValue();
+    ASSERT_TRUE(future.Ready());
+  }
+  ASSERT_EQ(counter, kTimes);
+}
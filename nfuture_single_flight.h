@@ -0,0 +1,177 @@
+#pragma once
+
+// Request coalescing. Concurrent Get()s of the same key share a single load,
+// so a cold key hit by a herd of requests is loaded once:
+//
+//   SingleFlight<std::string, Response> flight(1024, std::chrono::seconds(1));
+//   auto shared = flight.Get(key, [&]() { return backend.Fetch(key); });
+//   shared.GetFuture().Then(...);
+//
+// The pending load is kept in the map entry as a SharedFuture, so a joining
+// Get() costs a reference count, and its waiter is kept inline by the shared
+// state. Optionally, loaded values are kept for a while as well, in an LRU
+// bounded by the number of keys. A failed load is never kept, so the next
+// Get() tries again.
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "nfuture.h"
+
+namespace nfuture {
+
+// Not thread-safe, the same as the futures. A pending load refers back to its
+// SingleFlight once done, so the SingleFlight should outlive its loads.
+template <class K, class T, class Hash = std::hash<K>,
+          class KeyEqual = std::equal_to<K>>
+class SingleFlight {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Coalesces pending loads only.
+  SingleFlight() = default;
+
+  // Keeps up to `capacity` loaded values, each for `ttl`, evicting the least
+  // recently used one beyond that.
+  SingleFlight(size_t capacity, Clock::duration ttl)
+      : capacity_(capacity), ttl_(ttl) {}
+
+  SingleFlight(const SingleFlight &) = delete;
+  SingleFlight &operator=(const SingleFlight &) = delete;
+
+  // Joins the pending load of `key`, or hits the kept value, or otherwise
+  // starts a load by `loader()`, which returns a Future<T> or a T.
+  template <class Loader>
+  SharedFuture<T> Get(const K &key, Loader &&loader) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      auto &entry = it->second;
+      if (!entry.cached) return entry.future;
+      if (Clock::now() < entry.expiry) {
+        Unlink(&entry);
+        LinkFront(&entry);
+        return entry.future;
+      }
+      Erase(it);  // Expired.
+    }
+    return Load(key, std::forward<Loader>(loader));
+  }
+
+  // Drops the kept value of `key`, or detaches its pending load, which then
+  // completes as usual for those who already joined it, while the next Get()
+  // starts another. That's also the way out of a load abandoned by its
+  // producer, which is pending forever.
+  void Forget(const K &key) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) Erase(it);
+  }
+
+  size_t Pending() const { return entries_.size() - cached_; }
+
+  size_t Cached() const { return cached_; }
+
+ private:
+  struct Entry {
+    Entry(SharedFuture<T> &&future, uint64_t load)
+        : future(std::move(future)), load(load) {}
+
+    SharedFuture<T> future;
+    // Tells a pending load from a later one of the same key.
+    uint64_t load;
+    bool cached = false;
+    Clock::time_point expiry;
+    // The LRU, most recent first, linked through the entries, which stay in
+    // place in the map.
+    Entry *prev = nullptr;
+    Entry *next = nullptr;
+    const K *key = nullptr;
+  };
+
+  using Map = std::unordered_map<K, Entry, Hash, KeyEqual>;
+
+  template <class Loader>
+  SharedFuture<T> Load(const K &key, Loader &&loader) {
+    auto future = FuturizeInvoke(std::forward<Loader>(loader));
+    static_assert(std::is_same_v<decltype(future), Future<T>>,
+                  "Loader should return a Future<T> or a T.");
+    if (future.Available()) {
+      auto shared = future.Share();
+      if (shared.Ready() && capacity_ > 0)
+        Keep(entries_.emplace(key, Entry(SharedFuture<T>(shared), 0)).first);
+      return shared;
+    }
+
+    auto load = ++loads_;
+    auto shared = future
+                      .ThenWrap([this, key, load](Future<T> &&future) {
+                        Complete(key, load, future.Ready());
+                        return std::move(future);
+                      })
+                      .Share();
+    entries_.emplace(key, Entry(SharedFuture<T>(shared), load));
+    return shared;
+  }
+
+  // Runs before the result is passed on to the waiters.
+  void Complete(const K &key, uint64_t load, bool ready) {
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.load != load) return;  // Forgotten.
+    if (ready && capacity_ > 0)
+      Keep(it);
+    else
+      entries_.erase(it);
+  }
+
+  void Keep(typename Map::iterator it) {
+    auto &entry = it->second;
+    entry.cached = true;
+    entry.expiry = Clock::now() + ttl_;
+    entry.key = &it->first;
+    LinkFront(&entry);
+    if (++cached_ > capacity_) Erase(entries_.find(*tail_->key));
+  }
+
+  void Erase(typename Map::iterator it) {
+    auto &entry = it->second;
+    if (entry.cached) {
+      Unlink(&entry);
+      --cached_;
+    }
+    entries_.erase(it);
+  }
+
+  void LinkFront(Entry *entry) {
+    entry->prev = nullptr;
+    entry->next = head_;
+    if (head_)
+      head_->prev = entry;
+    else
+      tail_ = entry;
+    head_ = entry;
+  }
+
+  void Unlink(Entry *entry) {
+    if (entry->prev)
+      entry->prev->next = entry->next;
+    else
+      head_ = entry->next;
+    if (entry->next)
+      entry->next->prev = entry->prev;
+    else
+      tail_ = entry->prev;
+  }
+
+  Map entries_;
+  size_t capacity_ = 0;
+  Clock::duration ttl_{};
+  size_t cached_ = 0;
+  uint64_t loads_ = 0;
+  Entry *head_ = nullptr;
+  Entry *tail_ = nullptr;
+};
+
+}  // namespace nfuture
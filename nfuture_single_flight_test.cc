@@ -0,0 +1,115 @@
+#include "nfuture_single_flight.h"
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+using namespace nfuture;
+
+TEST(SingleFlight, coalesce) {
+  SingleFlight<int, std::string> flight;
+  int loads = 0;
+  Promise<std::string> promise;
+  auto loader = [&]() {
+    ++loads;
+    return promise.GetFuture();
+  };
+  auto s1 = flight.Get(1, loader);
+  auto s2 = flight.Get(1, loader);
+  EXPECT_EQ(loads, 1);
+  EXPECT_EQ(flight.Pending(), 1);
+
+  auto f1 = s1.GetFuture();
+  auto f2 = s2.GetFuture();
+  promise.SetValue("a");
+  ASSERT_TRUE(f1.Ready());
+  ASSERT_TRUE(f2.Ready());
+  EXPECT_EQ(f2.Value<0>(), "a");
+  // Nothing kept.
+  EXPECT_EQ(flight.Pending(), 0);
+  EXPECT_EQ(flight.Cached(), 0);
+
+  auto s3 = flight.Get(1, []() { return std::string("b"); });
+  EXPECT_EQ(s3.ValueRef<0>(), "b");
+}
+
+TEST(SingleFlight, failed) {
+  SingleFlight<int, int> flight(8, std::chrono::hours(1));
+  Promise<int> promise;
+  auto s1 = flight.Get(1, [&]() { return promise.GetFuture(); });
+  promise.SetError(std::make_error_code(std::errc::timed_out));
+  EXPECT_TRUE(s1.Failed());
+  // Never kept, loaded again.
+  EXPECT_EQ(flight.Cached(), 0);
+  auto s2 = flight.Get(1, []() { return 2; });
+  EXPECT_EQ(s2.ValueRef<0>(), 2);
+  EXPECT_EQ(flight.Cached(), 1);
+}
+
+TEST(SingleFlight, lru) {
+  SingleFlight<int, int> flight(2, std::chrono::hours(1));
+  int loads = 0;
+  auto loader = [&loads]() { return ++loads; };
+  flight.Get(1, loader);
+  flight.Get(2, loader);
+  EXPECT_EQ(flight.Get(1, loader).ValueRef<0>(), 1);
+  // Evicts 2, the least recently used.
+  flight.Get(3, loader);
+  EXPECT_EQ(flight.Cached(), 2);
+  EXPECT_EQ(flight.Get(1, loader).ValueRef<0>(), 1);
+  EXPECT_EQ(flight.Get(3, loader).ValueRef<0>(), 3);
+  EXPECT_EQ(flight.Get(2, loader).ValueRef<0>(), 4);
+  EXPECT_EQ(loads, 4);
+
+  flight.Forget(2);
+  EXPECT_EQ(flight.Cached(), 1);
+  EXPECT_EQ(flight.Get(2, loader).ValueRef<0>(), 5);
+}
+
+TEST(SingleFlight, ttl) {
+  SingleFlight<int, int> flight(8, std::chrono::milliseconds(1));
+  int loads = 0;
+  auto loader = [&loads]() { return ++loads; };
+  flight.Get(1, loader);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  EXPECT_EQ(flight.Get(1, loader).ValueRef<0>(), 2);
+}
+
+TEST(SingleFlight, forget_pending) {
+  SingleFlight<int, int> flight(8, std::chrono::hours(1));
+  Promise<int> p1;
+  auto s1 = flight.Get(1, [&]() { return p1.GetFuture(); });
+  flight.Forget(1);
+  EXPECT_EQ(flight.Pending(), 0);
+
+  Promise<int> p2;
+  auto s2 = flight.Get(1, [&]() { return p2.GetFuture(); });
+  // The detached load doesn't touch the later one.
+  p1.SetValue(1);
+  EXPECT_EQ(s1.ValueRef<0>(), 1);
+  EXPECT_EQ(flight.Pending(), 1);
+  p2.SetValue(2);
+  EXPECT_EQ(flight.Get(1, []() { return 0; }).ValueRef<0>(), 2);
+}
+
+constexpr int kTimes = 1000000;
+
+// A herd of ten on each cold key.
+TEST(perf, single_flight) {
+  SingleFlight<int, int> flight;
+  int counter = 0;
+  for (int i = 0; i < kTimes / 10; ++i) {
+    Promise<int> promise;
+    int sum = 0;
+    for (int j = 0; j < 10; ++j) {
+      flight.Get(i, [&promise]() { return promise.GetFuture(); })
+          .GetFuture()
+          .Then([&sum](int v) { sum += v; })
+          .Ignore();
+    }
+    promise.SetValue(1);
+    counter += sum;
+  }
+  EXPECT_EQ(counter, kTimes);
+}
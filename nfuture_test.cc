@@ -1,6 +1,11 @@
 #include "nfuture.h"
 
+#include <cstdint>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -94,6 +99,320 @@ TEST(Future, basic1) {
   ASSERT_EQ(counter, 3);
 }
 
+TEST(Future, Fold) {
+  {
+    Promise<int> promise;
+    auto future = promise.GetFuture();
+    MakeReadyFuture<int>(1).Fold(std::move(promise));
+    EXPECT_TRUE(future.Ready());
+    EXPECT_EQ(future.Value<0>(), 1);
+  }
+  {
+    Promise<int> promise;
+    auto future = promise.GetFuture();
+    MakeExceptionalFuture<int>(std::make_exception_ptr(0.1f))
+        .Fold(std::move(promise));
+    EXPECT_TRUE(future.Failed());
+    EXPECT_THROW(std::rethrow_exception(future.Exception()), float);
+  }
+  {
+    Promise<int> inner;
+    Promise<int> outer;
+    auto future = outer.GetFuture();
+    inner.GetFuture().Fold(std::move(outer));
+    EXPECT_FALSE(future.Available());
+    inner.SetValue(2);
+    EXPECT_TRUE(future.Ready());
+    EXPECT_EQ(future.Value<0>(), 2);
+  }
+}
+
+namespace {
+
+// Every level waits for `pending` and then calls itself in the callback.
+Future<> AsyncLoop(int n, int &counter, Promise<> *&pending) {
+  delete std::exchange(pending, nullptr);
+  if (n == 0) return MakeReadyFuture<>();
+  pending = new Promise<>();
+  return pending->GetFuture().Then([n, &counter, &pending]() {
+    ++counter;
+    return AsyncLoop(n - 1, counter, pending);
+  });
+}
+
+}  // namespace
+
+TEST(Future, tail_call) {
+  int counter = 0;
+  Promise<> *pending = nullptr;
+  auto future = AsyncLoop(100, counter, pending);
+  EXPECT_FALSE(future.Available());
+  while (pending) pending->SetValue();
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, 100);
+}
+
+namespace {
+
+// Neither default-constructible nor copyable.
+class Payload {
+ public:
+  explicit Payload(int value) : value_(value) { ++live; }
+  Payload(Payload &&other) : value_(other.value_) { ++live; }
+  Payload &operator=(Payload &&) = default;
+  ~Payload() { --live; }
+
+  int value() const { return value_; }
+
+  static inline int live = 0;
+
+ private:
+  int value_;
+};
+
+}  // namespace
+
+TEST(Promise, Rearm) {
+  Promise<int> promise;
+  int sum = 0;
+  for (int i = 0; i < 3; ++i) {
+    auto future = promise.Rearm().Then([&sum](int v) { sum += v; });
+    EXPECT_FALSE(future.Available());
+    promise.SetValue(i);
+    EXPECT_TRUE(future.Ready());
+  }
+  EXPECT_EQ(sum, 0 + 1 + 2);
+
+  // The previous future keeps its result.
+  auto f1 = promise.Rearm();
+  promise.SetValue(1);
+  auto f2 = promise.Rearm();
+  promise.SetValue(2);
+  EXPECT_EQ(f1.Value<0>(), 1);
+  EXPECT_EQ(f2.Value<0>(), 2);
+}
+
+// Of a future still around, whose result the continuation consumed.
+TEST(Promise, Rearm_after_then) {
+  Promise<int> p;
+  int value = 0;
+  auto f = p.GetFuture();
+  auto g = f.Then([&value](int v) { value = v; });
+  p.SetValue(1);
+  EXPECT_TRUE(g.Ready());
+  EXPECT_EQ(value, 1);
+
+  auto h = p.Rearm();
+  EXPECT_FALSE(h.Available());
+  p.SetValue(2);
+  EXPECT_EQ(h.Value<0>(), 2);
+}
+
+TEST(PromisePool, basic) {
+  PromisePool<int> pool(2);
+  EXPECT_EQ(pool.Size(), 2);
+  auto p1 = pool.Acquire();
+  auto p2 = pool.Acquire();
+  EXPECT_EQ(pool.Acquire(), nullptr);
+
+  int sum = 0;
+  auto f1 = p1->GetFuture().Then([&sum](int v) { sum += v; });
+  auto f2 = p2->GetFuture().Then([&sum](int v) { sum += v; });
+  p1->SetValue(1);
+  pool.Release(p1);
+  // Released before resolved, the round is abandoned.
+  pool.Release(p2);
+  EXPECT_TRUE(f1.Ready());
+  EXPECT_FALSE(f2.Available());
+  EXPECT_EQ(pool.Available(), 2);
+
+  // The last released is handed out first, re-armed.
+  auto p3 = pool.Acquire();
+  EXPECT_EQ(p3, p2);
+  auto f3 = p3->GetFuture();
+  p3->SetValue(3);
+  EXPECT_EQ(f3.Value<0>(), 3);
+  pool.Release(p3);
+  EXPECT_EQ(sum, 1);
+}
+
+TEST(SharedFuture, basic) {
+  Promise<std::string> promise;
+  auto shared = promise.GetFuture().Share();
+  EXPECT_FALSE(shared.Available());
+
+  std::string result;
+  std::vector<Future<>> futures;
+  // Inline for the first three, then spilled.
+  for (int i = 0; i < 4; ++i) {
+    futures.push_back(shared.GetFuture().Then(
+        [&result](std::string s) { result += s; }));
+  }
+  auto copy = shared;
+  promise.SetValue("a");
+  for (auto &future : futures) EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(result, "aaaa");
+  EXPECT_EQ(copy.ValueRef<0>(), "a");
+
+  // Once resolved, a ready future is made right away.
+  auto f = shared.GetFuture();
+  ASSERT_TRUE(f.Ready());
+  EXPECT_EQ(f.Value<0>(), "a");
+  EXPECT_EQ(shared.ValueRef<0>(), "a");
+
+  // Shared once ready.
+  auto s2 = MakeReadyFuture<int>(1).Share();
+  EXPECT_EQ(s2.GetFuture().Value<0>(), 1);
+  EXPECT_EQ(s2.GetFuture().Value<0>(), 1);
+}
+
+TEST(SharedFuture, failed) {
+  Promise<int> promise;
+  auto shared = promise.GetFuture().Share();
+  auto f1 = shared.GetFuture();
+  auto f2 = shared.GetFuture();
+  promise.SetError(std::make_error_code(std::errc::timed_out));
+  ASSERT_TRUE(f1.HasErrorCode());
+  ASSERT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.ErrorCode(), std::errc::timed_out);
+  EXPECT_TRUE(shared.Failed());
+  EXPECT_TRUE(shared.GetFuture().HasErrorCode());
+
+  auto s2 = MakeExceptionalFuture<int>(std::make_exception_ptr(1)).Share();
+  EXPECT_THROW(std::rethrow_exception(s2.GetFuture().Exception()), int);
+  EXPECT_THROW(std::rethrow_exception(s2.GetFuture().Exception()), int);
+}
+
+TEST(SharedFuture, abandoned) {
+  std::optional<Promise<int>> promise(std::in_place);
+  std::optional<SharedFuture<int>> shared(promise->GetFuture().Share());
+  auto future = shared->GetFuture();
+  // Outlived by the source.
+  shared.reset();
+  promise.reset();
+  EXPECT_FALSE(future.Available());
+
+  // Outlives the source.
+  promise.emplace();
+  shared.emplace(promise->GetFuture().Share());
+  promise.reset();
+  EXPECT_FALSE(shared->Available());
+}
+
+// A chain far deeper than the stack allows to run inline.
+TEST(Future, deep_chain) {
+  constexpr int kLength = 1000000;
+  int counter = 0;
+  Promise<> promise;
+  auto future = promise.GetFuture();
+  for (int i = 0; i < kLength; ++i) {
+    future = future.Then([&counter]() { ++counter; });
+  }
+  promise.SetValue();
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, kLength);
+}
+
+TEST(Future, non_default_constructible) {
+  {
+    auto future = MakeReadyFuture<Payload>(Payload(1)).Then([](Payload &&p) {
+      return Payload(p.value() + 1);
+    });
+    EXPECT_TRUE(future.Ready());
+    EXPECT_EQ(future.Value<0>().value(), 2);
+  }
+  {
+    Promise<Payload> promise;
+    auto future =
+        promise.GetFuture().Then([](Payload p) { return p.value(); });
+    EXPECT_FALSE(future.Available());
+    promise.SetValue(Payload(3));
+    EXPECT_TRUE(future.Ready());
+    EXPECT_EQ(future.Value<0>(), 3);
+  }
+  {
+    Promise<Payload, int> promise;
+    auto future = promise.GetFuture().ThenWrap([](Future<Payload, int> ft) {
+      EXPECT_TRUE(ft.Failed());
+      ft.Ignore();
+    });
+    promise.SetException(std::make_exception_ptr(0.1f));
+    EXPECT_TRUE(future.Ready());
+  }
+  {
+    Promise<Payload> promise;
+    auto future = promise.GetFuture();
+    promise.SetValue(Payload(4));
+    auto moved = std::move(future);
+    EXPECT_EQ(moved.Value<0>().value(), 4);
+  }
+  EXPECT_EQ(Payload::live, 0);
+}
+
+namespace {
+
+struct Counted {
+  Counted(int value) : value(value) {}
+  Counted(int value, int scale) : value(value * scale) {}
+  Counted(const Counted &other) : value(other.value) { ++copies; }
+  Counted(Counted &&other) : value(other.value) { ++moves; }
+
+  int value;
+
+  static inline int copies = 0;
+  static inline int moves = 0;
+};
+
+}  // namespace
+
+TEST(Promise, Emplace) {
+  Counted::copies = Counted::moves = 0;
+  {
+    Promise<Counted> promise;
+    auto future = promise.GetFuture();
+    promise.Emplace(2);
+    EXPECT_EQ(future.ValueRef<0>().value, 2);
+  }
+  {
+    Promise<Counted, Counted> promise;
+    auto future = promise.GetFuture();
+    promise.Emplace(1, 2);
+    EXPECT_EQ(future.ValueRef<0>().value, 1);
+    EXPECT_EQ(future.ValueRef<1>().value, 2);
+  }
+  EXPECT_EQ(Counted::copies, 0);
+  EXPECT_EQ(Counted::moves, 0);
+  {
+    // Lvalues are copied rather than moved.
+    Counted counted(3);
+    Promise<Counted> promise;
+    auto future = promise.GetFuture();
+    promise.SetValue(counted);
+    EXPECT_EQ(Counted::copies, 1);
+    EXPECT_EQ(Counted::moves, 0);
+    EXPECT_EQ(future.ValueRef<0>().value, 3);
+  }
+  {
+    Promise<Counted> promise;
+    auto future = promise.GetFuture();
+    promise.Emplace(2, 3);
+    EXPECT_EQ(future.ValueRef<0>().value, 6);
+  }
+}
+
+TEST(Future, ConsumeValue) {
+  Counted::copies = Counted::moves = 0;
+  auto future = MakeReadyFuture<Counted, int>(1, 2);
+  EXPECT_EQ(future.ValueRef<0>().value, 1);
+  EXPECT_EQ(future.ValueRef<1>(), 2);
+  auto sum = future.ConsumeValue([](Counted &&counted, int &&value) {
+    return counted.value + value;
+  });
+  EXPECT_EQ(sum, 3);
+  EXPECT_EQ(Counted::copies, 0);
+  EXPECT_EQ(Counted::moves, 0);
+}
+
 TEST(Promise, basic0) {
   {
     Promise<> promise;
@@ -137,6 +456,17 @@ TEST(Promise, basic1) {
   ASSERT_EQ(counter, 1);
 }
 
+// A promise moved before its future is handed out keeps a state of its own.
+TEST(Promise, move_before_future) {
+  Promise<int> moved;
+  Promise<int> promise(std::move(moved));
+  auto future = promise.GetFuture();
+  EXPECT_FALSE(future.Available());
+  promise.SetValue(1);
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), 1);
+}
+
 TEST(DoUntil, failed) {
   int counter = 0;
   auto future =
@@ -188,8 +518,195 @@ TEST(DoUntil, pending_failed2) {
   ASSERT_EQ(counter, 2);
 }
 
+TEST(Future, ErrorCode) {
+  const auto code = std::make_error_code(std::errc::timed_out);
+  auto future = MakeErrorFuture<int>(code);
+  EXPECT_TRUE(future.Failed());
+  EXPECT_TRUE(future.HasErrorCode());
+  EXPECT_EQ(future.ErrorCode(), code);
+
+  // Converted to an exception on demand.
+  future = MakeErrorFuture<int>(code);
+  try {
+    std::rethrow_exception(future.Exception());
+    FAIL();
+  } catch (const std::system_error & e) {
+    EXPECT_EQ(e.code(), code);
+  }
+
+  // Skips the value callbacks.
+  bool called = false;
+  auto f1 = MakeErrorFuture<int>(code).Then([&called](int) {
+    called = true;
+    return 1;
+  });
+  EXPECT_FALSE(called);
+  EXPECT_TRUE(f1.HasErrorCode());
+  EXPECT_EQ(f1.ErrorCode(), code);
+
+  Promise<int> pr;
+  auto f2 = pr.GetFuture().Then([&called](int) { called = true; });
+  pr.SetError(code);
+  EXPECT_FALSE(called);
+  EXPECT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.ErrorCode(), code);
+
+  // Folded through a returned future.
+  Promise<> pr2;
+  auto f3 = MakeReadyFuture<>().Then([&pr2]() { return pr2.GetFuture(); });
+  pr2.SetError(code);
+  EXPECT_TRUE(f3.HasErrorCode());
+  EXPECT_EQ(f3.ErrorCode(), code);
+}
+
+TEST(Future, ThenOnError) {
+  const auto code = std::make_error_code(std::errc::timed_out);
+  auto f1 = MakeErrorFuture<int>(code).ThenOnError([&code](std::error_code ec) {
+    EXPECT_EQ(ec, code);
+    return 1;
+  });
+  ASSERT_TRUE(f1.Ready());
+  EXPECT_EQ(f1.Value<0>(), 1);
+
+  // Not accepted by the handler, passed on.
+  auto f2 = MakeExceptionalFuture<int>(std::make_exception_ptr("test")).ThenOnError(
+      [](std::error_code) { return 1; });
+  EXPECT_TRUE(f2.Failed());
+  EXPECT_FALSE(f2.HasErrorCode());
+
+  auto f3 = MakeExceptionalFuture<int>(std::make_exception_ptr("test")).ThenOnError(
+      [](std::exception_ptr) { return MakeReadyFuture<int>(2); });
+  ASSERT_TRUE(f3.Ready());
+  EXPECT_EQ(f3.Value<0>(), 2);
+
+  auto f4 = MakeReadyFuture<int>(3).ThenOnError([](std::error_code) {
+    ADD_FAILURE();
+    return 1;
+  });
+  ASSERT_TRUE(f4.Ready());
+  EXPECT_EQ(f4.Value<0>(), 3);
+
+  Promise<> pr;
+  bool called = false;
+  auto f5 = pr.GetFuture().ThenOnError(
+      [&called](std::error_code) { called = true; });
+  ASSERT_FALSE(f5.Available());
+  pr.SetError(code);
+  EXPECT_TRUE(called);
+  EXPECT_TRUE(f5.Ready());
+}
+
+TEST(DoUntil, pending_error) {
+  const auto code = std::make_error_code(std::errc::timed_out);
+  int counter = 0;
+  Promise<> promise;
+  auto future = DoUntil([]() { return false; },
+                        [&counter, &promise]() {
+                          ++counter;
+                          return promise.GetFuture();
+                        });
+  ASSERT_FALSE(future.Available());
+  promise.SetError(code);
+
+  ASSERT_TRUE(future.HasErrorCode());
+  EXPECT_EQ(future.ErrorCode(), code);
+  EXPECT_EQ(counter, 1);
+}
+
+TEST(Future, HandleException) {
+  auto f1 = MakeExceptionalFuture<int>(
+                    std::make_exception_ptr(std::runtime_error("test")))
+                .HandleException<std::logic_error>([](const auto &) {
+                  ADD_FAILURE();
+                  return 1;
+                })
+                .HandleException<std::exception>(
+                    [](const std::exception & e) {
+                      EXPECT_STREQ(e.what(), "test");
+                      return 2;
+                    });
+  ASSERT_TRUE(f1.Ready());
+  EXPECT_EQ(f1.Value<0>(), 2);
+
+  Promise<> pr;
+  bool called = false;
+  auto f2 = pr.GetFuture().HandleExceptionType(
+      [&called](const std::runtime_error &) { called = true; });
+  ASSERT_FALSE(f2.Available());
+  pr.SetException(std::make_exception_ptr(std::runtime_error("test")));
+  EXPECT_TRUE(called);
+  EXPECT_TRUE(f2.Ready());
+
+  // Neither a value nor an error code is touched.
+  auto f3 = MakeReadyFuture<int>(3).HandleExceptionType(
+      [](const std::exception &) { return 1; });
+  ASSERT_TRUE(f3.Ready());
+  EXPECT_EQ(f3.Value<0>(), 3);
+  auto f4 = MakeErrorFuture<>(std::make_error_code(std::errc::timed_out))
+                .HandleExceptionType([](const std::exception &) {});
+  EXPECT_TRUE(f4.HasErrorCode());
+}
+
+TEST(Future, Finally) {
+  int counter = 0;
+  auto f1 = MakeReadyFuture<int>(1).Finally([&counter]() { ++counter; });
+  ASSERT_TRUE(f1.Ready());
+  EXPECT_EQ(f1.Value<0>(), 1);
+
+  Promise<int> pr;
+  auto f2 = pr.GetFuture().Finally([&counter]() { ++counter; });
+  EXPECT_EQ(counter, 1);
+  pr.SetError(std::make_error_code(std::errc::timed_out));
+  EXPECT_EQ(counter, 2);
+  EXPECT_TRUE(f2.HasErrorCode());
+}
+
+TEST(Future, ThenValueOrError) {
+  auto on_value = [](int v) { return v + 1; };
+  auto on_error = [](std::exception_ptr) { return -1; };
+  auto f1 = MakeReadyFuture<int>(1).ThenValueOrError(on_value, on_error);
+  ASSERT_TRUE(f1.Ready());
+  EXPECT_EQ(f1.Value<0>(), 2);
+
+  auto f2 = MakeExceptionalFuture<int>(
+                    std::make_exception_ptr(std::runtime_error("test")))
+                .ThenValueOrError(on_value, on_error);
+  ASSERT_TRUE(f2.Ready());
+  EXPECT_EQ(f2.Value<0>(), -1);
+
+  // An error code isn't accepted by `on_error`, passed on.
+  Promise<int> pr;
+  auto f3 = pr.GetFuture().ThenValueOrError(on_value, on_error);
+  ASSERT_FALSE(f3.Available());
+  pr.SetError(std::make_error_code(std::errc::timed_out));
+  EXPECT_TRUE(f3.HasErrorCode());
+}
+
 constexpr int kTimes = 1000000;
 
+TEST(ReadyFuture, Then) {
+  auto future = MakeReady<int>(1)
+                    .Then([](int v) { return v + 1; })
+                    .Then([](int v) { return MakeReady<int, bool>(v, true); });
+  static_assert(std::is_same_v<decltype(future), ReadyFuture<int, bool>>);
+  EXPECT_EQ(future.ValueRef<0>(), 2);
+  EXPECT_EQ(future.Value(), std::make_tuple(2, true));
+
+  auto f2 = MakeReady<>().Then([]() {});
+  static_assert(std::is_same_v<decltype(f2), ReadyFuture<>>);
+
+  // A callback returning a Future makes a Future, as well as the conversion.
+  Promise<int> promise;
+  auto f3 = MakeReady<>().Then([&promise]() { return promise.GetFuture(); });
+  static_assert(std::is_same_v<decltype(f3), Future<int>>);
+  promise.SetValue(1);
+  EXPECT_EQ(f3.Value<0>(), 1);
+
+  Future<int> f4 = MakeReady<int>(1).Then([](int v) { return v + 1; });
+  ASSERT_TRUE(f4.Ready());
+  EXPECT_EQ(f4.Value<0>(), 2);
+}
+
 TEST(perf, mark) {
   int counter = 0;
   auto do_until = [](auto &&stop, auto &&func) {
@@ -252,6 +769,54 @@ TEST(perf, unready) {
   EXPECT_EQ(counter, kTimes);
 }
 
+// Compare to perf.unready, with a single promise re-armed over and over.
+TEST(perf, unready_rearm) {
+  int counter = 0;
+  Promise<> promise;
+  bool pending = false;
+  auto future = DoUntil([n = kTimes]() mutable { return n-- == 0; },
+                        [&]() {
+                          pending = true;
+                          ++counter;
+                          return promise.Rearm();
+                        });
+
+  while (pending) {
+    pending = false;
+    promise.SetValue();
+  }
+
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, kTimes);
+}
+
+// A result fanned out to three consumers.
+TEST(perf, shared_future) {
+  int counter = 0;
+  for (int i = 0; i < kTimes / 3; ++i) {
+    Promise<int> promise;
+    auto shared = promise.GetFuture().Share();
+    auto f1 = shared.GetFuture();
+    auto f2 = shared.GetFuture();
+    auto f3 = shared.GetFuture();
+    promise.SetValue(1);
+    counter += f1.Value<0>() + f2.Value<0>() + f3.Value<0>();
+  }
+  EXPECT_EQ(counter, kTimes / 3 * 3);
+}
+
+TEST(perf, unready_tail_call) {
+  int counter = 0;
+  Promise<> *pending = nullptr;
+  auto future = AsyncLoop(kTimes, counter, pending);
+  while (pending) {
+    // There is no underlying scheduler, so we can drive it in this way.
+    pending->SetValue();
+  }
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(counter, kTimes);
+}
+
 TEST(perf, ready_then1) {
   ASSERT_EQ(kTimes % 10, 0);
 
@@ -299,6 +864,15 @@ TEST(perf, ready_then3) {
   ASSERT_EQ(counter, kTimes);
 }
 
+TEST(perf, ready_future_then) {
+  int counter = 0;
+  auto future = MakeReady<>();
+  for (int i = 0; i < kTimes; ++i) {
+    future = future.Then([&]() { ++counter; });
+  }
+  ASSERT_EQ(counter, kTimes);
+}
+
 TEST(perf, unready_then) {
   ASSERT_EQ(kTimes % 10, 0);
 
@@ -316,4 +890,100 @@ TEST(perf, unready_then) {
 
   EXPECT_TRUE(future.Ready());
   ASSERT_EQ(counter, kTimes);
-}
\ No newline at end of file
+}
+
+namespace {
+
+// Resolving the head dispatches the whole chain of continuations one by one.
+void UnreadyThenChain(int length) {
+  ASSERT_EQ(kTimes % length, 0);
+
+  int counter = 0;
+  auto future = DoUntil([n = kTimes / length]() mutable { return n-- == 0; },
+                        [&]() {
+                          Promise<> promise;
+                          auto future = promise.GetFuture();
+                          for (int i = 0; i < length; ++i) {
+                            future = future.Then([&]() { ++counter; });
+                          }
+                          promise.SetValue();
+                          return future;
+                        });
+
+  EXPECT_TRUE(future.Ready());
+  ASSERT_EQ(counter, kTimes);
+}
+
+// As above, with four distinct callback types in turn, so the dispatch through
+// the continuations is not the same call site over and over.
+void UnreadyThenMixedChain(int length) {
+  ASSERT_EQ(length % 4, 0);
+  ASSERT_EQ(kTimes % length, 0);
+
+  int counter = 0;
+  auto future = DoUntil([n = kTimes / length]() mutable { return n-- == 0; },
+                        [&]() {
+                          Promise<> promise;
+                          auto future = promise.GetFuture();
+                          for (int i = 0; i < length; i += 4) {
+                            future = future.Then([&]() { ++counter; })
+                                         .Then([&]() { counter += 1; })
+                                         .Then([&counter]() { ++counter; })
+                                         .Then([p = &counter]() { ++*p; });
+                          }
+                          promise.SetValue();
+                          return future;
+                        });
+
+  EXPECT_TRUE(future.Ready());
+  ASSERT_EQ(counter, kTimes);
+}
+
+}  // namespace
+
+TEST(perf, unready_then_chain1) { UnreadyThenChain(1); }
+
+TEST(perf, unready_then_chain100) { UnreadyThenChain(100); }
+
+TEST(perf, unready_then_chain10000) { UnreadyThenChain(10000); }
+
+TEST(perf, unready_then_mixed_chain100) { UnreadyThenMixedChain(100); }
+
+TEST(perf, unready_then_mixed_chain10000) { UnreadyThenMixedChain(10000); }
+
+TEST(perf, handle_exception) {
+  auto e = std::make_exception_ptr(std::runtime_error("test"));
+  int counter = 0;
+  for (int i = 0; i < kTimes; ++i) {
+    MakeExceptionalFuture<>(std::exception_ptr(e))
+        .HandleException<std::logic_error>(
+            [](const std::logic_error &) { ADD_FAILURE(); })
+        .HandleException<std::runtime_error>(
+            [&counter](const std::runtime_error &) { ++counter; })
+        .Ignore();
+  }
+  ASSERT_EQ(counter, kTimes);
+}
+
+TEST(perf, vector_move) {
+  // Futures are moved while growing, then once more one by one, so this is
+  // mainly bound by the memory bandwidth, i.e. the size of a future. Of a
+  // pointer, which the compact layout shrinks from 32 bytes to 24.
+  static_assert(sizeof(Future<void *>) == 3 * sizeof(void *));
+  std::vector<Future<void *>> futures;
+  for (int i = 0; i < kTimes; ++i) {
+    futures.push_back(MakeReadyFuture<void *>(
+        reinterpret_cast<void *>(static_cast<std::uintptr_t>(i))));
+  }
+  std::vector<Future<void *>> moved;
+  for (auto &future : futures) {
+    moved.push_back(std::move(future));
+  }
+
+  long sum = 0;
+  for (auto &future : moved) {
+    EXPECT_TRUE(future.Ready());
+    sum += reinterpret_cast<std::uintptr_t>(future.Value<0>());
+  }
+  ASSERT_EQ(sum, static_cast<long>(kTimes) * (kTimes - 1) / 2);
+}
@@ -0,0 +1,53 @@
+// Built with -fno-exceptions: failures are carried by error codes only.
+
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if __cpp_exceptions
+#error "This test should be built with -fno-exceptions."
+#endif
+
+namespace {
+
+const std::error_code kTimedOut = std::make_error_code(std::errc::timed_out);
+
+}  // namespace
+
+TEST(mfuture, ErrorCode) {
+  using namespace mfuture;
+
+  Promise<int> pr;
+  auto future = pr.GetFuture()
+                    .Then([](int v) { return v + 1; })
+                    .ThenOnError([](std::error_code ec) {
+                      EXPECT_EQ(ec, kTimedOut);
+                      return -1;
+                    });
+  pr.SetError(kTimedOut);
+  ASSERT_TRUE(future.IsReady());
+  EXPECT_EQ(future.GetValue<0>(), -1);
+
+  auto f2 = MakeErrorFuture<>(kTimedOut).Then([]() { ADD_FAILURE(); });
+  ASSERT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.GetErrorCode(), kTimedOut);
+}
+
+TEST(nfuture, ErrorCode) {
+  using namespace nfuture;
+
+  Promise<int> pr;
+  auto future = pr.GetFuture()
+                    .Then([](int v) { return v + 1; })
+                    .ThenOnError([](std::error_code ec) {
+                      EXPECT_EQ(ec, kTimedOut);
+                      return -1;
+                    });
+  pr.SetError(kTimedOut);
+  ASSERT_TRUE(future.Ready());
+  EXPECT_EQ(future.Value<0>(), -1);
+
+  auto f2 = MakeErrorFuture<>(kTimedOut).Then([]() { ADD_FAILURE(); });
+  ASSERT_TRUE(f2.HasErrorCode());
+  EXPECT_EQ(f2.ErrorCode(), kTimedOut);
+}
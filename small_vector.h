@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "alloc.h"
+
+namespace internal {
+
+// A vector keeping up to `N` elements inline, for lists which are short in the
+// common case, e.g. the waiters of a shared future, so that those don't
+// allocate at all. Beyond `N`, elements are moved to the heap as std::vector
+// does, allocating by `kSite`. Only what's needed is provided.
+template <typename T, std::size_t N, AllocSite kSite>
+class SmallVector {
+  static_assert(N > 0);
+
+ public:
+  SmallVector() = default;
+
+  SmallVector(SmallVector&& other) { MoveFrom(std::move(other)); }
+
+  SmallVector& operator=(SmallVector&& other) {
+    if (this != &other) {
+      Release();
+      MoveFrom(std::move(other));
+    }
+    return *this;
+  }
+
+  SmallVector(const SmallVector&) = delete;
+  SmallVector& operator=(const SmallVector&) = delete;
+
+  ~SmallVector() { Release(); }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity_) Grow();
+    auto p = new (data_ + size_) T(std::forward<Args>(args)...);
+    ++size_;
+    return *p;
+  }
+
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  void clear() {
+    // Elements might append to this vector while being destroyed, so one by
+    // one from the back.
+    while (size_) data_[--size_].~T();
+  }
+
+  std::size_t size() const { return size_; }
+  std::size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+
+  // Whether the elements are kept inline.
+  bool is_inline() const { return data_ == Inline(); }
+
+  T& operator[](std::size_t i) {
+    assert(i < size_);
+    return data_[i];
+  }
+
+  const T& operator[](std::size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+ private:
+  T* Inline() { return std::launder(reinterpret_cast<T*>(&inline_)); }
+  const T* Inline() const {
+    return std::launder(reinterpret_cast<const T*>(&inline_));
+  }
+
+  void Grow() {
+    auto capacity = capacity_ * 2;
+    auto data = static_cast<T*>(Allocate(kSite, capacity * sizeof(T)));
+    Relocate(data_, size_, data);
+    if (!is_inline()) Deallocate(kSite, data_, capacity_ * sizeof(T));
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  static void Relocate(T* from, std::size_t size, T* to) {
+    for (std::size_t i = 0; i < size; ++i) {
+      new (to + i) T(std::move(from[i]));
+      from[i].~T();
+    }
+  }
+
+  void Release() {
+    clear();
+    if (!is_inline()) Deallocate(kSite, data_, capacity_ * sizeof(T));
+    data_ = Inline();
+    capacity_ = N;
+  }
+
+  void MoveFrom(SmallVector&& other) {
+    if (other.is_inline()) {
+      data_ = Inline();
+      capacity_ = N;
+      Relocate(other.data_, other.size_, data_);
+    } else {
+      data_ = std::exchange(other.data_, other.Inline());
+      capacity_ = std::exchange(other.capacity_, N);
+    }
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  T* data_ = Inline();
+  std::size_t size_ = 0;
+  std::size_t capacity_ = N;
+  std::aligned_storage_t<sizeof(T) * N, alignof(T)> inline_;
+};
+
+}  // namespace internal
@@ -0,0 +1,43 @@
+#include "small_vector.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+using namespace internal;
+
+TEST(SmallVector, basic) {
+  SmallVector<std::unique_ptr<int>, 2, AllocSite::kWaiters> v;
+  EXPECT_TRUE(v.empty());
+  v.emplace_back(std::make_unique<int>(0));
+  v.push_back(std::make_unique<int>(1));
+  EXPECT_TRUE(v.is_inline());
+
+  // Spilled to the heap.
+  v.emplace_back(std::make_unique<int>(2));
+  EXPECT_FALSE(v.is_inline());
+  ASSERT_EQ(v.size(), 3);
+  EXPECT_EQ(v.capacity(), 4);
+  int i = 0;
+  for (auto& p : v) EXPECT_EQ(*p, i++);
+
+  auto v2 = std::move(v);
+  EXPECT_TRUE(v.empty());
+  EXPECT_TRUE(v.is_inline());
+  EXPECT_EQ(*v2[2], 2);
+
+  v2.clear();
+  EXPECT_TRUE(v2.empty());
+}
+
+TEST(SmallVector, move_inline) {
+  auto counter = std::make_shared<int>(0);
+  SmallVector<std::shared_ptr<int>, 2, AllocSite::kWaiters> v;
+  v.emplace_back(counter);
+  SmallVector<std::shared_ptr<int>, 2, AllocSite::kWaiters> v2;
+  v2 = std::move(v);
+  EXPECT_TRUE(v2.is_inline());
+  ASSERT_EQ(v2.size(), 1);
+  EXPECT_EQ(v2[0], counter);
+  EXPECT_EQ(counter.use_count(), 2);
+}
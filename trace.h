@@ -0,0 +1,321 @@
+#pragma once
+
+// Tracing of future chains, with MFUTURE_TRACE defined to 1. Creating a future,
+// attaching a continuation to it, resolving it and running the continuation
+// are recorded as events into a ring buffer of the calling thread, which is
+// fixed-size and lock-free, so that it's fine to be kept on in production. The
+// oldest events are overwritten once it's full.
+//
+// Each event carries the id of the chain (flow) its future belongs to. A
+// future created by Then() takes the flow of the one it's chained to, and so
+// does one created while a continuation runs, e.g. the future a callback
+// returns, which is folded into the chain. Otherwise a new flow is started.
+//
+// `WriteChromeTrace()` dumps the events of all threads as Chrome trace-event
+// JSON, which Perfetto or chrome://tracing loads, with the events of a chain
+// linked by flow arrows.
+//
+// A buffer takes 40 bytes per event, 320 KiB by default, for each thread
+// tracing. Once a thread exits, its buffer is kept for dumping, though only
+// for the latest MFUTURE_TRACE_EXITED_THREADS ones exited, so that threads
+// started over and over don't grow the memory without bound.
+//
+// Otherwise nothing is compiled into the futures.
+
+#ifndef MFUTURE_TRACE
+#define MFUTURE_TRACE 0
+#endif
+
+// Events kept per thread, a power of two.
+#ifndef MFUTURE_TRACE_CAPACITY
+#define MFUTURE_TRACE_CAPACITY 8192
+#endif
+
+// Buffers of exited threads kept for dumping, the older ones are released.
+#ifndef MFUTURE_TRACE_EXITED_THREADS
+#define MFUTURE_TRACE_EXITED_THREADS 16
+#endif
+
+#if MFUTURE_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+
+namespace internal {
+
+enum class TraceEvent : std::uint8_t {
+  kCreate,   // A future is created.
+  kAttach,   // A continuation is attached to a pending future.
+  kResolve,  // A future is resolved, by its promise.
+  kRun,      // A continuation runs, for `duration`.
+};
+
+inline const char* TraceEventName(TraceEvent event) {
+  static constexpr const char* kNames[] = {"create", "attach", "resolve",
+                                           "run"};
+  return kNames[static_cast<std::size_t>(event)];
+}
+
+struct TraceRecord {
+  std::uint64_t time;      // Nanoseconds, by the steady clock.
+  std::uint64_t duration;  // Nanoseconds, of kRun only.
+  std::uint64_t flow;
+  TraceEvent event;
+};
+
+// Written by its own thread only, and read by any. Each slot is guarded by a
+// sequence number, odd while being written, so that a reader skips the slots
+// overwritten under it instead of waiting.
+class TraceBuffer {
+ public:
+  static constexpr std::size_t kCapacity = MFUTURE_TRACE_CAPACITY;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "MFUTURE_TRACE_CAPACITY should be a power of two.");
+
+  explicit TraceBuffer(std::uint32_t thread) : thread_(thread) {}
+
+  TraceBuffer(const TraceBuffer&) = delete;
+  TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+  void Record(const TraceRecord& record) {
+    auto n = head_.load(std::memory_order_relaxed);
+    auto& slot = slots_[n & (kCapacity - 1)];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(record.time, std::memory_order_relaxed);
+    slot.duration.store(record.duration, std::memory_order_relaxed);
+    slot.flow.store(record.flow, std::memory_order_relaxed);
+    slot.event.store(record.event, std::memory_order_relaxed);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+    head_.store(n + 1, std::memory_order_release);
+  }
+
+  // The events kept, oldest first.
+  std::vector<TraceRecord> Snapshot() const {
+    std::vector<TraceRecord> records;
+    auto head = head_.load(std::memory_order_acquire);
+    auto n = head > kCapacity ? head - kCapacity : 0;
+    records.reserve(head - n);
+    for (; n < head; ++n) {
+      auto& slot = slots_[n & (kCapacity - 1)];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      if (seq != 2 * n + 2) continue;
+      TraceRecord record{slot.time.load(std::memory_order_relaxed),
+                         slot.duration.load(std::memory_order_relaxed),
+                         slot.flow.load(std::memory_order_relaxed),
+                         slot.event.load(std::memory_order_relaxed)};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+      records.push_back(record);
+    }
+    return records;
+  }
+
+  // Numbered from 1 in the order threads start tracing.
+  std::uint32_t Thread() const { return thread_; }
+
+  // A flow id unique across threads, without any synchronization.
+  std::uint64_t NewFlow() {
+    return static_cast<std::uint64_t>(thread_) << 40 | ++flows_;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<std::uint64_t> seq{0};
+    std::atomic<std::uint64_t> time{0};
+    std::atomic<std::uint64_t> duration{0};
+    std::atomic<std::uint64_t> flow{0};
+    std::atomic<TraceEvent> event{TraceEvent::kCreate};
+  };
+
+  const std::uint32_t thread_;
+  std::uint64_t flows_ = 0;
+  std::atomic<std::uint64_t> head_{0};
+  Slot slots_[kCapacity];
+};
+
+// Buffers of the threads tracing, and of the latest ones exited, so that their
+// events are still dumped. Only taken as a thread starts or exits, and by
+// dumping.
+struct TraceRegistry {
+  static constexpr std::size_t kExitedThreads = MFUTURE_TRACE_EXITED_THREADS;
+
+  std::mutex mutex;
+  std::uint32_t threads = 0;  // Ever traced.
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  std::deque<std::shared_ptr<TraceBuffer>> exited;  // Oldest first.
+
+  // Kept past static destruction, for a thread exiting late to retire its
+  // buffer into.
+  static TraceRegistry& Get() {
+    static auto registry = new TraceRegistry;
+    return *registry;
+  }
+};
+
+// Registers the buffer of a thread, and retires it once the thread exits.
+class TraceThread {
+ public:
+  TraceThread() {
+    auto& registry = TraceRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffer_ = std::make_shared<TraceBuffer>(++registry.threads);
+    registry.buffers.push_back(buffer_);
+  }
+
+  ~TraceThread() {
+    auto& registry = TraceRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto& buffers = registry.buffers;
+    buffers.erase(std::find(buffers.begin(), buffers.end(), buffer_));
+    if (TraceRegistry::kExitedThreads == 0) return;
+    if (registry.exited.size() == TraceRegistry::kExitedThreads)
+      registry.exited.pop_front();
+    registry.exited.push_back(std::move(buffer_));
+  }
+
+  TraceThread(const TraceThread&) = delete;
+  TraceThread& operator=(const TraceThread&) = delete;
+
+  TraceBuffer& Buffer() { return *buffer_; }
+
+ private:
+  std::shared_ptr<TraceBuffer> buffer_;
+};
+
+inline TraceBuffer& ThreadTraceBuffer() {
+  static thread_local TraceThread thread;
+  return thread.Buffer();
+}
+
+// The flow of the continuation running on this thread, if any.
+inline std::uint64_t& CurrentTraceFlow() {
+  static thread_local std::uint64_t flow = 0;
+  return flow;
+}
+
+inline void Trace(TraceEvent event, std::uint64_t flow) {
+  ThreadTraceBuffer().Record({NowNanoseconds(), 0, flow, event});
+}
+
+// Records a future created, and returns its flow.
+inline std::uint64_t TraceCreate() {
+  auto flow = CurrentTraceFlow();
+  if (!flow) flow = ThreadTraceBuffer().NewFlow();
+  Trace(TraceEvent::kCreate, flow);
+  return flow;
+}
+
+// Futures created within the scope belong to `flow`.
+class TraceScope {
+ public:
+  explicit TraceScope(std::uint64_t flow)
+      : saved_(std::exchange(CurrentTraceFlow(), flow)) {}
+
+  ~TraceScope() { CurrentTraceFlow() = saved_; }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  std::uint64_t saved_;
+};
+
+// Records a continuation of `flow` running, for the lifetime of the object.
+class TraceRun {
+ public:
+  explicit TraceRun(std::uint64_t flow)
+      : scope_(flow), flow_(flow), start_(NowNanoseconds()) {}
+
+  ~TraceRun() {
+    ThreadTraceBuffer().Record(
+        {start_, NowNanoseconds() - start_, flow_, TraceEvent::kRun});
+  }
+
+  TraceRun(const TraceRun&) = delete;
+  TraceRun& operator=(const TraceRun&) = delete;
+
+ private:
+  TraceScope scope_;
+  std::uint64_t flow_;
+  std::uint64_t start_;
+};
+
+// Dumps the events of all the threads. Each one is a complete event ("X"),
+// lasting for the runs, and the ones of a flow are linked by flow events, in
+// the order of time.
+inline void WriteChromeTrace(std::ostream& out) {
+  struct Event {
+    TraceRecord record;
+    std::uint32_t thread;
+  };
+  std::vector<Event> events;
+  {
+    auto& registry = TraceRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto add = [&events](const TraceBuffer& buffer) {
+      for (auto& record : buffer.Snapshot())
+        events.push_back({record, buffer.Thread()});
+    };
+    for (auto& buffer : registry.exited) add(*buffer);
+    for (auto& buffer : registry.buffers) add(*buffer);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event& a, const Event& b) {
+                     return a.record.time < b.record.time;
+                   });
+
+  // The last event of each flow, which ends it.
+  std::unordered_map<std::uint64_t, std::size_t> last;
+  for (std::size_t i = 0; i < events.size(); ++i)
+    last[events[i].record.flow] = i;
+
+  std::unordered_map<std::uint64_t, bool> started;
+  char buf[256];
+  const char* separator = "";
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    auto& [record, thread] = events[i];
+    // Microseconds, as Chrome expects.
+    double ts = record.time / 1e3;
+    std::snprintf(buf, sizeof(buf),
+                  "%s\n{\"name\":\"%s\",\"cat\":\"future\",\"ph\":\"X\","
+                  "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%" PRIu32
+                  ",\"args\":{\"flow\":%" PRIu64 "}}",
+                  separator, TraceEventName(record.event), ts,
+                  record.duration / 1e3, thread, record.flow);
+    out << buf;
+    separator = ",";
+
+    const char* phase = "t";
+    if (!std::exchange(started[record.flow], true))
+      phase = "s";
+    else if (last[record.flow] == i)
+      phase = "f";
+    if (*phase == 's' && last[record.flow] == i) continue;  // Alone.
+    std::snprintf(buf, sizeof(buf),
+                  ",\n{\"name\":\"chain\",\"cat\":\"future\",\"ph\":\"%s\","
+                  "\"bp\":\"e\",\"id\":%" PRIu64 ",\"ts\":%.3f,\"pid\":1,"
+                  "\"tid\":%" PRIu32 "}",
+                  phase, record.flow, ts, thread);
+    out << buf;
+  }
+  out << "\n]}\n";
+}
+
+}  // namespace internal
+
+#endif  // MFUTURE_TRACE
@@ -0,0 +1,196 @@
+// Built with MFUTURE_TRACE, so that futures are traced.
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mfuture.h"
+#include "nfuture.h"
+
+#if !MFUTURE_TRACE
+#error "This test should be built with MFUTURE_TRACE=1."
+#endif
+
+using internal::TraceBuffer;
+using internal::TraceEvent;
+using internal::TraceRecord;
+
+namespace {
+
+// The flow of the last event of this thread.
+std::uint64_t LastFlow() {
+  return internal::ThreadTraceBuffer().Snapshot().back().flow;
+}
+
+std::size_t Count(std::uint64_t flow, TraceEvent event) {
+  auto records = internal::ThreadTraceBuffer().Snapshot();
+  return std::count_if(records.begin(), records.end(),
+                       [&](const TraceRecord& record) {
+                         return record.flow == flow && record.event == event;
+                       });
+}
+
+}  // namespace
+
+TEST(Trace, nfuture_chain) {
+  using namespace nfuture;
+
+  Promise<int> promise;
+  auto flow = LastFlow();
+  auto future = promise.GetFuture()
+                    .Then([](int v) { return v + 1; })
+                    .Then([](int v) { return v + 1; });
+  EXPECT_EQ(Count(flow, TraceEvent::kCreate), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kAttach), 2);
+  EXPECT_EQ(Count(flow, TraceEvent::kRun), 0);
+
+  promise.SetValue(1);
+  EXPECT_EQ(future.Value<0>(), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kResolve), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kRun), 2);
+
+  // Another chain.
+  Promise<> other;
+  EXPECT_NE(LastFlow(), flow);
+}
+
+TEST(Trace, nfuture_fold) {
+  using namespace nfuture;
+
+  Promise<int> inner;
+  auto inner_flow = LastFlow();
+  Promise<int> promise;
+  auto flow = LastFlow();
+  ASSERT_NE(inner_flow, flow);
+
+  auto future = promise.GetFuture().Then(
+      [&](int) { return inner.GetFuture(); });
+  promise.SetValue(1);
+  EXPECT_FALSE(future.Available());
+
+  // Once folded, the inner promise resolves the chain.
+  inner.SetValue(2);
+  EXPECT_EQ(future.Value<0>(), 2);
+  EXPECT_EQ(Count(flow, TraceEvent::kResolve), 2);
+  EXPECT_EQ(Count(inner_flow, TraceEvent::kResolve), 0);
+}
+
+TEST(Trace, mfuture_chain) {
+  using namespace mfuture;
+
+  Promise<int> promise;
+  auto flow = LastFlow();
+  auto future = promise.GetFuture()
+                    .Then([](int v) { return v + 1; })
+                    .Then([](int v) { return v + 1; });
+  EXPECT_EQ(Count(flow, TraceEvent::kCreate), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kAttach), 2);
+
+  promise.SetValue(1);
+  EXPECT_EQ(future.GetValue<0>(), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kResolve), 3);
+  EXPECT_EQ(Count(flow, TraceEvent::kRun), 2);
+}
+
+TEST(Trace, mfuture_fold) {
+  using namespace mfuture;
+
+  Promise<int> inner;
+  auto inner_flow = LastFlow();
+  Promise<int> promise;
+  auto flow = LastFlow();
+  ASSERT_NE(inner_flow, flow);
+
+  auto future = promise.GetFuture().Then(
+      [&](int) { return inner.GetFuture(); });
+  promise.SetValue(1);
+  EXPECT_FALSE(future.IsResolved());
+
+  inner.SetValue(2);
+  EXPECT_EQ(future.GetValue<0>(), 2);
+  EXPECT_EQ(Count(flow, TraceEvent::kResolve), 2);
+  EXPECT_EQ(Count(inner_flow, TraceEvent::kResolve), 0);
+}
+
+TEST(Trace, ring) {
+  auto buffer = std::make_unique<TraceBuffer>(1);
+  EXPECT_TRUE(buffer->Snapshot().empty());
+  for (std::uint64_t i = 0; i < TraceBuffer::kCapacity + 10; ++i)
+    buffer->Record({i, 0, 1, TraceEvent::kCreate});
+  // The oldest ones are overwritten.
+  auto records = buffer->Snapshot();
+  ASSERT_EQ(records.size(), TraceBuffer::kCapacity);
+  EXPECT_EQ(records.front().time, 10);
+  EXPECT_EQ(records.back().time, TraceBuffer::kCapacity + 9);
+}
+
+TEST(Trace, concurrent_snapshot) {
+  auto buffer = std::make_unique<TraceBuffer>(1);
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (std::uint64_t i = 1; i <= 1000000; ++i)
+      buffer->Record({i, i, i, TraceEvent::kRun});
+    done = true;
+  });
+  // Never torn, nor out of order.
+  do {
+    std::uint64_t last = 0;
+    for (auto& record : buffer->Snapshot()) {
+      ASSERT_EQ(record.duration, record.time);
+      ASSERT_EQ(record.flow, record.time);
+      ASSERT_GT(record.time, last);
+      last = record.time;
+    }
+  } while (!done);
+  writer.join();
+}
+
+TEST(Trace, chrome) {
+  using namespace nfuture;
+
+  Promise<> promise;
+  auto flow = LastFlow();
+  auto future = promise.GetFuture().Then([] {});
+  promise.SetValue();
+
+  std::ostringstream out;
+  internal::WriteChromeTrace(out);
+  auto json = out.str();
+  EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0);
+  EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+  auto id = std::to_string(flow);
+  EXPECT_NE(json.find("\"name\":\"run\""), std::string::npos);
+  EXPECT_NE(json.find("\"ph\":\"s\",\"bp\":\"e\",\"id\":" + id + ","),
+            std::string::npos);
+  EXPECT_NE(json.find("\"ph\":\"f\",\"bp\":\"e\",\"id\":" + id + ","),
+            std::string::npos);
+}
+
+TEST(Trace, exited_threads) {
+  constexpr auto kExited = internal::TraceRegistry::kExitedThreads;
+  std::vector<std::uint32_t> threads;
+  for (std::size_t i = 0; i < kExited + 3; ++i) {
+    std::thread([&threads] {
+      internal::TraceCreate();
+      threads.push_back(internal::ThreadTraceBuffer().Thread());
+    }).join();
+  }
+
+  // Only the latest ones exited are kept.
+  auto& registry = internal::TraceRegistry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  ASSERT_EQ(registry.exited.size(), kExited);
+  if (kExited > 0) {
+    EXPECT_EQ(registry.exited.front()->Thread(), threads[3]);
+    EXPECT_EQ(registry.exited.back()->Thread(), threads.back());
+  }
+  for (auto& buffer : registry.buffers)
+    EXPECT_TRUE(std::find(threads.begin(), threads.end(), buffer->Thread()) ==
+                threads.end());
+}
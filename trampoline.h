@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+
+#include "alloc.h"
+
+namespace internal {
+
+// Bounds the nesting of continuations running inline. Resolving a promise runs
+// its continuation right away, which may resolve another promise, and so on,
+// all on the C++ stack. Up to `kMaxDepth` levels are run inline, keeping the
+// latency of the common shallow case, beyond which a continuation is deferred
+// to a thread-local queue, drained by the outermost level before it returns.
+//
+// A deferred continuation runs later than its promise is resolved, though
+// still before the outermost resolution returns.
+class Trampoline {
+ public:
+  using Function = void (*)(void*);
+
+  static constexpr int kMaxDepth = 64;
+
+  // Runs `function(arg)` inline if nesting allows, or defers it.
+  static void Run(Function function, void* arg) {
+    if (CanRunInline())
+      RunInline([function, arg]() { function(arg); });
+    else
+      Defer(function, arg);
+  }
+
+  static bool CanRunInline() { return depth_ < kMaxDepth; }
+
+  // Runs `f()` one level deeper, draining the deferred ones if it's the
+  // outermost, even if `f()` throws. Should only be called if
+  // `CanRunInline()`.
+  template <typename F>
+  static void RunInline(F&& f) {
+    Outermost outermost;
+    Level level;
+    f();
+  }
+
+  static void Defer(Function function, void* arg) {
+    Queue().push_back({function, arg});
+    ++pending_;
+  }
+
+  static int Depth() { return depth_; }
+
+ private:
+  struct Entry {
+    Function function;
+    void* arg;
+  };
+
+  struct Level {
+    Level() { ++depth_; }
+    ~Level() { --depth_; }
+  };
+
+  // Drains as the outermost level exits, whichever way. A deferred one
+  // throwing is passed on, unless `f()` is throwing already, which
+  // terminates as any destructor throwing during unwinding does.
+  struct Outermost {
+    ~Outermost() noexcept(false) {
+      if (pending_ && depth_ == 0) Drain();
+    }
+  };
+
+  using DeferredQueue = SiteVector<Entry, AllocSite::kDeferredQueue>;
+
+  static DeferredQueue& Queue() {
+    static thread_local DeferredQueue queue;
+    return queue;
+  }
+
+  // Runs at the outermost level, so each deferred one may again nest up to
+  // `kMaxDepth`, deferring more to the end of the queue. An entry is popped
+  // before it runs, so that a throwing one is never run again.
+  [[gnu::noinline, gnu::cold]] static void Drain() {
+    auto& queue = Queue();
+    Level level;
+    while (pending_) {
+      auto entry = queue[queue.size() - pending_--];
+      entry.function(entry.arg);
+    }
+    queue.clear();
+  }
+
+  // Both are trivial, so that the inline path checks no initialization guard.
+  static inline thread_local int depth_ = 0;
+  static inline thread_local std::size_t pending_ = 0;
+};
+
+}  // namespace internal
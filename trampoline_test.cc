@@ -0,0 +1,72 @@
+#include "trampoline.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace internal;
+
+namespace {
+
+struct Recursion {
+  int remaining;
+  int max_depth = 0;
+  std::vector<int> order = {};
+};
+
+void Recurse(void* arg) {
+  auto recursion = static_cast<Recursion*>(arg);
+  recursion->max_depth = std::max(recursion->max_depth, Trampoline::Depth());
+  recursion->order.push_back(recursion->remaining);
+  if (recursion->remaining-- > 0) Trampoline::Run(&Recurse, recursion);
+}
+
+}  // namespace
+
+TEST(Trampoline, basic) {
+  Recursion shallow{10};
+  Trampoline::Run(&Recurse, &shallow);
+  EXPECT_EQ(shallow.order.size(), 11);
+  EXPECT_EQ(shallow.max_depth, 11);
+
+  // Far deeper than the stack allows, while never nested beyond the limit.
+  Recursion deep{1000000};
+  Trampoline::Run(&Recurse, &deep);
+  ASSERT_EQ(deep.order.size(), 1000001);
+  EXPECT_EQ(deep.max_depth, Trampoline::kMaxDepth);
+  for (int i = 0; i < 1000001; ++i) ASSERT_EQ(deep.order[i], 1000000 - i);
+  EXPECT_EQ(Trampoline::Depth(), 0);
+}
+
+TEST(Trampoline, deferred_order) {
+  std::vector<int> order;
+  Trampoline::RunInline([&]() {
+    Trampoline::Defer(
+        [](void* p) { static_cast<std::vector<int>*>(p)->push_back(1); },
+        &order);
+    Trampoline::Defer(
+        [](void* p) { static_cast<std::vector<int>*>(p)->push_back(2); },
+        &order);
+    order.push_back(0);
+  });
+  // Drained in order before the outermost returns.
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2}));
+}
+
+TEST(Trampoline, drained_on_throw) {
+  int ran = 0;
+  EXPECT_THROW(Trampoline::RunInline([&]() {
+                 Trampoline::Defer([](void* p) { ++*static_cast<int*>(p); },
+                                   &ran);
+                 throw std::runtime_error("test");
+               }),
+               std::runtime_error);
+  EXPECT_EQ(ran, 1);
+  EXPECT_EQ(Trampoline::Depth(), 0);
+
+  // None is left behind for the next one.
+  Trampoline::RunInline([]() {});
+  EXPECT_EQ(ran, 1);
+}